@@ -338,6 +338,13 @@ void mi_thread_init(void);
 /// be freed by other threads in the future) is properly handled.
 void mi_thread_done(void);
 
+/// Signal that the current thread is about to be idle for a while.
+/// Frees the empty pages of the heaps of this thread and purges the free
+/// memory in its segments, such that a parked thread (as in a thread pool)
+/// does not hold on to memory that it does not use. The thread can keep
+/// allocating afterwards. See also the `mi_option_idle_trim_delay` option.
+void mi_thread_idle_hint(void);
+
 /// Print out heap statistics for this thread.
 /// @param out An output function or \a NULL for the default.
 /// @param arg Optional argument passed to \a out (if not \a NULL)
@@ -409,6 +416,36 @@ typedef void (mi_error_fun)(int err, void* arg);
 /// * \a EINVAL: Trying to free or re-allocate an invalid pointer.
 void mi_register_error(mi_error_fun* errfun, void* arg);
 
+/// Memory pressure levels.
+/// @see mi_register_pressure_handler()
+typedef enum mi_pressure_e {
+  mi_pressure_none,       ///< No memory pressure.
+  mi_pressure_moderate,   ///< Memory is getting scarce (for example, a cgroup PSI trigger or `memory.high` event on Linux).
+  mi_pressure_critical    ///< Memory is (almost) exhausted (for example, a cgroup `memory.max` event on Linux).
+} mi_pressure_t;
+
+/// Type of memory pressure handlers.
+/// @param level The pressure level.
+/// @param size  The size of the request that caused the pressure, or 0 if not known.
+/// @param arg   Argument that was passed at registration to hold extra state.
+/// @see mi_register_pressure_handler()
+typedef void (mi_pressure_fun)(mi_pressure_t level, size_t size, void* arg);
+
+/// Register a memory pressure handler.
+/// @param fun The handler, or \a NULL to unregister.
+/// @param arg Argument that will be passed on to the handler.
+///
+/// The handler is called when the OS signals memory pressure (when using `MIMALLOC_WATCH_MEMORY_PRESSURE=1`)
+/// so the application can release memory, like shrinking caches. It is then called from a helper thread.
+/// While under pressure, mimalloc also purges unused memory sooner.
+/// The handler is also called (with ::mi_pressure_critical) when an OS allocation failed,
+/// and (with ::mi_pressure_moderate) when the committed memory crosses `MIMALLOC_COMMIT_PRESSURE_THRESHOLD`.
+/// As these are detected in the middle of an allocation, the handler is not called right away but
+/// from the allocating thread at a safe point: at its next allocation that is not served from a free list,
+/// at the next mi_collect(), and before an allocation that ran out of memory is retried.
+/// The handler can thus allocate and free memory, for example to release a cache so the retry succeeds.
+void mi_register_pressure_handler(mi_pressure_fun* fun, void* arg);
+
 /// Is a pointer part of our heap?
 /// @param p The pointer to check.
 /// @returns \a true if this is a pointer into our heap.
@@ -466,6 +503,25 @@ int mi_reserve_huge_os_pages_interleave(size_t pages, size_t numa_nodes, size_t
 /// fragmented.
 int mi_reserve_huge_os_pages_at(size_t pages, int numa_node, size_t timeout_msecs);
 
+/// Type of the function called when the huge OS page reservation at startup is done.
+/// @param err  0 if successful, \a ENOMEM if running out of memory, or \a ETIMEDOUT if timed out.
+/// @param arg  The argument passed to mi_register_reserve_huge_os_pages_done().
+/// @see mi_register_reserve_huge_os_pages_done()
+typedef void (mi_reserve_done_fun)(int err, void* arg);
+
+/// Register a function that is called when the huge OS pages that are reserved at startup in a
+/// background thread (using `MIMALLOC_RESERVE_HUGE_OS_PAGES_ASYNC=1`) are reserved.
+/// @param fun  The function to call (on the background thread), or right away if no reservation is pending.
+/// @param arg  Argument passed to \a fun.
+///
+/// Only one function can be registered.
+void mi_register_reserve_huge_os_pages_done(mi_reserve_done_fun* fun, void* arg);
+
+/// Is the huge OS page reservation at startup done?
+/// @param err  If not \a NULL, set to the error code of the reservation when it is done.
+/// @returns \a true if the reservation is done, or if there was no reservation in a background thread.
+bool mi_reserve_huge_os_pages_is_done(int* err);
+
 
 /// Is the C runtime \a malloc API redirected?
 /// @returns \a true if all malloc API calls are redirected to mimalloc.
@@ -534,11 +590,97 @@ int   mi_reserve_os_memory_ex(size_t size, bool commit, bool allow_large, bool e
 /// @return `true` if successful.
 bool  mi_manage_os_memory_ex(void* start, size_t size, bool is_committed, bool is_large, bool is_zero, int numa_node, bool exclusive, mi_arena_id_t* arena_id);
 
+/// @brief Manage a shared memory area as an arena that is shared between processes.
+/// @param start    Start address of the area; must be aligned to the segment size (4MiB).
+/// @param size     Size in bytes of the area (at least 8MiB).
+/// @param arena_id The arena identifier.
+/// @return `true` if successful.
+///
+/// The memory should be mapped with `MAP_SHARED` (for example from a `memfd` or POSIX shared
+/// memory object), be zero-initialized when it is first used, and be mapped at the same
+/// address in every process that calls this function. The first caller initializes
+/// the arena meta data in the first 4MiB of the area and the others attach to it.
+/// If the initializing process does not finish within a few seconds (as it may have
+/// terminated while initializing), the others give up and this function returns `false`.
+/// At most 4 shared areas can be managed at the same time; these use separate arena slots
+/// (and do not count toward the limit of regular arenas) and attaching fails in a process
+/// where the slot of the area is already used, so all processes should manage their shared
+/// memory areas in the same order.
+/// The arena is exclusive and pinned: use a heap from mi_heap_new_in_arena() to
+/// allocate in it. Blocks can be freed by any thread in any of the processes and are
+/// returned to the owning thread. Abandoned memory is only reclaimed by the process that
+/// allocated it, and memory of a process that exits without freeing it is not reclaimed.
+/// In a child process created with `fork()` any heaps in a shared arena start out empty as
+/// their memory still belongs to the parent.
+/// @see mi_unmanage_shared_memory()
+bool  mi_manage_shared_memory(void* start, size_t size, mi_arena_id_t* arena_id);
+
+/// @brief Stop managing a shared memory area in this process.
+/// @param arena_id The arena identifier returned from mi_manage_shared_memory().
+/// @return `true` if successful.
+///
+/// This fails if this process still has memory allocated in the area (so delete or
+/// collect the heaps in it first). Afterwards the area can be unmapped in this process;
+/// the other processes that manage it are not affected.
+bool  mi_unmanage_shared_memory(mi_arena_id_t arena_id);
+
 /// @brief Create a new heap that only allocates in the specified arena.
 /// @param arena_id The arena identifier.
 /// @return The new heap or `NULL`.
 mi_heap_t* mi_heap_new_in_arena(mi_arena_id_t arena_id);
 
+/// Lock the memory of an I/O arena (using `mlock`) so it is never paged out.
+#define MI_IO_ARENA_LOCK      (1)
+
+/// Fault in all the pages of an I/O arena up front.
+#define MI_IO_ARENA_PREFAULT  (2)
+
+/// The default flags for an I/O arena: locked and pre-faulted.
+#define MI_IO_ARENA_DEFAULT   (MI_IO_ARENA_LOCK | MI_IO_ARENA_PREFAULT)
+
+/// The alignment (and size granularity) of I/O buffers (see mi_heap_malloc_io()).
+#define MI_IO_BLOCK_ALIGN     (4096)
+
+/// @brief Reserve an exclusive arena for I/O buffers (experimental).
+/// @param size     Size in bytes of the arena; rounded up to a multiple of the arena block size (4MiB).
+/// @param flags    Any combination of #MI_IO_ARENA_LOCK and #MI_IO_ARENA_PREFAULT (or #MI_IO_ARENA_DEFAULT).
+/// @param arena_id The new arena identifier.
+/// @return 0 if successful, \a EINVAL for an invalid size, or \a ENOMEM if the memory could not be reserved or locked.
+///
+/// The memory of the arena is pinned: it is never decommitted or reset so buffers stay at
+/// stable addresses and (when locked) resident, as needed for buffers that are registered once
+/// with `io_uring_register_buffers`, or for `O_DIRECT`. Locking can fail if the size exceeds
+/// the `RLIMIT_MEMLOCK` limit of the process. Use a heap from mi_heap_new_in_arena() and
+/// allocate the buffers with mi_heap_malloc_io().
+/// In secure mode the segments in the arena still use guard pages: these are only protected
+/// (and stay locked) when a segment is allocated, which does not affect the buffer addresses.
+int mi_io_arena_new(size_t size, int flags, mi_arena_id_t* arena_id);
+
+/// A contiguous range of memory in an arena (see mi_arena_ranges()).
+typedef struct mi_arena_range_s {
+  void*  start;  ///< Start of the range.
+  size_t size;   ///< Size of the range in bytes.
+} mi_arena_range_t;
+
+/// @brief Get the contiguous memory ranges of an arena.
+/// @param arena_id       The arena identifier.
+/// @param max_range_size The maximum size of a range (or 0 for no maximum), for example
+///                       the 1GiB per-buffer limit of `io_uring_register_buffers`.
+/// @param ranges         Array to store the ranges in.
+/// @param ranges_count   The number of entries in \a ranges.
+/// @return The number of ranges of the arena (which can be more than \a ranges_count; only the first \a ranges_count are stored).
+size_t mi_arena_ranges(mi_arena_id_t arena_id, size_t max_range_size, mi_arena_range_t* ranges, size_t ranges_count);
+
+/// @brief Allocate an I/O buffer.
+/// @param heap  The heap to allocate in (usually a heap in an I/O arena, see mi_io_arena_new()).
+/// @param size  The size in bytes; rounded up to a multiple of #MI_IO_BLOCK_ALIGN.
+/// @return A pointer aligned to #MI_IO_BLOCK_ALIGN, or \a NULL if out of memory.
+void* mi_heap_malloc_io(mi_heap_t* heap, size_t size);
+
+/// @brief Allocate a zero initialized I/O buffer.
+/// @see mi_heap_malloc_io()
+void* mi_heap_zalloc_io(mi_heap_t* heap, size_t size);
+
 /// @brief Create a new heap
 /// @param heap_tag       The heap tag associated with this heap; heaps only reclaim memory between heaps with the same tag.
 /// @param allow_destroy  Is \a mi_heap_destroy allowed?  Not allowing this allows the heap to reclaim memory from terminated threads.
@@ -551,6 +693,28 @@ mi_heap_t* mi_heap_new_in_arena(mi_arena_id_t arena_id);
 /// This is used for example in the CPython integration.
 mi_heap_t* mi_heap_new_ex(int heap_tag, bool allow_destroy, mi_arena_id_t arena_id);
 
+/// Purge and commit policy of a heap.
+/// @see mi_heap_new_with_policy()
+typedef struct mi_heap_policy_s {
+  long purge_delay;       ///< Purge unused pages after N milli-seconds (-1 = never purge, 0 = purge immediately).
+  bool purge_decommits;   ///< Decommit memory on a purge (instead of resetting it).
+  bool eager_commit;      ///< Always commit new segments eagerly.
+} mi_heap_policy_t;
+
+/// Initialize a heap policy from the current options (`mi_option_purge_delay`, `mi_option_purge_decommits`, and `mi_option_eager_commit`).
+void mi_heap_policy_init(mi_heap_policy_t* policy);
+
+/// @brief Create a new heap with its own purge and commit policy.
+/// @param policy The policy (initialize it first with  mi_heap_policy_init), or `NULL` to use the global options.
+/// @return A new heap or `NULL` on failure.
+///
+/// The policy applies to pages freed by the heap and to new segments allocated for it
+/// (as segments are shared between the heaps of a thread, other heaps can use them too).
+/// For example, a latency critical heap can never purge (`purge_delay = -1`) and commit eagerly,
+/// while a heap for background jobs can purge its pages immediately when they are freed (`purge_delay = 0`)
+/// to reduce the resident memory without affecting the other heaps.
+mi_heap_t* mi_heap_new_with_policy(const mi_heap_policy_t* policy);
+
 /// A process can associate threads with sub-processes.
 /// A sub-process will not reclaim memory from (abandoned heaps/threads)
 /// other subprocesses.
@@ -685,6 +849,20 @@ mi_heap_t* mi_heap_get_backing();
 /// Release outstanding resources in a specific heap.
 void mi_heap_collect(mi_heap_t* heap, bool force);
 
+/// Release outstanding resources in a specific heap in a bounded step.
+/// @param heap The heap to collect; it must belong to the current thread.
+/// @param budget_ns Stop after about this many nanoseconds (or 0 for no time limit).
+/// @param target_bytes Stop once at least this many bytes are freed or purged (or 0 for no target).
+/// @returns \a true if there is more work to do.
+///
+/// Does the same work as `mi_heap_collect(heap,false)` but stops when
+/// the budget is spent; the next call resumes where the previous one stopped.
+/// This is useful to collect in the idle time of a frame or event loop, e.g.
+/// `while (mi_heap_collect_ex(heap, 100000, 0) && have_idle_time()) { }`.
+/// The time is measured with the millisecond clock of mimalloc so short budgets are rounded up.
+/// If both \a budget_ns and \a target_bytes are 0 this is a full `mi_heap_collect(heap,false)`.
+bool mi_heap_collect_ex(mi_heap_t* heap, size_t budget_ns, size_t target_bytes);
+
 /// Allocate in a specific heap.
 /// @see mi_malloc()
 void* mi_heap_malloc(mi_heap_t* heap, size_t size);
@@ -834,7 +1012,8 @@ bool mi_heap_contains_block(mi_heap_t* heap, const void* p);
 /// @param p   Any pointer -- not required to be previously allocated by us.
 /// @returns \a true if \a p points to a block in \a heap.
 ///
-/// Note: expensive function, linear in the pages in the heap.
+/// This takes constant time (using the segment map) but \a p should not point into
+/// memory that is concurrently freed by another thread.
 /// @see mi_heap_contains_block()
 /// @see mi_heap_get_default()
 bool mi_heap_check_owned(mi_heap_t* heap, const void* p);
@@ -843,7 +1022,8 @@ bool mi_heap_check_owned(mi_heap_t* heap, const void* p);
 /// @param p   Any pointer -- not required to be previously allocated by us.
 /// @returns \a true if \a p points to a block in default heap of this thread.
 ///
-/// Note: expensive function, linear in the pages in the heap.
+/// This takes constant time (using the segment map) but \a p should not point into
+/// memory that is concurrently freed by another thread.
 /// @see mi_heap_contains_block()
 /// @see mi_heap_get_default()
 bool mi_check_owned(const void* p);
@@ -924,7 +1104,8 @@ typedef enum mi_option_e {
   mi_option_purge_decommits,          ///< should a memory purge decommit? (=1). Set to 0 to use memory reset on a purge (instead of decommit)
   mi_option_arena_reserve,            ///< initial memory size for arena reservation (= 1 GiB on 64-bit) (internally, this value is in KiB; use `mi_option_get_size`)
   mi_option_os_tag,                   ///< tag used for OS logging (macOS only for now) (=100)
-  mi_option_retry_on_oom,             ///< retry on out-of-memory for N milli seconds (=400), set to 0 to disable retries. (only on windows)
+  mi_option_retry_on_oom,             ///< retry on out-of-memory after purging and signalling memory pressure; on windows also retry for N milli seconds (=400), set to 0 to disable retries.
+  mi_option_commit_pressure_threshold, ///< signal moderate memory pressure when the committed memory exceeds N KiB (=0, disabled) (internally, this value is in KiB; use `mi_option_get_size`)
 
   // experimental options
   mi_option_eager_commit,             ///< eager commit segments? (after `eager_commit_delay` segments) (enabled by default).
@@ -938,10 +1119,12 @@ typedef enum mi_option_e {
   mi_option_max_segment_reclaim,        ///< max. percentage of the abandoned segments can be reclaimed per try (=10%)
   mi_option_destroy_on_exit,            ///< if set, release all memory on exit; sometimes used for dynamic unloading but can be unsafe
   mi_option_arena_purge_mult,           ///< multiplier for `purge_delay` for the purging delay for arenas (=10)
-  mi_option_abandoned_reclaim_on_free,  ///< allow to reclaim an abandoned segment on a free (=1)
+  mi_option_abandoned_reclaim_on_free,  ///< allow to reclaim an abandoned segment on a free (=1); the segment is reclaimed at the next allocation of the thread that misses the fast path
   mi_option_purge_extend_delay,         ///< extend purge delay on each subsequent delay (=1)
   mi_option_disallow_arena_alloc,       ///< 1 = do not use arena's for allocation (except if using specific arena id's)
   mi_option_visit_abandoned,            ///< allow visiting heap blocks from abandoned threads (=0)
+  mi_option_idle_trim_delay,            ///< trim the heaps of a thread when it allocates again after being idle for at least N milli seconds (=0, disabled)
+  mi_option_fork_handlers,              ///< install `pthread_atfork` handlers so the child of a fork leaves the memory of the threads that did not survive alone (=0)
 
   _mi_option_last
 } mi_option_t;
@@ -1218,6 +1401,34 @@ Advanced options:
    a page becomes unused which can improve memory usage but also decreases performance. Setting `N` to a higher
    value like `100` can improve performance (sometimes by a lot) at the cost of potentially using more memory at times.
    Setting it to `-1` disables purging completely.
+- `MIMALLOC_WATCH_MEMORY_PRESSURE=1`: watch for memory pressure events of the OS in a background thread. On Linux this
+   uses a cgroup v2 PSI trigger on `memory.pressure` and the `high` and `max` events of `memory.events` (as in containers).
+   While under pressure, the purge delay is shortened (or purging is immediate if critical) and a handler registered with
+   `mi_register_pressure_handler` is called so the application can release memory as well.
+- `MIMALLOC_COMMIT_PRESSURE_THRESHOLD=N`: signal moderate memory pressure (as above) each time the committed memory
+   of the process grows beyond `N` (like `1GiB`; by default `0` which disables this). Note that on overcommit systems
+   the arenas are eagerly committed so the threshold should be above the arena reservation size (`1GiB` by default).
+   Independent of this, if an OS allocation or commit fails, critical memory pressure is signalled and the allocation
+   is retried once (unless `MIMALLOC_RETRY_ON_OOM=0`). When the pressure is detected inside an allocation like this,
+   the handler is called afterwards at a safe point in the allocating thread (before the allocation is retried at the
+   heap level), so it can allocate and free memory itself.
+- `MIMALLOC_HUGE_SEGMENT_CACHE=N`: keep up to `N` bytes (like `256MiB`; by default `0` which disables this) of freed
+   huge blocks (larger than 1MiB and less than 128MiB) committed in a process-wide cache for reuse by any thread. This avoids
+   repeated commit/decommit and page faults when large buffers are allocated and freed at a high rate. Cached blocks
+   are released after the arena purge delay (`MIMALLOC_PURGE_DELAY` times `MIMALLOC_ARENA_PURGE_MULT`), on a forced
+   `mi_collect`, and under memory pressure.
+- `MIMALLOC_FORK_FREEZE=1`: in the child process of a `fork()`, leave all memory that was allocated before the fork alone
+   so it stays shared copy-on-write with the parent (by default `0`). Frees of such blocks are ignored and the forking thread
+   starts with fresh heaps. This is useful for pre-fork servers where the workers free (parts of) a large heap
+   inherited from the parent. This also installs the fork handlers (see `MIMALLOC_FORK_HANDLERS`).
+- `MIMALLOC_FORK_HANDLERS=1`: install `pthread_atfork` handlers (by default `0`) so that in the child process of a `fork()`
+   the memory of the parent threads that did not survive the fork is left alone (with frees of it ignored) instead
+   of being written to. The handlers are installed when the option is first enabled and stay installed.
+   They are always installed when using shared memory (see `mi_manage_shared_memory`).
+- `MIMALLOC_IDLE_TRIM_DELAY=N`: when a thread allocates again after being idle for at least `N` milli-seconds
+   (by default `0` which disables this), it first frees the empty pages of its heaps and purges the free memory
+   of its segments. Threads can also release this memory right away by calling `mi_thread_idle_hint()`
+   before they go idle (as when parking a thread in a thread pool).
 - `MIMALLOC_PURGE_DECOMMITS=1`: By default "purging" memory means unused memory is decommitted (`MEM_DECOMMIT` on Windows,
    `MADV_DONTNEED` (which decresease rss immediately) on `mmap` systems). Set this to 0 to instead "reset" unused
    memory on a purge (`MEM_RESET` on Windows, generally `MADV_FREE` (which does not decrease rss immediately) on `mmap` systems).
@@ -1252,6 +1463,9 @@ Further options for large workloads and services:
    The huge pages are usually allocated evenly among NUMA nodes.
    We can use `MIMALLOC_RESERVE_HUGE_OS_PAGES_AT=N` where `N` is the numa node (starting at 0) to allocate all
    the huge pages at a specific numa node instead.
+   Use `MIMALLOC_RESERVE_HUGE_OS_PAGES_ASYNC=1` to reserve the huge pages in a background thread so startup is not
+   delayed; until the huge pages are reserved, allocations use regular OS memory. Use `mi_reserve_huge_os_pages_is_done`
+   or `mi_register_reserve_huge_os_pages_done` to find out when the reservation is done.
 
 Use caution when using `fork` in combination with either large or huge OS pages: on a fork, the OS uses copy-on-write
 for all pages in the original process including the huge OS pages. When any memory is now written in that area, the
@@ -147,6 +147,15 @@ mi_decl_export void mi_register_output(mi_output_fun* out, void* arg) mi_attr_no
 typedef void (mi_cdecl mi_error_fun)(int err, void* arg);
 mi_decl_export void mi_register_error(mi_error_fun* fun, void* arg);
 
+typedef enum mi_pressure_e {
+  mi_pressure_none,       // no memory pressure
+  mi_pressure_moderate,   // memory is getting scarce (for example, a cgroup PSI trigger or `memory.high` event on Linux)
+  mi_pressure_critical    // memory is (almost) exhausted (for example, a cgroup `memory.max` event on Linux)
+} mi_pressure_t;
+
+typedef void (mi_cdecl mi_pressure_fun)(mi_pressure_t level, size_t size, void* arg);
+mi_decl_export void mi_register_pressure_handler(mi_pressure_fun* fun, void* arg) mi_attr_noexcept;
+
 mi_decl_export void mi_collect(bool force)    mi_attr_noexcept;
 mi_decl_export void mi_collect_reduce(size_t target_thread_owned) mi_attr_noexcept;
 mi_decl_export int  mi_version(void)          mi_attr_noexcept;
@@ -158,6 +167,7 @@ mi_decl_export void mi_stats_print_out(mi_output_fun* out, void* arg) mi_attr_no
 mi_decl_export void mi_process_init(void)     mi_attr_noexcept;
 mi_decl_export void mi_thread_init(void)      mi_attr_noexcept;
 mi_decl_export void mi_thread_done(void)      mi_attr_noexcept;
+mi_decl_export void mi_thread_idle_hint(void) mi_attr_noexcept;
 mi_decl_export void mi_thread_stats_print_out(mi_output_fun* out, void* arg) mi_attr_noexcept;
 
 mi_decl_export void mi_process_info(size_t* elapsed_msecs, size_t* user_msecs, size_t* system_msecs,
@@ -194,6 +204,7 @@ mi_decl_export mi_heap_t* mi_heap_set_default(mi_heap_t* heap);
 mi_decl_export mi_heap_t* mi_heap_get_default(void);
 mi_decl_export mi_heap_t* mi_heap_get_backing(void);
 mi_decl_export void       mi_heap_collect(mi_heap_t* heap, bool force) mi_attr_noexcept;
+mi_decl_export bool       mi_heap_collect_ex(mi_heap_t* heap, size_t budget_ns, size_t target_bytes) mi_attr_noexcept;
 
 mi_decl_nodiscard mi_decl_export mi_decl_restrict void* mi_heap_malloc(mi_heap_t* heap, size_t size) mi_attr_noexcept mi_attr_malloc mi_attr_alloc_size(2);
 mi_decl_nodiscard mi_decl_export mi_decl_restrict void* mi_heap_zalloc(mi_heap_t* heap, size_t size) mi_attr_noexcept mi_attr_malloc mi_attr_alloc_size(2);
@@ -273,6 +284,11 @@ mi_decl_nodiscard mi_decl_export bool mi_is_redirected(void) mi_attr_noexcept;
 mi_decl_export int mi_reserve_huge_os_pages_interleave(size_t pages, size_t numa_nodes, size_t timeout_msecs) mi_attr_noexcept;
 mi_decl_export int mi_reserve_huge_os_pages_at(size_t pages, int numa_node, size_t timeout_msecs) mi_attr_noexcept;
 
+// Experimental: status of the huge OS page reservation at startup when using `mi_option_reserve_huge_os_pages_async`
+typedef void (mi_cdecl mi_reserve_done_fun)(int err, void* arg);
+mi_decl_export void mi_register_reserve_huge_os_pages_done(mi_reserve_done_fun* fun, void* arg) mi_attr_noexcept;
+mi_decl_nodiscard mi_decl_export bool mi_reserve_huge_os_pages_is_done(int* err) mi_attr_noexcept;
+
 mi_decl_export int  mi_reserve_os_memory(size_t size, bool commit, bool allow_large) mi_attr_noexcept;
 mi_decl_export bool mi_manage_os_memory(void* start, size_t size, bool is_committed, bool is_large, bool is_zero, int numa_node) mi_attr_noexcept;
 
@@ -284,12 +300,32 @@ mi_decl_export void* mi_arena_area(mi_arena_id_t arena_id, size_t* size);
 mi_decl_export int   mi_reserve_huge_os_pages_at_ex(size_t pages, int numa_node, size_t timeout_msecs, bool exclusive, mi_arena_id_t* arena_id) mi_attr_noexcept;
 mi_decl_export int   mi_reserve_os_memory_ex(size_t size, bool commit, bool allow_large, bool exclusive, mi_arena_id_t* arena_id) mi_attr_noexcept;
 mi_decl_export bool  mi_manage_os_memory_ex(void* start, size_t size, bool is_committed, bool is_large, bool is_zero, int numa_node, bool exclusive, mi_arena_id_t* arena_id) mi_attr_noexcept;
+mi_decl_export bool  mi_manage_shared_memory(void* start, size_t size, mi_arena_id_t* arena_id) mi_attr_noexcept;  // memory shared between processes at the same address
+mi_decl_export bool  mi_unmanage_shared_memory(mi_arena_id_t arena_id) mi_attr_noexcept;
 
 #if MI_MALLOC_VERSION >= 182
 // Create a heap that only allocates in the specified arena
 mi_decl_nodiscard mi_decl_export mi_heap_t* mi_heap_new_in_arena(mi_arena_id_t arena_id);
 #endif
 
+// Experimental: exclusive I/O arena's with pinned and pre-faulted memory at stable addresses,
+// for example for buffers registered once with `io_uring_register_buffers`, or for `O_DIRECT`.
+// Allocate I/O buffers using `mi_heap_malloc_io` on a heap created with `mi_heap_new_in_arena`.
+#define MI_IO_ARENA_LOCK      (1)     // lock the memory (`mlock`) so it is never paged out
+#define MI_IO_ARENA_PREFAULT  (2)     // fault in all pages up front
+#define MI_IO_ARENA_DEFAULT   (MI_IO_ARENA_LOCK | MI_IO_ARENA_PREFAULT)
+#define MI_IO_BLOCK_ALIGN     (4096)  // alignment (and size granularity) of I/O buffers
+
+typedef struct mi_arena_range_s {
+  void*  start;
+  size_t size;
+} mi_arena_range_t;
+
+mi_decl_export int    mi_io_arena_new(size_t size, int flags, mi_arena_id_t* arena_id) mi_attr_noexcept;
+mi_decl_export size_t mi_arena_ranges(mi_arena_id_t arena_id, size_t max_range_size, mi_arena_range_t* ranges, size_t ranges_count) mi_attr_noexcept;
+mi_decl_nodiscard mi_decl_export mi_decl_restrict void* mi_heap_malloc_io(mi_heap_t* heap, size_t size) mi_attr_noexcept mi_attr_malloc mi_attr_alloc_size(2);
+mi_decl_nodiscard mi_decl_export mi_decl_restrict void* mi_heap_zalloc_io(mi_heap_t* heap, size_t size) mi_attr_noexcept mi_attr_malloc mi_attr_alloc_size(2);
+
 
 // Experimental: allow sub-processes whose memory segments stay separated (and no reclamation between them)
 // Used for example for separate interpreter's in one process.
@@ -307,10 +343,22 @@ mi_decl_export bool mi_abandoned_visit_blocks(mi_subproc_id_t subproc_id, int he
 // fall back to `mi_heap_delete`.
 mi_decl_nodiscard mi_decl_export mi_heap_t* mi_heap_new_ex(int heap_tag, bool allow_destroy, mi_arena_id_t arena_id);
 
+// Experimental: create a new heap with its own purge and commit policy (instead of the global options).
+// For example, a latency critical heap can use a negative `purge_delay` and `eager_commit`, while a heap
+// for background jobs can use a `purge_delay` of 0 to purge freed pages immediately.
+typedef struct mi_heap_policy_s {
+  long purge_delay;       // purge unused pages after N milli-seconds (-1 = never purge, 0 = purge immediately)
+  bool purge_decommits;   // decommit memory on a purge (instead of resetting it)
+  bool eager_commit;      // always commit new segments eagerly
+} mi_heap_policy_t;
+
+mi_decl_export void mi_heap_policy_init(mi_heap_policy_t* policy) mi_attr_noexcept;   // initialize from the current options
+mi_decl_nodiscard mi_decl_export mi_heap_t* mi_heap_new_with_policy(const mi_heap_policy_t* policy);
+
 // deprecated
 mi_decl_export int mi_reserve_huge_os_pages(size_t pages, double max_secs, size_t* pages_reserved) mi_attr_noexcept;
 
-// Experimental: objects followed by a guard page.
+// Experimental: objects followed by a guard page (not available in builds with padding, like debug builds).
 // A sample rate of 0 disables guarded objects, while 1 uses a guard page for every object.
 // A seed of 0 uses a random start point. Only objects within the size bound are eligable for guard pages.
 mi_decl_export void mi_heap_guarded_set_sample_rate(mi_heap_t* heap, size_t sample_rate, size_t seed);
@@ -371,14 +419,21 @@ typedef enum mi_option_e {
   mi_option_purge_extend_delay,
   mi_option_abandoned_reclaim_on_free,  // allow to reclaim an abandoned segment on a free (=1)
   mi_option_disallow_arena_alloc,       // 1 = do not use arena's for allocation (except if using specific arena id's)
-  mi_option_retry_on_oom,               // retry on out-of-memory for N milli seconds (=400), set to 0 to disable retries. (only on windows)
+  mi_option_retry_on_oom,               // retry on out-of-memory after purging and signalling memory pressure; on windows also retry for N milli seconds (=400), set to 0 to disable retries.
   mi_option_visit_abandoned,            // allow visiting heap blocks from abandoned threads (=0)
-  mi_option_guarded_min,                // only used when building with MI_GUARDED: minimal rounded object size for guarded objects (=0)
-  mi_option_guarded_max,                // only used when building with MI_GUARDED: maximal rounded object size for guarded objects (=0)
+  mi_option_guarded_min,                // minimal rounded object size for guarded objects (=0)
+  mi_option_guarded_max,                // maximal rounded object size for guarded objects (=1GiB)
   mi_option_guarded_precise,            // disregard minimal alignment requirement to always place guarded blocks exactly in front of a guard page (=0)
-  mi_option_guarded_sample_rate,        // 1 out of N allocations in the min/max range will be guarded (=1000)
+  mi_option_guarded_sample_rate,        // 1 out of N allocations in the min/max range will be guarded; not available in builds with padding (=0, or 4000 in MI_GUARDED builds)
   mi_option_guarded_sample_seed,        // can be set to allow for a (more) deterministic re-execution when a guard page is triggered (=0)
   mi_option_target_segments_per_thread, // experimental (=0)
+  mi_option_reserve_huge_os_pages_async, // reserve the huge OS pages at startup in a background thread (=0)
+  mi_option_watch_memory_pressure,      // watch for OS memory pressure events (cgroup v2 PSI on Linux) in a background thread (=0)
+  mi_option_commit_pressure_threshold,  // signal moderate memory pressure when the committed memory exceeds N KiB (=0, disabled) (use `mi_option_get_size`)
+  mi_option_huge_segment_cache,         // keep up to N KiB of freed huge segments committed for reuse (=0, disabled) (use `mi_option_get_size`)
+  mi_option_fork_freeze,                // in the child of a fork, leave all memory allocated before the fork alone so it stays shared copy-on-write (=0)
+  mi_option_idle_trim_delay,            // trim the heaps of a thread when it allocates again after being idle for at least N milli seconds (=0, disabled)
+  mi_option_fork_handlers,              // install `pthread_atfork` handlers so the child of a fork leaves the memory of the threads that did not survive alone (=0)
   _mi_option_last,
   // legacy option names
   mi_option_large_os_pages = mi_option_allow_large_os_pages,
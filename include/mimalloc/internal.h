@@ -73,6 +73,8 @@ void        _mi_strlcat(char* dest, const char* src, size_t dest_size);
 size_t      _mi_strlen(const char* s);
 size_t      _mi_strnlen(const char* s, size_t max_len);
 bool        _mi_getenv(const char* name, char* result, size_t result_size);
+void        _mi_memcpy_nt(void* dst, const void* src, size_t n);
+void        _mi_memzero_nt(void* dst, size_t n);
 
 // "options.c"
 void        _mi_fputs(mi_output_fun* out, void* arg, const char* prefix, const char* message);
@@ -90,6 +92,7 @@ void        _mi_random_init_weak(mi_random_ctx_t* ctx);
 void        _mi_random_reinit_if_weak(mi_random_ctx_t * ctx);
 void        _mi_random_split(mi_random_ctx_t* ctx, mi_random_ctx_t* new_ctx);
 uintptr_t   _mi_random_next(mi_random_ctx_t* ctx);
+void        _mi_random_fill(mi_random_ctx_t* ctx, uintptr_t* buf, size_t count);
 uintptr_t   _mi_heap_random_next(mi_heap_t* heap);
 uintptr_t   _mi_os_random_weak(uintptr_t extra_seed);
 static inline uintptr_t _mi_random_shuffle(uintptr_t x);
@@ -110,14 +113,20 @@ void        _mi_thread_data_collect(void);
 void        _mi_tld_init(mi_tld_t* tld, mi_heap_t* bheap);
 mi_threadid_t _mi_thread_id(void) mi_attr_noexcept;
 mi_heap_t*    _mi_heap_main_get(void);     // statically allocated main backing heap
+void        _mi_fork_prepare(void);         // called around a `fork()` (see `prim.h:_mi_prim_fork_handlers_install`)
+void        _mi_fork_parent(void);
+void        _mi_fork_child(void);
+void        _mi_fork_handlers_install(bool always);
 mi_subproc_t* _mi_subproc_from_id(mi_subproc_id_t subproc_id);
 void        _mi_heap_guarded_init(mi_heap_t* heap);
+extern bool _mi_guarded_sampling_enabled;   // `true` once any heap has a non-zero guarded sample rate
 
 // os.c
 void        _mi_os_init(void);                                            // called from process init
 void*       _mi_os_alloc(size_t size, mi_memid_t* memid);
 void        _mi_os_free(void* p, size_t size, mi_memid_t memid);
 void        _mi_os_free_ex(void* p, size_t size, bool still_committed, mi_memid_t memid);
+bool        _mi_os_shrink(void* p, size_t size, size_t newsize, bool still_committed, mi_memid_t* memid);
 
 size_t      _mi_os_page_size(void);
 size_t      _mi_os_good_alloc_size(size_t size);
@@ -129,8 +138,10 @@ bool        _mi_os_commit(void* p, size_t size, bool* is_zero);
 bool        _mi_os_decommit(void* addr, size_t size);
 bool        _mi_os_protect(void* addr, size_t size);
 bool        _mi_os_unprotect(void* addr, size_t size);
+bool        _mi_os_lock(void* addr, size_t size);
 bool        _mi_os_purge(void* p, size_t size);
-bool        _mi_os_purge_ex(void* p, size_t size, bool allow_reset, size_t stat_size);
+bool        _mi_os_purge_ex(void* p, size_t size, bool allow_reset, size_t stat_size, bool* is_zero);
+bool        _mi_os_purge_policy_ex(void* p, size_t size, bool decommit, bool allow_reset, size_t stat_size, bool* is_zero);
 
 void*       _mi_os_alloc_aligned(size_t size, size_t alignment, bool commit, bool allow_large, mi_memid_t* memid);
 void*       _mi_os_alloc_aligned_at_offset(size_t size, size_t alignment, size_t align_offset, bool commit, bool allow_large, mi_memid_t* memid);
@@ -141,15 +152,24 @@ size_t      _mi_os_large_page_size(void);
 
 void*       _mi_os_alloc_huge_os_pages(size_t pages, int numa_node, mi_msecs_t max_secs, size_t* pages_reserved, size_t* psize, mi_memid_t* memid);
 
+bool        _mi_os_memory_pressure(mi_pressure_t level, size_t size);
+void        _mi_os_memory_pressure_notify(void);
+long        _mi_os_purge_delay(long delay);
+
 // arena.c
 mi_arena_id_t _mi_arena_id_none(void);
 void        _mi_arena_free(void* p, size_t size, size_t still_committed_size, mi_memid_t memid);
+bool        _mi_arena_shrink(void* p, size_t size, size_t* newsize, bool still_committed, mi_memid_t* memid);
 void*       _mi_arena_alloc(size_t size, bool commit, bool allow_large, mi_arena_id_t req_arena_id, mi_memid_t* memid);
 void*       _mi_arena_alloc_aligned(size_t size, size_t alignment, size_t align_offset, bool commit, bool allow_large, mi_arena_id_t req_arena_id, mi_memid_t* memid);
 bool        _mi_arena_memid_is_suitable(mi_memid_t memid, mi_arena_id_t request_arena_id);
+bool        _mi_arena_memid_is_os(mi_memid_t memid);
+bool        _mi_arena_id_is_shared(mi_arena_id_t arena_id);
 bool        _mi_arena_contains(const void* p);
+bool        _mi_arena_reserve_huge_os_pages_async(size_t pages, int numa_node, size_t timeout_msecs);
 void        _mi_arenas_collect(bool force_purge);
 void        _mi_arena_unsafe_destroy_all(void);
+void        _mi_arenas_fork_child(void);
 
 bool        _mi_arena_segment_clear_abandoned(mi_segment_t* segment);
 void        _mi_arena_segment_mark_abandoned(mi_segment_t* segment);
@@ -161,25 +181,34 @@ typedef struct mi_arena_field_cursor_s { // abstract struct
   size_t         os_list_count;           // max entries to visit in the OS abandoned list
   size_t         start;                   // start arena idx (may need to be wrapped)
   size_t         end;                     // end arena idx (exclusive, may need to be wrapped)
+  size_t         arena_count;             // arena idx's wrap around at this count (0 for no wrap around)
   size_t         bitmap_idx;              // current bit idx for an arena
   mi_subproc_t*  subproc;                 // only visit blocks in this sub-process
   bool           visit_all;               // ensure all abandoned blocks are seen (blocking)
   bool           hold_visit_lock;         // if the subproc->abandoned_os_visit_lock is held
+  bool           os_list_taken;           // if the OS abandoned list was taken into `os_list`
+  mi_segment_t*  os_list;                 // the remaining OS abandoned segments to visit (owned by this cursor)
 } mi_arena_field_cursor_t;
 void          _mi_arena_field_cursor_init(mi_heap_t* heap, mi_subproc_t* subproc, bool visit_all, mi_arena_field_cursor_t* current);
 mi_segment_t* _mi_arena_segment_clear_abandoned_next(mi_arena_field_cursor_t* previous);
 void          _mi_arena_field_cursor_done(mi_arena_field_cursor_t* current);
+mi_segment_t* _mi_arena_segment_clear_abandoned_at_block(mi_arena_id_t arena_id, size_t block_index, mi_subproc_t* subproc);
+mi_segment_t* _mi_arena_segment_os_clear_abandoned_hinted(mi_segment_t* segment, mi_subproc_t* subproc);
 
 // "segment-map.c"
 void        _mi_segment_map_allocated_at(const mi_segment_t* segment);
 void        _mi_segment_map_freed_at(const mi_segment_t* segment);
+void        _mi_segment_map_shrunk_at(const mi_segment_t* segment, size_t new_size);
 void        _mi_segment_map_unsafe_destroy(void);
+mi_segment_t* _mi_segment_of(const void* p);
 
 // "segment.c"
 mi_page_t*  _mi_segment_page_alloc(mi_heap_t* heap, size_t block_size, size_t page_alignment, mi_segments_tld_t* tld);
-void        _mi_segment_page_free(mi_page_t* page, bool force, mi_segments_tld_t* tld);
+void        _mi_segment_page_free(mi_page_t* page, bool force, const mi_heap_policy_t* policy, mi_segments_tld_t* tld);
 void        _mi_segment_page_abandon(mi_page_t* page, mi_segments_tld_t* tld);
 uint8_t*    _mi_segment_page_start(const mi_segment_t* segment, const mi_page_t* page, size_t* page_size);
+bool        _mi_segment_page_commit(mi_page_t* page, size_t size, bool* is_zero);
+bool        _mi_segment_huge_page_shrink(mi_segment_t* segment, mi_page_t* page, size_t block_size, mi_segments_tld_t* tld);
 
 #if MI_HUGE_PAGE_ABANDON
 void        _mi_segment_huge_page_free(mi_segment_t* segment, mi_page_t* page, mi_block_t* block);
@@ -188,8 +217,18 @@ void        _mi_segment_huge_page_reset(mi_segment_t* segment, mi_page_t* page,
 #endif
 
 void        _mi_segments_collect(bool force, mi_segments_tld_t* tld);
+bool        _mi_segments_collect_step(size_t* purged_size, mi_segments_tld_t* tld);
+void        _mi_segment_cache_collect(bool force);
 void        _mi_abandoned_reclaim_all(mi_heap_t* heap, mi_segments_tld_t* tld);
-bool        _mi_segment_attempt_reclaim(mi_heap_t* heap, mi_segment_t* segment);
+void        _mi_segment_reclaim_hint(mi_heap_t* heap, mi_segment_t* segment);
+void        _mi_segment_reclaim_hinted(mi_heap_t* heap);
+bool        _mi_segment_is_fork_orphan(const mi_segment_t* segment);
+bool        _mi_segment_is_foreign(const mi_segment_t* segment);
+uintptr_t   _mi_segment_process_key(void);
+void        _mi_segments_fork_child(void);
+void        _mi_segments_fork_freeze(mi_segments_tld_t* tld);
+void        _mi_segments_fork_leave_shared(mi_segments_tld_t* tld);
+void        _mi_segment_fork_freeze(mi_segment_t* segment);
 bool        _mi_segment_visit_blocks(mi_segment_t* segment, int heap_tag, bool visit_blocks, mi_block_visit_fun* visitor, void* arg);
 
 // "page.c"
@@ -220,9 +259,11 @@ uint8_t     _mi_bin(size_t size);                // for stats
 void        _mi_heap_init(mi_heap_t* heap, mi_tld_t* tld, mi_arena_id_t arena_id, bool noreclaim, uint8_t tag);
 void        _mi_heap_destroy_pages(mi_heap_t* heap);
 void        _mi_heap_collect_abandon(mi_heap_t* heap);
+void        _mi_thread_idle_check(mi_tld_t* tld);
 void        _mi_heap_set_default_direct(mi_heap_t* heap);
 bool        _mi_heap_memid_is_suitable(mi_heap_t* heap, mi_memid_t memid);
 void        _mi_heap_unsafe_destroy_all(mi_heap_t* heap);
+void        _mi_heap_fork_child(mi_heap_t* heap, bool freeze);
 mi_heap_t*  _mi_heap_by_tag(mi_heap_t* heap, uint8_t tag);
 void        _mi_heap_area_init(mi_heap_area_t* area, mi_page_t* page);
 bool        _mi_heap_area_visit_blocks(const mi_heap_area_t* area, mi_page_t* page, mi_block_visit_fun* visitor, void* arg);
@@ -432,6 +473,11 @@ static inline bool mi_heap_is_initialized(mi_heap_t* heap) {
   return (heap != NULL && heap != &_mi_heap_empty);
 }
 
+// The purge and commit policy of a heap, or `NULL` if it uses the global options
+static inline const mi_heap_policy_t* _mi_heap_policy(const mi_heap_t* heap) {
+  return (heap != NULL && heap->has_policy ? &heap->policy : NULL);
+}
+
 static inline uintptr_t _mi_ptr_cookie(const void* p) {
   extern mi_decl_hidden mi_heap_t _mi_heap_main;
   mi_assert_internal(_mi_heap_main.cookie != 0);
@@ -478,7 +524,7 @@ static inline size_t _mi_segment_page_idx_of(const mi_segment_t* segment, const
   mi_assert_internal(diff >= 0 && (size_t)diff <= MI_SEGMENT_SIZE /* for huge alignment it can be equal */);
   size_t idx = (size_t)diff >> segment->page_shift;
   mi_assert_internal(idx < segment->capacity);
-  mi_assert_internal(segment->page_kind <= MI_PAGE_MEDIUM || idx == 0);
+  mi_assert_internal(segment->page_kind <= MI_PAGE_MLARGE || idx == 0);
   return idx;
 }
 
@@ -615,30 +661,18 @@ static inline void mi_page_set_has_aligned(mi_page_t* page, bool has_aligned) {
 /* -------------------------------------------------------------------
   Guarded objects
 ------------------------------------------------------------------- */
-#if MI_GUARDED
+#if MI_GUARDED_SAMPLING
 static inline bool mi_block_ptr_is_guarded(const mi_block_t* block, const void* p) {
   const ptrdiff_t offset = (uint8_t*)p - (uint8_t*)block;
   return (offset >= (ptrdiff_t)(sizeof(mi_block_t)) && block->next == MI_BLOCK_TAG_GUARDED);
 }
 
-static inline bool mi_heap_malloc_use_guarded(mi_heap_t* heap, size_t size) {
-  // this code is written to result in fast assembly as it is on the hot path for allocation
-  const size_t count = heap->guarded_sample_count - 1;  // if the rate was 0, this will underflow and count for a long time..
-  if mi_likely(count != 0) {
-    // no sample
-    heap->guarded_sample_count = count;
-    return false;
-  }
-  else if (size >= heap->guarded_size_min && size <= heap->guarded_size_max) {
-    // use guarded allocation
-    heap->guarded_sample_count = heap->guarded_sample_rate;  // reset
-    return (heap->guarded_sample_rate != 0);
-  }
-  else {
-    // failed size criteria, rewind count (but don't write to an empty heap)
-    if (heap->guarded_sample_rate != 0) { heap->guarded_sample_count = 1; }
-    return false;
-  }
+// Is a guarded sample due for an allocation of `size` bytes?
+// The sample count only counts down in the allocation slow path (see `page.c:mi_heap_guarded_reserve`)
+// so this is never evaluated in the fast path.
+static inline bool mi_heap_guarded_sample_due(const mi_heap_t* heap, size_t size) {
+  return (heap->guarded_sample_rate != 0 && heap->guarded_sample_count == 0 &&
+          size >= heap->guarded_size_min && size <= heap->guarded_size_max);
 }
 
 mi_decl_restrict void* _mi_heap_malloc_guarded(mi_heap_t* heap, size_t size, bool zero) mi_attr_noexcept;
@@ -786,6 +820,26 @@ static inline mi_memid_t _mi_memid_create_os(bool committed, bool is_zero, bool
   return memid;
 }
 
+// Is the memory in an arena that is shared between processes? (see `arena.c:mi_manage_shared_memory`)
+static inline bool mi_memid_is_shared(mi_memid_t memid) {
+  return (memid.memkind == MI_MEM_ARENA && memid.mem.arena.is_shared);
+}
+
+static inline bool mi_segment_is_shared(const mi_segment_t* segment) {
+  return mi_memid_is_shared(segment->memid);
+}
+
+// The id with which thread `tid` owns a segment. Thread id's are only unique within a process
+// so for segments in shared memory it is salted with a per-process key (see `segment.c`).
+static inline mi_threadid_t _mi_segment_owner_id(const mi_segment_t* segment, mi_threadid_t tid) {
+  return (mi_likely(!mi_segment_is_shared(segment)) ? tid : (tid ^ _mi_segment_process_key()));
+}
+
+// Is the segment cookie valid? (segments in shared memory can be initialized by another process)
+static inline bool _mi_segment_cookie_is_valid(const mi_segment_t* segment) {
+  return (_mi_ptr_cookie(segment) == segment->cookie || mi_segment_is_shared(segment));
+}
+
 
 // -------------------------------------------------------------------
 // Fast "random" shuffle
@@ -1016,5 +1070,39 @@ static inline void _mi_memzero_aligned(void* dst, size_t n) {
 }
 #endif
 
+// -------------------------------------------------------------------------------
+// The `_mi_memcpy_large` and `_mi_memzero_large` are used for realloc copies and
+// zeroing of huge blocks. Blocks of at least `MI_MEMOP_NT_MIN_SIZE` use non-temporal
+// stores (see `libc.c`) to avoid evicting the working set from the cache. Below that,
+// regular stores are faster even when counting the cost of the evicted working set.
+// -------------------------------------------------------------------------------
+
+#define MI_MEMOP_NT_MIN_SIZE   (MI_MiB)
+
+// The x86 intrinsics headers of gcc and clang declare `posix_memalign` (in `mm_malloc.h`) with
+// a different exception specifier than its definition in `alloc-override.c` when compiling
+// as C++ (`MI_USE_CXX`); in that case we do not use these headers (as in `atomic.h`).
+#if defined(__cplusplus) && defined(MI_MALLOC_OVERRIDE) && !defined(_WIN32)
+#define MI_NO_X86_INTRINSICS  1
+#endif
+
+static inline void _mi_memcpy_large(void* dst, const void* src, size_t n) {
+  if mi_unlikely(n >= MI_MEMOP_NT_MIN_SIZE) {
+    _mi_memcpy_nt(dst, src, n);
+  }
+  else {
+    _mi_memcpy(dst, src, n);
+  }
+}
+
+static inline void _mi_memzero_large(void* dst, size_t n) {
+  if mi_unlikely(n >= MI_MEMOP_NT_MIN_SIZE) {
+    _mi_memzero_nt(dst, n);
+  }
+  else {
+    _mi_memzero(dst, n);
+  }
+}
+
 
 #endif
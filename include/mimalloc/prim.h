@@ -30,6 +30,7 @@ typedef struct mi_os_mem_config_s {
   bool    has_overcommit;       // can we reserve more memory than can be actually committed?
   bool    has_partial_free;     // can allocated blocks be freed partially? (true for mmap, false for VirtualAlloc)
   bool    has_virtual_reserve;  // supports virtual address space reservation? (if true we can reserve virtual address space without using commit or physical memory)
+  bool    has_decommit_zero;    // is decommitted private memory zero when it is accessed (or committed) again? (true for `MADV_DONTNEED` on Linux and `MEM_DECOMMIT` on Windows)
 } mi_os_mem_config_t;
 
 // Initialize
@@ -66,6 +67,10 @@ int _mi_prim_reset(void* addr, size_t size);
 // Protect memory. Returns error code or 0 on success.
 int _mi_prim_protect(void* addr, size_t size, bool protect);
 
+// Lock memory into physical memory so it is never paged out (and fault in all pages).
+// Returns error code or 0 on success.
+int _mi_prim_lock(void* addr, size_t size);
+
 // Allocate huge (1GiB) pages possibly associated with a NUMA node.
 // `is_zero` is set to true if the memory was zero initialized (as on most OS's)
 // pre: size > 0  and a multiple of 1GiB.
@@ -117,6 +122,20 @@ void _mi_prim_thread_done_auto_done(void);
 // Called when the default heap for a thread changes
 void _mi_prim_thread_associate_default_heap(mi_heap_t* heap);
 
+// Start a detached helper thread that runs `fn(arg)`.
+// Returns `false` if threads are not supported (or the thread could not be created).
+typedef void (mi_prim_thread_fun_t)(void* arg);
+bool _mi_prim_thread_start(mi_prim_thread_fun_t* fn, void* arg);
+
+// Start watching for memory pressure events of the OS (like cgroup v2 PSI triggers on Linux)
+// in a helper thread that calls `_mi_os_memory_pressure` on each event.
+// Returns `false` if this is not supported.
+bool _mi_prim_memory_pressure_watch(void);
+
+// Install handlers (like `pthread_atfork`) so `_mi_fork_prepare`, `_mi_fork_parent`, and `_mi_fork_child`
+// are called around a `fork()`. Returns `false` if this is not supported.
+bool _mi_prim_fork_handlers_install(void);
+
 
 
 
@@ -72,7 +72,7 @@ terms of the MIT license. A copy of the license can be found in the file
 #endif
 #endif
 
-// Use guard pages behind objects of a certain size (set by the MIMALLOC_DEBUG_GUARDED_MIN/MAX options)
+// Use guard pages behind a sample of objects by default (set by the MIMALLOC_GUARDED_SAMPLE_RATE and MIMALLOC_GUARDED_MIN/MAX options)
 // Padding should be disabled when using guard pages
 // #define MI_GUARDED 1
 #if defined(MI_GUARDED)
@@ -90,6 +90,12 @@ terms of the MIT license. A copy of the license can be found in the file
 #define MI_PADDING_CHECK 1
 #endif
 
+// Guarded sampling can be enabled at runtime (using `mi_option_guarded_sample_rate`) in any build without padding;
+// `MI_GUARDED` only enables it by default. The sampling only runs in the allocation slow path (see `page.c`).
+#if !defined(MI_GUARDED_SAMPLING) && !MI_PADDING
+#define MI_GUARDED_SAMPLING 1
+#endif
+
 
 // Encoded free lists allow detection of corrupted free lists
 // and can detect buffer overflows, modify after free, and double `free`s.
@@ -173,6 +179,9 @@ typedef int32_t  mi_ssize_t;
 #ifndef MI_MEDIUM_PAGE_SHIFT
 #define MI_MEDIUM_PAGE_SHIFT              ( 3 + MI_SMALL_PAGE_SHIFT)  // 512KiB
 #endif
+#ifndef MI_MLARGE_PAGE_SHIFT
+#define MI_MLARGE_PAGE_SHIFT              ( 1 + MI_MEDIUM_PAGE_SHIFT) // 1MiB
+#endif
 #ifndef MI_LARGE_PAGE_SHIFT
 #define MI_LARGE_PAGE_SHIFT               ( 3 + MI_MEDIUM_PAGE_SHIFT) // 4MiB
 #endif
@@ -187,16 +196,22 @@ typedef int32_t  mi_ssize_t;
 
 #define MI_SMALL_PAGE_SIZE                (MI_ZU(1)<<MI_SMALL_PAGE_SHIFT)
 #define MI_MEDIUM_PAGE_SIZE               (MI_ZU(1)<<MI_MEDIUM_PAGE_SHIFT)
+#define MI_MLARGE_PAGE_SIZE               (MI_ZU(1)<<MI_MLARGE_PAGE_SHIFT)
 #define MI_LARGE_PAGE_SIZE                (MI_ZU(1)<<MI_LARGE_PAGE_SHIFT)
 
 #define MI_SMALL_PAGES_PER_SEGMENT        (MI_SEGMENT_SIZE/MI_SMALL_PAGE_SIZE)
 #define MI_MEDIUM_PAGES_PER_SEGMENT       (MI_SEGMENT_SIZE/MI_MEDIUM_PAGE_SIZE)
+#define MI_MLARGE_PAGES_PER_SEGMENT       (MI_SEGMENT_SIZE/MI_MLARGE_PAGE_SIZE)
 #define MI_LARGE_PAGES_PER_SEGMENT        (MI_SEGMENT_SIZE/MI_LARGE_PAGE_SIZE)
 
+// Medium, medium-large, and large pages are committed on demand in chunks (see `segment.c:mi_page_commit_chunks`)
+#define MI_COMMIT_CHUNK_SIZE              (MI_SEGMENT_SIZE/64)     // 64KiB
+
 // The max object size are checked to not waste more than 12.5% internally over the page sizes.
-// (Except for large pages since huge objects are allocated in 4MiB chunks)
+// (Except for medium-large and large pages since huge objects are allocated in 4MiB chunks)
 #define MI_SMALL_OBJ_SIZE_MAX             (MI_SMALL_PAGE_SIZE/8)   // 8 KiB
 #define MI_MEDIUM_OBJ_SIZE_MAX            (MI_MEDIUM_PAGE_SIZE/8)  // 64 KiB
+#define MI_MLARGE_OBJ_SIZE_MAX            (MI_MLARGE_PAGE_SIZE/4)  // 256 KiB
 #define MI_LARGE_OBJ_SIZE_MAX             (MI_LARGE_PAGE_SIZE/4)   // 1 MiB
 #define MI_LARGE_OBJ_WSIZE_MAX            (MI_LARGE_OBJ_SIZE_MAX/MI_INTPTR_SIZE)
 
@@ -232,7 +247,7 @@ typedef struct mi_block_s {
   mi_encoded_t next;
 } mi_block_t;
 
-#if MI_GUARDED
+#if MI_GUARDED_SAMPLING
 // we always align guarded pointers in a block at an offset
 // the block `next` field is then used as a tag to distinguish regular offset aligned blocks from guarded ones
 #define MI_BLOCK_TAG_ALIGNED   ((mi_encoded_t)(0))
@@ -309,6 +324,9 @@ typedef struct mi_page_s {
   uint8_t               is_committed:1;    // `true` if the page virtual memory is committed
   uint8_t               is_zero_init:1;    // `true` if the page was initially zero initialized
   uint8_t               is_huge:1;         // `true` if the page is in a huge segment
+  uint8_t               purge_policy:1;    // `true` if a delayed purge uses `purge_decommit` instead of the global option
+  uint8_t               purge_decommit:1;  // `true` if a delayed purge should decommit (instead of reset)
+  uint8_t               purge_never:1;     // `true` if the page was freed under a policy that never purges (a negative purge delay)
 
   // layout like this to optimize access in `mi_malloc` and `mi_free`
   uint16_t              capacity;          // number of blocks committed, must be the first field, see `segment.c:page_clear`
@@ -350,6 +368,7 @@ typedef struct mi_page_s {
 typedef enum mi_page_kind_e {
   MI_PAGE_SMALL,    // small blocks go into 64KiB pages inside a segment
   MI_PAGE_MEDIUM,   // medium blocks go into 512KiB pages inside a segment
+  MI_PAGE_MLARGE,   // medium-large blocks go into 1MiB pages inside a segment
   MI_PAGE_LARGE,    // larger blocks go into a single page spanning a whole segment
   MI_PAGE_HUGE      // a huge page is a single page in a segment of variable size (but still 2MiB aligned)
                     // used for blocks `> MI_LARGE_OBJ_SIZE_MAX` or an alignment `> MI_BLOCK_ALIGNMENT_MAX`.
@@ -384,6 +403,7 @@ typedef struct mi_memid_arena_info {
   size_t        block_index;        // index in the arena
   mi_arena_id_t id;                 // arena id (>= 1)
   bool          is_exclusive;       // this arena can only be used for specific arena allocations
+  bool          is_shared;          // this arena is shared between processes (see `mi_manage_shared_memory`)
 } mi_memid_arena_info_t;
 
 typedef struct mi_memid_s {
@@ -418,17 +438,20 @@ typedef struct mi_segment_s {
   struct mi_segment_s* prev;
   bool                 was_reclaimed;    // true if it was reclaimed (used to limit reclaim-on-free reclamation)
   bool                 dont_free;        // can be temporarily true to ensure the segment is not freed
+  size_t               fork_generation;  // fork generation when the segment was claimed by its owner (see `segment.c:mi_segment_is_fork_orphan`)
+  uintptr_t            process_key;      // key of the owning process for segments in shared memory (see `segment.c:_mi_segment_process_key`)
 
   size_t               abandoned;        // abandoned pages (i.e. the original owning thread stopped) (`abandoned <= used`)
   size_t               abandoned_visits; // count how often this segment is visited for reclaiming (to force reclaim if it is too long)
 
   size_t               used;             // count of pages in use (`used <= capacity`)
   size_t               capacity;         // count of available pages (`#free + used`)
+  size_t               free_bucket;      // occupancy bucket of the free queue this segment is in (see `segment.c:mi_segment_free_bucket`)
+  uint64_t             commit_mask;      // committed chunks of `MI_COMMIT_CHUNK_SIZE` (only for medium, medium-large, and large pages)
   size_t               segment_info_size;// space we are using from the first page for segment meta-data and possible guard pages.
   uintptr_t            cookie;           // verify addresses in secure mode: `_mi_ptr_cookie(segment) == segment->cookie`
 
-  struct mi_segment_s* abandoned_os_next; // only used for abandoned segments outside arena's, and only if `mi_option_visit_abandoned` is enabled
-  struct mi_segment_s* abandoned_os_prev;
+  struct mi_segment_s* abandoned_os_next; // only used for abandoned segments outside arena's (see `arena-abandon.c`)
 
   // layout like this to optimize access in `mi_free`
   _Atomic(mi_threadid_t) thread_id;      // unique id of the thread owning this segment
@@ -463,10 +486,22 @@ typedef struct mi_page_queue_s {
 
 #define MI_BIN_FULL  (MI_BIN_HUGE+1)
 
+// Page retirement and extension adapt to the allocation pattern of each size class (see `page.c`)
+typedef struct mi_bin_churn_s {
+  uint8_t  retire_level;   // retired pages are kept for `MI_RETIRE_CYCLES << retire_level` cycles
+  uint8_t  extend_level;   // pages are extended by at most `MI_MAX_EXTEND_SIZE << extend_level` bytes at a time
+  bool     retire_freed;   // `true` if a retired page was freed and no fresh page was needed since
+  bool     hot;            // `true` if the free list of this size class ran out within `MI_CHURN_HOT_BEATS` heartbeats
+  uint32_t beat;           // heartbeat at which the free list of this size class last ran out (the gap measures the allocation rate)
+} mi_bin_churn_t;
+
 // Random context
+#define MI_RANDOM_BLOCKS  (4)                      // chacha blocks generated at once
+#define MI_RANDOM_OUTPUT  (16*MI_RANDOM_BLOCKS)    // output words per generation
+
 typedef struct mi_random_cxt_s {
   uint32_t input[16];
-  uint32_t output[16];
+  uint32_t output[MI_RANDOM_OUTPUT];
   int      output_available;
   bool     weak;
 } mi_random_ctx_t;
@@ -503,13 +538,18 @@ struct mi_heap_s {
   mi_heap_t*            next;                                // list of heaps per thread
   bool                  no_reclaim;                          // `true` if this heap should not reclaim abandoned pages
   uint8_t               tag;                                 // custom tag, can be used for separating heaps based on the object types
-  #if MI_GUARDED
+  bool                  has_policy;                          // `true` if the `policy` is used instead of the global purge and commit options
+  mi_heap_policy_t      policy;                              // purge and commit policy (see `mi_heap_new_with_policy`)
+  size_t                collect_bin;                         // cursor of an incremental collection (see `mi_heap_collect_ex`): current page queue,
+  size_t                collect_page;                        //   and the number of pages already visited in that queue
+  #if MI_GUARDED_SAMPLING
   size_t                guarded_size_min;                    // minimal size for guarded objects
   size_t                guarded_size_max;                    // maximal size for guarded objects
   size_t                guarded_sample_rate;                 // sample rate (set to 0 to disable guarded pages)
   size_t                guarded_sample_seed;                 // starting sample count
   size_t                guarded_sample_count;                // current sample count (counting down to 0)
   #endif
+  mi_bin_churn_t        bin_churn[MI_BIN_FULL];              // adaptive retire and extend heuristics for each size class
   mi_page_t*            pages_free_direct[MI_PAGES_DIRECT];  // optimize: array where every entry points a page with possibly free blocks in the corresponding queue for that size.
   mi_page_queue_t       pages[MI_BIN_FULL + 1];              // queue of pages for each size class (or "bin")
 };
@@ -645,10 +685,8 @@ void _mi_stat_counter_increase(mi_stat_counter_t* stat, size_t amount);
 struct mi_subproc_s {
   _Atomic(size_t)    abandoned_count;         // count of abandoned segments for this sub-process
   _Atomic(size_t)    abandoned_os_list_count; // count of abandoned segments in the os-list
-  mi_lock_t          abandoned_os_lock;       // lock for the abandoned os segment list (outside of arena's) (this lock protect list operations)
   mi_lock_t          abandoned_os_visit_lock; // ensure only one thread per subproc visits the abandoned os list
-  mi_segment_t*      abandoned_os_list;       // doubly-linked list of abandoned segments outside of arena's (in OS allocated memory)
-  mi_segment_t*      abandoned_os_list_tail;  // the tail-end of the list
+  _Atomic(mi_segment_t*) abandoned_os_list;   // lock-free stack of abandoned segments outside of arena's (in OS allocated memory)
   mi_memid_t         memid;                   // provenance of this memory block
 };
 
@@ -666,15 +704,22 @@ typedef struct mi_segment_queue_s {
 } mi_segment_queue_t;
 
 // Segments thread local data
+#define MI_SEGMENT_FREE_BUCKETS  (4)  // segments with free pages are bucketed by occupancy (see `segment.c`)
+
 typedef struct mi_segments_tld_s {
-  mi_segment_queue_t  small_free;   // queue of segments with free small pages
-  mi_segment_queue_t  medium_free;  // queue of segments with free medium pages
+  mi_segment_queue_t  small_free[MI_SEGMENT_FREE_BUCKETS];   // queues of segments with free small pages (by occupancy)
+  mi_segment_queue_t  medium_free[MI_SEGMENT_FREE_BUCKETS];  // queues of segments with free medium pages (by occupancy)
+  mi_segment_queue_t  mlarge_free[MI_SEGMENT_FREE_BUCKETS];  // queues of segments with free medium-large pages (by occupancy)
+  mi_segment_queue_t  shared_free[MI_PAGE_MLARGE+1];         // queues of segments in shared memory with free pages (by page kind)
   mi_page_queue_t     pages_purge;  // queue of freed pages that are delay purged
   size_t              count;        // current number of segments;
   size_t              peak_count;   // peak number of segments
   size_t              current_size; // current size of all segments
   size_t              peak_size;    // peak size of all segments
   size_t              reclaim_count;// number of reclaimed (abandoned) segments
+  mi_arena_id_t       reclaim_hint_arena;  // arena of an abandoned segment that a `free` wants to reclaim (see `segment.c:_mi_segment_reclaim_hinted`)
+  size_t              reclaim_hint_block;  // and the block index of that segment in the arena
+  mi_segment_t*       reclaim_hint_os;     // or an abandoned segment outside arena's that a `free` wants to reclaim
   mi_subproc_t*       subproc;      // sub-process this thread belongs to.
   mi_stats_t*         stats;        // points to tld stats
 } mi_segments_tld_t;
@@ -683,6 +728,7 @@ typedef struct mi_segments_tld_s {
 struct mi_tld_s {
   unsigned long long  heartbeat;     // monotonic heartbeat count
   bool                recurse;       // true if deferred was called; used to prevent infinite recursion.
+  mi_msecs_t          last_generic;  // time of the previous `_mi_malloc_generic` call (if idle trimming is enabled, see `heap.c:_mi_thread_idle_check`)
   mi_heap_t*          heap_backing;  // backing heap of this thread (cannot be deleted)
   mi_heap_t*          heaps;         // list of heaps in this thread (so we can abandon all when the thread terminates)
   mi_segments_tld_t   segments;      // segment tld
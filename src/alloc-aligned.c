@@ -15,21 +15,31 @@ terms of the MIT license. A copy of the license can be found in the file
 // Aligned Allocation
 // ------------------------------------------------------
 
-static bool mi_malloc_is_naturally_aligned( size_t size, size_t alignment ) {
-  // objects up to `MI_MAX_ALIGN_GUARANTEE` are allocated aligned to their size (see `segment.c:_mi_segment_page_start`).
+// Aligned size classes: round up `size` such that the block size of its size class is a multiple of `alignment`.
+// Small and medium pages start at an address aligned to their block size (see `segment.c:_mi_segment_page_start`),
+// so every block in such size class is naturally aligned. This way common alignments (like 64 bytes for cache lines,
+// or 4KiB for OS pages) are allocated through the regular fast path without over-allocation, and without
+// setting `has_aligned` on the page (which would force every free on that page through `_mi_page_ptr_unalign`).
+// Returns `false` if there is no such size class.
+static bool mi_malloc_aligned_size_class( size_t size, size_t alignment, size_t* asize ) {
   mi_assert_internal(_mi_is_power_of_two(alignment) && (alignment > 0));
-  if (alignment > size) return false;
-  if (alignment <= MI_MAX_ALIGN_SIZE) return true;
-  const size_t bsize = mi_good_size(size);
-  return (bsize <= MI_MAX_ALIGN_GUARANTEE && (bsize & (alignment-1)) == 0);
+  if (alignment > MI_MAX_ALIGN_GUARANTEE || size > MI_MAX_ALIGN_GUARANTEE) return false;
+  const size_t psize = _mi_align_up((size==0 ? 1 : size) + MI_PADDING_SIZE, alignment);  // including padding
+  const size_t bsize = _mi_bin_size(_mi_bin(psize));
+  if (bsize > MI_MAX_ALIGN_GUARANTEE || (bsize & (alignment-1)) != 0) return false;
+  mi_assert_internal(psize - MI_PADDING_SIZE >= size);
+  *asize = psize - MI_PADDING_SIZE;
+  return true;
 }
 
-#if MI_GUARDED
+#if MI_GUARDED_SAMPLING
 static mi_decl_restrict void* mi_heap_malloc_guarded_aligned(mi_heap_t* heap, size_t size, size_t alignment, bool zero) mi_attr_noexcept {
   // use over allocation for guarded blocksl
   mi_assert_internal(alignment > 0 && alignment < MI_BLOCK_ALIGNMENT_MAX);
   const size_t oversize = size + alignment - 1;
   void* base = _mi_heap_malloc_guarded(heap, oversize, zero);
+  if (base == NULL) return NULL;
+  mi_track_malloc(base, oversize, zero);
   void* p = mi_align_up_ptr(base, alignment);
   mi_track_align(base, p, (uint8_t*)p - (uint8_t*)base, size);
   mi_assert_internal(mi_usable_size(p) >= size);
@@ -60,14 +70,17 @@ static mi_decl_noinline void* mi_heap_malloc_zero_aligned_at_overalloc(mi_heap_t
   void* p;
   size_t oversize;
   if mi_unlikely(alignment > MI_BLOCK_ALIGNMENT_MAX) {
-    // use OS allocation for very large alignment and allocate inside a huge page (dedicated segment with 1 page)
+    // use arena or OS allocation for very large alignment and allocate inside a huge page (dedicated segment with 1 page)
     // This can support alignments >= MI_SEGMENT_SIZE by ensuring the object can be aligned at a point in the
     // first (and single) page such that the segment info is `MI_SEGMENT_SIZE` bytes before it (so it can be found by aligning the pointer down)
-    if mi_unlikely(offset != 0) {
-      // todo: cannot support offset alignment for very large alignments yet
-#if MI_DEBUG > 0
-      _mi_error_message(EOVERFLOW, "aligned allocation with a very large alignment cannot be used with an alignment offset (size %zu, alignment %zu, offset %zu)\n", size, alignment, offset);
-#endif
+    // With an offset, the aligned point is placed `offset % alignment` bytes before the aligned start of the huge page.
+    // This only works if it is still inside the first `MI_SEGMENT_SIZE` bytes of the segment (so we can find the segment
+    // by aligning the pointer down) which is always the case if the offset is at most `MI_BLOCK_ALIGNMENT_MAX`.
+    const size_t align_ofs = offset & (alignment - 1);
+    if mi_unlikely(align_ofs > MI_BLOCK_ALIGNMENT_MAX) {
+      #if MI_DEBUG > 0
+      _mi_error_message(EOVERFLOW, "aligned allocation with a very large alignment can only be used with an alignment offset up to %zu bytes (size %zu, alignment %zu, offset %zu)\n", (size_t)MI_BLOCK_ALIGNMENT_MAX, size, alignment, offset);
+      #endif
       return NULL;
     }
     oversize = (size <= MI_SMALL_SIZE_MAX ? MI_SMALL_SIZE_MAX + 1 /* ensure we use generic malloc path */ : size);
@@ -92,7 +105,7 @@ static mi_decl_noinline void* mi_heap_malloc_zero_aligned_at_overalloc(mi_heap_t
   void* aligned_p = (void*)((uintptr_t)p + adjust);
   if (aligned_p != p) {
     mi_page_set_has_aligned(page, true);
-    #if MI_GUARDED
+    #if MI_GUARDED_SAMPLING
     // set tag to aligned so mi_usable_size works with guard pages
     if (adjust >= sizeof(mi_block_t)) {
       mi_block_t* const block = (mi_block_t*)p;
@@ -118,13 +131,20 @@ static mi_decl_noinline void* mi_heap_malloc_zero_aligned_at_overalloc(mi_heap_t
     // for the tracker, on huge aligned allocations only from the start of the large block is defined
     mi_track_mem_undefined(aligned_p, size);
     if (zero) {
-      _mi_memzero_aligned(aligned_p, mi_usable_size(aligned_p));
+      if (page->free_is_zero) {
+        // fresh (or purged) memory: only the free list pointer may be non-zero
+        if (adjust < sizeof(mi_block_t)) { ((mi_block_t*)p)->next = 0; }
+        mi_track_mem_defined(aligned_p, mi_usable_size(aligned_p));
+      }
+      else {
+        _mi_memzero_large(aligned_p, mi_usable_size(aligned_p));  // note: with an offset, `aligned_p` may not be word aligned
+      }
     }
   }
 
   if (p != aligned_p) {
     mi_track_align(p,aligned_p,adjust,mi_usable_size(aligned_p));
-    #if MI_GUARDED
+    #if MI_GUARDED_SAMPLING
     mi_track_mem_defined(p, sizeof(mi_block_t));
     #endif
   }
@@ -143,23 +163,6 @@ static mi_decl_noinline void* mi_heap_malloc_zero_aligned_at_generic(mi_heap_t*
     return NULL;
   }
 
-  // use regular allocation if it is guaranteed to fit the alignment constraints.
-  // this is important to try as the fast path in `mi_heap_malloc_zero_aligned` only works when there exist
-  // a page with the right block size, and if we always use the over-alloc fallback that would never happen.
-  if (offset == 0 && mi_malloc_is_naturally_aligned(size,alignment)) {
-    void* p = mi_heap_malloc_zero_no_guarded(heap, size, zero);
-    mi_assert_internal(p == NULL || ((uintptr_t)p % alignment) == 0);
-    const bool is_aligned_or_null = (((uintptr_t)p) & (alignment-1))==0;
-    if mi_likely(is_aligned_or_null) {
-      return p;
-    }
-    else {
-      // this should never happen if the `mi_malloc_is_naturally_aligned` check is correct..
-      mi_assert(false);
-      mi_free(p);
-    }
-  }
-
   // fall back to over-allocation
   return mi_heap_malloc_zero_aligned_at_overalloc(heap,size,alignment,offset,zero);
 }
@@ -176,12 +179,29 @@ static void* mi_heap_malloc_zero_aligned_at(mi_heap_t* const heap, const size_t
     return NULL;
   }
 
-  #if MI_GUARDED
-  if (offset==0 && alignment < MI_BLOCK_ALIGNMENT_MAX && mi_heap_malloc_use_guarded(heap,size)) {
+  #if MI_GUARDED_SAMPLING
+  if mi_unlikely(offset==0 && alignment < MI_BLOCK_ALIGNMENT_MAX && mi_heap_guarded_sample_due(heap,size)) {
     return mi_heap_malloc_guarded_aligned(heap, size, alignment, zero);
   }
   #endif
 
+  // blocks are aligned to `MI_MAX_ALIGN_SIZE` (or to their size if that is smaller), so use a regular allocation for small alignments
+  if mi_likely(offset == 0 && alignment <= MI_MAX_ALIGN_SIZE && alignment <= size) {
+    void* p = mi_heap_malloc_zero_no_guarded(heap, size, zero);
+    mi_assert_internal(p == NULL || _mi_is_aligned(p, alignment));
+    return p;
+  }
+
+  // use an aligned size class if possible; this is important as it avoids both over-allocation and `has_aligned` pages.
+  // note: the fast path below only works if there happens to be a page with the right block size, and
+  // if we would always use the over-alloc fallback that would never happen.
+  size_t asize;
+  if mi_likely(offset == 0 && mi_malloc_aligned_size_class(size, alignment, &asize)) {
+    void* p = mi_heap_malloc_zero_no_guarded(heap, asize, zero);
+    mi_assert_internal(p == NULL || _mi_is_aligned(p, alignment));
+    return p;
+  }
+
   // try first if there happens to be a small block available with just the right alignment
   if mi_likely(size <= MI_SMALL_SIZE_MAX && alignment <= size) {
     const uintptr_t align_mask = alignment-1;       // for any x, `(x & align_mask) == (x % alignment)`
@@ -267,6 +287,30 @@ mi_decl_nodiscard mi_decl_restrict void* mi_calloc_aligned(size_t count, size_t
 }
 
 
+// ------------------------------------------------------
+// I/O buffers: aligned to and sized in multiples of `MI_IO_BLOCK_ALIGN`
+// (as needed for `O_DIRECT` and registered `io_uring` buffers)
+// ------------------------------------------------------
+
+static void* mi_heap_malloc_zero_io(mi_heap_t* heap, size_t size, bool zero) mi_attr_noexcept {
+  if mi_unlikely(size > PTRDIFF_MAX) {  // avoid overflow when rounding up
+    #if MI_DEBUG > 0
+    _mi_error_message(EOVERFLOW, "I/O buffer allocation request is too large (size %zu)\n", size);
+    #endif
+    return NULL;
+  }
+  return mi_heap_malloc_zero_aligned_at(heap, _mi_align_up(size == 0 ? 1 : size, MI_IO_BLOCK_ALIGN), MI_IO_BLOCK_ALIGN, 0, zero);
+}
+
+mi_decl_nodiscard mi_decl_restrict void* mi_heap_malloc_io(mi_heap_t* heap, size_t size) mi_attr_noexcept {
+  return mi_heap_malloc_zero_io(heap, size, false);
+}
+
+mi_decl_nodiscard mi_decl_restrict void* mi_heap_zalloc_io(mi_heap_t* heap, size_t size) mi_attr_noexcept {
+  return mi_heap_malloc_zero_io(heap, size, true);
+}
+
+
 // ------------------------------------------------------
 // Aligned re-allocation
 // ------------------------------------------------------
@@ -287,9 +331,9 @@ static void* mi_heap_realloc_zero_aligned_at(mi_heap_t* heap, void* p, size_t ne
       if (zero && newsize > size) {
         // also set last word in the previous allocation to zero to ensure any padding is zero-initialized
         size_t start = (size >= sizeof(intptr_t) ? size - sizeof(intptr_t) : 0);
-        _mi_memzero((uint8_t*)newp + start, newsize - start);
+        _mi_memzero_large((uint8_t*)newp + start, newsize - start);
       }
-      _mi_memcpy_aligned(newp, p, (newsize > size ? size : newsize));
+      _mi_memcpy_large(newp, p, (newsize > size ? size : newsize));
       mi_free(p); // only free if successful
     }
     return newp;
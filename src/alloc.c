@@ -121,10 +121,6 @@ extern void* _mi_page_malloc_zeroed(mi_heap_t* heap, mi_page_t* page, size_t siz
   return _mi_page_malloc_zero(heap,page,size,true);
 }
 
-#if MI_GUARDED
-mi_decl_restrict void* _mi_heap_malloc_guarded(mi_heap_t* heap, size_t size, bool zero) mi_attr_noexcept;
-#endif
-
 static inline mi_decl_restrict void* mi_heap_malloc_small_zero(mi_heap_t* heap, size_t size, bool zero) mi_attr_noexcept {
   mi_assert(heap != NULL);
   mi_assert(size <= MI_SMALL_SIZE_MAX);
@@ -135,11 +131,6 @@ static inline mi_decl_restrict void* mi_heap_malloc_small_zero(mi_heap_t* heap,
   #if (MI_PADDING || MI_GUARDED)
   if (size == 0) { size = sizeof(void*); }
   #endif
-  #if MI_GUARDED
-  if (mi_heap_malloc_use_guarded(heap,size)) {
-    return _mi_heap_malloc_guarded(heap, size, zero);
-  }
-  #endif
 
   // get page in constant time, and allocate from it
   mi_page_t* page = _mi_heap_get_free_small_page(heap, size + MI_PADDING_SIZE);
@@ -176,11 +167,6 @@ extern inline void* _mi_heap_malloc_zero_ex(mi_heap_t* heap, size_t size, bool z
     mi_assert_internal(huge_alignment == 0);
     return mi_heap_malloc_small_zero(heap, size, zero);
   }
-  #if MI_GUARDED
-  else if (huge_alignment==0 && mi_heap_malloc_use_guarded(heap,size)) {
-    return _mi_heap_malloc_guarded(heap, size, zero);
-  }
-  #endif
   else {
     // regular allocation
     mi_assert(heap!=NULL);
@@ -264,11 +250,43 @@ void* mi_expand(void* p, size_t newsize) mi_attr_noexcept {
   #endif
 }
 
+// Try to shrink a huge block in place to `newsize` bytes and release the memory of the tail.
+static bool mi_heap_try_shrink_huge(mi_heap_t* heap, void* p, size_t size, size_t newsize) {
+  mi_segment_t* const segment = _mi_ptr_segment(p);
+  mi_page_t* const page = _mi_segment_page_of(segment, p);
+  if (!mi_page_is_huge(page) || mi_atomic_load_relaxed(&segment->thread_id) != _mi_segment_owner_id(segment, heap->thread_id)) return false;
+  mi_block_t* const block = (mi_page_has_aligned(page) ? _mi_page_ptr_unalign(page, p) : (mi_block_t*)p);
+  #if MI_GUARDED_SAMPLING
+  if (mi_block_ptr_is_guarded(block, p)) return false;  // keep the guard page at the end
+  #endif
+  const size_t ofs = (size_t)((uint8_t*)p - (uint8_t*)block);
+  const size_t bsize = mi_page_block_size(page);
+  if (!_mi_segment_huge_page_shrink(segment, page, ofs + newsize + MI_PADDING_SIZE, &heap->tld->segments)) return false;
+  mi_heap_stat_decrease(heap, huge, bsize - mi_page_block_size(page));  // match stat in free.c:mi_stat_free
+  #if MI_PADDING
+  // set new padding at the end of the shrunk block
+  mi_padding_t* const padding = (mi_padding_t*)((uint8_t*)block + mi_page_usable_block_size(page));
+  mi_track_mem_defined(padding, sizeof(mi_padding_t));
+  padding->canary = mi_ptr_encode_canary(page, block, page->keys);
+  padding->delta  = (uint32_t)(mi_page_usable_block_size(page) - ofs - newsize);
+  #endif
+  #if (MI_STAT>1)
+  mi_heap_stat_decrease(heap, malloc, size - _mi_usable_size(p, "mi_realloc"));
+  #endif
+  MI_UNUSED(size); MI_UNUSED(bsize);
+  return true;
+}
+
 void* _mi_heap_realloc_zero(mi_heap_t* heap, void* p, size_t newsize, bool zero) mi_attr_noexcept {
   // if p == NULL then behave as malloc.
   // else if size == 0 then reallocate to a zero-sized block (and don't return NULL, just as mi_malloc(0)).
   // (this means that returning NULL always indicates an error, and `p` will not have been freed in that case.)
   const size_t size = _mi_usable_size(p,"mi_realloc"); // also works if p == NULL (with size 0)
+  if mi_unlikely(newsize < size && newsize > MI_LARGE_OBJ_SIZE_MAX) {
+    // shrink huge blocks in place (and release the tail memory)
+    mi_assert_internal(p!=NULL);
+    if (mi_heap_try_shrink_huge(heap, p, size, newsize)) return p;
+  }
   if mi_unlikely(newsize <= size && newsize >= (size / 2) && newsize > 0) {  // note: newsize must be > 0 or otherwise we return NULL for realloc(NULL,0)
     mi_assert_internal(p!=NULL);
     // todo: do not track as the usable size is still the same in the free; adjust potential padding?
@@ -281,7 +299,7 @@ void* _mi_heap_realloc_zero(mi_heap_t* heap, void* p, size_t newsize, bool zero)
     if (zero && newsize > size) {
       // also set last word in the previous allocation to zero to ensure any padding is zero-initialized
       const size_t start = (size >= sizeof(intptr_t) ? size - sizeof(intptr_t) : 0);
-      _mi_memzero((uint8_t*)newp + start, newsize - start);
+      _mi_memzero_large((uint8_t*)newp + start, newsize - start);
     }
     else if (newsize == 0) {
       ((uint8_t*)newp)[0] = 0; // work around for applications that expect zero-reallocation to be zero initialized (issue #725)
@@ -289,7 +307,7 @@ void* _mi_heap_realloc_zero(mi_heap_t* heap, void* p, size_t newsize, bool zero)
     if mi_likely(p != NULL) {
       const size_t copysize = (newsize > size ? size : newsize);
       mi_track_mem_defined(p,copysize);  // _mi_useable_size may be too large for byte precise memory tracking..
-      _mi_memcpy(newp, p, copysize);
+      _mi_memcpy_large(newp, p, copysize);
       mi_free(p); // only free the original pointer if successful
     }
   }
@@ -603,7 +621,7 @@ mi_decl_nodiscard void* mi_new_reallocn(void* p, size_t newcount, size_t size) {
   }
 }
 
-#if MI_GUARDED
+#if MI_GUARDED_SAMPLING
 // We always allocate a guarded allocation at an offset (`mi_page_has_aligned` will be true).
 // We then set the first word of the block to `0` for regular offset aligned allocations (in `alloc-aligned.c`)
 // and the first word to `~0` for guarded allocations to have a correct `mi_usable_size`
@@ -625,12 +643,11 @@ static void* mi_block_ptr_set_guarded(mi_block_t* block, size_t obj_size) {
     return NULL;
   }
   uint8_t* guard_page = (uint8_t*)block + block_size - os_page_size;
-  mi_assert_internal(_mi_is_aligned(guard_page, os_page_size));
   if (segment->allow_decommit && _mi_is_aligned(guard_page, os_page_size)) {
     _mi_os_protect(guard_page, os_page_size);
   }
   else {
-    _mi_warning_message("unable to set a guard page behind an object due to pinned memory (large OS pages?) (object %p of size %zu)\n", block, block_size);
+    _mi_warning_message("unable to set a guard page behind an object due to pinned memory (large OS pages?) or an unaligned page (object %p of size %zu)\n", block, block_size);
   }
 
   // align pointer just in front of the guard page
@@ -657,17 +674,13 @@ mi_decl_restrict void* _mi_heap_malloc_guarded(mi_heap_t* heap, size_t size, boo
   const size_t obj_size = (mi_option_is_enabled(mi_option_guarded_precise) ? size : _mi_align_up(size, MI_MAX_ALIGN_SIZE));
   const size_t bsize    = _mi_align_up(_mi_align_up(obj_size, MI_MAX_ALIGN_SIZE) + sizeof(mi_block_t), MI_MAX_ALIGN_SIZE);
   const size_t req_size = _mi_align_up(bsize + os_page_size, os_page_size);
+  heap->guarded_sample_count = heap->guarded_sample_rate;  // reset the sample count (before allocating through the slow path)
   mi_block_t* const block = (mi_block_t*)_mi_malloc_generic(heap, req_size, zero, 0 /* huge_alignment */);
   if (block==NULL) return NULL;
   void* const p   = mi_block_ptr_set_guarded(block, obj_size);
 
-  // stats
-  mi_track_malloc(p, size, zero);  
+  // stats (note: the `malloc` statistic and tracking is done by the caller)
   if (p != NULL) {
-    if (!mi_heap_is_initialized(heap)) { heap = mi_prim_get_default_heap(); }
-    #if MI_STAT>1
-    mi_heap_stat_increase(heap, malloc, mi_usable_size(p));
-    #endif
     _mi_stat_counter_increase(&heap->tld->stats.guarded_alloc_count, 1);
   }
   #if MI_DEBUG>3
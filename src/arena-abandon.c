@@ -17,6 +17,7 @@ terms of the MIT license. A copy of the license can be found in the file
 size_t      mi_arena_id_index(mi_arena_id_t id);
 mi_arena_t* mi_arena_from_index(size_t idx);
 size_t      mi_arena_get_count(void);
+bool        mi_arena_index_is_valid(size_t idx);
 void*       mi_arena_block_start(mi_arena_t* arena, mi_bitmap_index_t bindex);
 bool        mi_arena_memid_indices(mi_memid_t memid, size_t* arena_index, mi_bitmap_index_t* bitmap_index);
 
@@ -35,8 +36,13 @@ bool        mi_arena_memid_indices(mi_memid_t memid, size_t* arena_index, mi_bit
 
   Abandoned segments are atomically marked in the `block_abandoned`
   bitmap of arenas. Any segments allocated outside arenas are put
-  in the sub-process `abandoned_os_list`. This list is accessed
-  using locks but this should be uncommon and generally uncontended.
+  in the sub-process `abandoned_os_list`. This is a lock-free
+  stack: abandoning a segment pushes it, and a cursor takes the
+  whole stack at once (holding the `abandoned_os_visit_lock`) and
+  pushes back what it did not visit. Since we never pop a single
+  element there is no A-B-A problem. To reclaim a specific OS segment
+  (on a `free`) we likewise take the whole stack under the visit lock,
+  unlink the segment, and push back the rest.
   Reclaim and visiting either scan through the `block_abandoned`
   bitmaps of the arena's, or visit the `abandoned_os_list`
 
@@ -46,54 +52,97 @@ bool        mi_arena_memid_indices(mi_memid_t memid, size_t* arena_index, mi_bit
 ----------------------------------------------------------- */
 
 
-// reclaim a specific OS abandoned segment; `true` on success.
-// sets the thread_id.
-static bool mi_arena_segment_os_clear_abandoned(mi_segment_t* segment, bool take_lock) {
-  mi_assert(segment->memid.memkind != MI_MEM_ARENA);
-  // not in an arena, remove from list of abandoned os segments
-  mi_subproc_t* const subproc = segment->subproc;
-  if (take_lock && !mi_lock_try_acquire(&subproc->abandoned_os_lock)) {
-    return false;  // failed to acquire the lock, we just give up
+// The visit lock of an arena; a shared arena uses a spin lock in the arena itself
+// instead as it must exclude threads in other processes as well.
+static bool mi_arena_visit_lock_try_acquire(mi_arena_t* arena) {
+  if mi_likely(!arena->is_shared) return mi_lock_try_acquire(&arena->abandoned_visit_lock);
+  uintptr_t expected = 0;
+  return mi_atomic_cas_strong_acq_rel(&arena->shared_visit_lock, &expected, (uintptr_t)1);
+}
+
+static void mi_arena_visit_lock_acquire(mi_arena_t* arena) {
+  if mi_likely(!arena->is_shared) { mi_lock_acquire(&arena->abandoned_visit_lock); return; }
+  while (!mi_arena_visit_lock_try_acquire(arena)) { mi_atomic_yield(); }
+}
+
+static void mi_arena_visit_lock_release(mi_arena_t* arena) {
+  if mi_likely(!arena->is_shared) { mi_lock_release(&arena->abandoned_visit_lock); return; }
+  mi_atomic_store_release(&arena->shared_visit_lock, (uintptr_t)0);
+}
+
+
+// reverse a list of abandoned os segments
+static mi_segment_t* mi_abandoned_os_list_reverse(mi_segment_t* list) {
+  mi_segment_t* reversed = NULL;
+  while (list != NULL) {
+    mi_segment_t* const next = list->abandoned_os_next;
+    list->abandoned_os_next = reversed;
+    reversed = list;
+    list = next;
+  }
+  return reversed;
+}
+
+// push back a (newest-first) list of abandoned os segments that was taken from the stack while holding
+// the visit lock; it goes below any segments that were abandoned in the meantime as those are newer.
+static void mi_abandoned_os_list_push_back(mi_subproc_t* subproc, mi_segment_t* first) {
+  mi_segment_t* expected = NULL;
+  while (!mi_atomic_cas_ptr_weak_release(mi_segment_t, &subproc->abandoned_os_list, &expected, first)) {
+    // since we hold the visit lock, other threads can only push; take those and put them on top
+    mi_segment_t* newer = mi_atomic_exchange_ptr_acq_rel(mi_segment_t, &subproc->abandoned_os_list, NULL);
+    if (newer != NULL) {
+      mi_segment_t* newer_last = newer;
+      while (newer_last->abandoned_os_next != NULL) { newer_last = newer_last->abandoned_os_next; }
+      newer_last->abandoned_os_next = first;
+      first = newer;
+    }
+    expected = NULL;
   }
-  // remove atomically from the abandoned os list (if possible!)
-  bool reclaimed = false;
-  mi_segment_t* const next = segment->abandoned_os_next;
-  mi_segment_t* const prev = segment->abandoned_os_prev;
-  if (next != NULL || prev != NULL || subproc->abandoned_os_list == segment) {
-    #if MI_DEBUG>3
-    // find ourselves in the abandoned list (and check the count)
-    bool found = false;
-    size_t count = 0;
-    for (mi_segment_t* current = subproc->abandoned_os_list; current != NULL; current = current->abandoned_os_next) {
-      if (current == segment) { found = true; }
-      count++;
+}
+
+// Try to reclaim a specific OS abandoned segment (as hinted by a `free`, see `segment.c:_mi_segment_reclaim_hinted`).
+// The segment may have been reclaimed (or freed) since, so it is only accessed if it is still in the abandoned list.
+// As the stack cannot remove an element in the middle, we take the whole stack (holding the visit lock,
+// but we never block on it), unlink the segment, and push back the rest.
+// This does not set the thread id (so it appears as still abandoned)
+mi_segment_t* _mi_arena_segment_os_clear_abandoned_hinted(mi_segment_t* segment, mi_subproc_t* subproc) {
+  if (mi_atomic_load_relaxed(&subproc->abandoned_os_list_count) == 0) return NULL;
+  if (!mi_lock_try_acquire(&subproc->abandoned_os_visit_lock)) return NULL;
+  mi_segment_t* list = mi_atomic_exchange_ptr_acq_rel(mi_segment_t, &subproc->abandoned_os_list, NULL);
+  mi_segment_t* found = NULL;
+  mi_segment_t* prev = NULL;
+  for (mi_segment_t* current = list; current != NULL; prev = current, current = current->abandoned_os_next) {
+    if (current == segment) {
+      if (prev == NULL) { list = current->abandoned_os_next; }
+                   else { prev->abandoned_os_next = current->abandoned_os_next; }
+      current->abandoned_os_next = NULL;
+      found = current;
+      break;
     }
-    mi_assert_internal(found);
-    mi_assert_internal(count == mi_atomic_load_relaxed(&subproc->abandoned_os_list_count));
-    #endif
-    // remove (atomically) from the list and reclaim
-    if (prev != NULL) { prev->abandoned_os_next = next; }
-    else { subproc->abandoned_os_list = next; }
-    if (next != NULL) { next->abandoned_os_prev = prev; }
-    else { subproc->abandoned_os_list_tail = prev; }
-    segment->abandoned_os_next = NULL;
-    segment->abandoned_os_prev = NULL;
+  }
+  if (list != NULL) { mi_abandoned_os_list_push_back(subproc, list); }
+  mi_lock_release(&subproc->abandoned_os_visit_lock);
+  if (found != NULL) {
     mi_atomic_decrement_relaxed(&subproc->abandoned_count);
     mi_atomic_decrement_relaxed(&subproc->abandoned_os_list_count);
-    if (take_lock) { // don't reset the thread_id when iterating
-      mi_atomic_store_release(&segment->thread_id, _mi_thread_id());
-    }
-    reclaimed = true;
   }
-  if (take_lock) { mi_lock_release(&segment->subproc->abandoned_os_lock); }
-  return reclaimed;
+  return found;
+}
+
+// reclaim a specific OS abandoned segment; `true` on success.
+static bool mi_arena_segment_os_clear_abandoned(mi_segment_t* segment) {
+  mi_assert(segment->memid.memkind != MI_MEM_ARENA);
+  if (_mi_arena_segment_os_clear_abandoned_hinted(segment, segment->subproc) == NULL) return false;
+  mi_assert_internal(mi_atomic_load_acquire(&segment->thread_id) == 0);
+  mi_atomic_store_release(&segment->thread_id, _mi_segment_owner_id(segment, _mi_thread_id()));
+  return true;
 }
 
 // reclaim a specific abandoned segment; `true` on success.
 // sets the thread_id.
 bool _mi_arena_segment_clear_abandoned(mi_segment_t* segment) {
   if mi_unlikely(segment->memid.memkind != MI_MEM_ARENA) {
-    return mi_arena_segment_os_clear_abandoned(segment, true /* take lock */);
+    return mi_arena_segment_os_clear_abandoned(segment);
   }
   // arena segment: use the blocks_abandoned bitmap.
   size_t arena_idx;
@@ -106,7 +155,7 @@ bool _mi_arena_segment_clear_abandoned(mi_segment_t* segment) {
   if (was_marked) {
     mi_assert_internal(mi_atomic_load_acquire(&segment->thread_id) == 0);
     mi_atomic_decrement_relaxed(&segment->subproc->abandoned_count);
-    mi_atomic_store_release(&segment->thread_id, _mi_thread_id());
+    mi_atomic_store_release(&segment->thread_id, _mi_segment_owner_id(segment, _mi_thread_id()));
   }
   // mi_assert_internal(was_marked);
   mi_assert_internal(!was_marked || _mi_bitmap_is_claimed(arena->blocks_inuse, arena->field_count, 1, bitmap_idx));
@@ -118,24 +167,15 @@ bool _mi_arena_segment_clear_abandoned(mi_segment_t* segment) {
 // mark a specific OS segment as abandoned
 static void mi_arena_segment_os_mark_abandoned(mi_segment_t* segment) {
   mi_assert(segment->memid.memkind != MI_MEM_ARENA);
-  // not in an arena; we use a list of abandoned segments
+  // not in an arena; push on the lock-free stack of abandoned segments.
+  // note: we never pop single elements (but take the whole stack in a cursor) so there is no A-B-A problem
   mi_subproc_t* const subproc = segment->subproc;
-  mi_lock(&subproc->abandoned_os_lock) {
-    // push on the tail of the list (important for the visitor)
-    mi_segment_t* prev = subproc->abandoned_os_list_tail;
-    mi_assert_internal(prev == NULL || prev->abandoned_os_next == NULL);
-    mi_assert_internal(segment->abandoned_os_prev == NULL);
-    mi_assert_internal(segment->abandoned_os_next == NULL);
-    if (prev != NULL) { prev->abandoned_os_next = segment; }
-    else { subproc->abandoned_os_list = segment; }
-    subproc->abandoned_os_list_tail = segment;
-    segment->abandoned_os_prev = prev;
-    segment->abandoned_os_next = NULL;
-    mi_atomic_increment_relaxed(&subproc->abandoned_os_list_count);
-    mi_atomic_increment_relaxed(&subproc->abandoned_count);
-    // and release the lock
-  }
-  return;
+  mi_atomic_increment_relaxed(&subproc->abandoned_os_list_count);
+  mi_atomic_increment_relaxed(&subproc->abandoned_count);
+  mi_segment_t* next = mi_atomic_load_ptr_relaxed(mi_segment_t, &subproc->abandoned_os_list);
+  do {
+    segment->abandoned_os_next = next;
+  } while (!mi_atomic_cas_ptr_weak_release(mi_segment_t, &subproc->abandoned_os_list, &next, segment));
 }
 
 // mark a specific segment as abandoned
@@ -175,6 +215,8 @@ void _mi_arena_field_cursor_init(mi_heap_t* heap, mi_subproc_t* subproc, bool vi
   current->subproc = subproc;
   current->visit_all = visit_all;
   current->hold_visit_lock = false;
+  current->os_list_taken = false;
+  current->os_list = NULL;
   const size_t abandoned_count = mi_atomic_load_relaxed(&subproc->abandoned_count);
   const size_t abandoned_list_count = mi_atomic_load_relaxed(&subproc->abandoned_os_list_count);
   const size_t max_arena = mi_arena_get_count();
@@ -182,10 +224,12 @@ void _mi_arena_field_cursor_init(mi_heap_t* heap, mi_subproc_t* subproc, bool vi
     // for a heap that is bound to one arena, only visit that arena
     current->start = mi_arena_id_index(heap->arena_id);
     current->end = current->start + 1;
+    current->arena_count = 0;  // no wrap around (as it can be a shared arena slot beyond the arena count)
     current->os_list_count = 0;
   }
   else {
     // otherwise visit all starting at a random location
+    current->arena_count = max_arena;
     if (abandoned_count > abandoned_list_count && max_arena > 0) {
       current->start = (heap == NULL || max_arena == 0 ? 0 : (mi_arena_id_t)(_mi_heap_random_next(heap) % max_arena));
       current->end = current->start + max_arena;
@@ -196,10 +240,17 @@ void _mi_arena_field_cursor_init(mi_heap_t* heap, mi_subproc_t* subproc, bool vi
     }
     current->os_list_count = abandoned_list_count; // max entries to visit in the os abandoned list
   }
-  mi_assert_internal(current->start <= max_arena);
+  mi_assert_internal(current->start <= max_arena || current->arena_count == 0);
 }
 
 void _mi_arena_field_cursor_done(mi_arena_field_cursor_t* current) {
+  if (current->os_list != NULL) {
+    // push back the abandoned os segments that we did not visit (in newest-first order again) but below
+    // any segments that were abandoned in the meantime as those are newer.
+    mi_assert_internal(current->hold_visit_lock);
+    mi_abandoned_os_list_push_back(current->subproc, mi_abandoned_os_list_reverse(current->os_list));
+    current->os_list = NULL;
+  }
   if (current->hold_visit_lock) {
     mi_lock_release(&current->subproc->abandoned_os_visit_lock);
     current->hold_visit_lock = false;
@@ -216,8 +267,8 @@ static mi_segment_t* mi_arena_segment_clear_abandoned_at(mi_arena_t* arena, mi_s
   // note: this is the reason we need the `abandoned_visit` lock in the case abandoned visiting is enabled.
   //  without the lock an abandoned visit may otherwise fail to visit all abandoned segments in the sub-process.
   //  for regular reclaim it is fine to miss one sometimes so without abandoned visiting we don't need the `abandoned_visit` lock.
-  if (segment->subproc != subproc) {
-    // it is from another sub-process, re-mark it and continue searching
+  if (segment->subproc != subproc || _mi_segment_is_foreign(segment)) {
+    // it is from another sub-process (or another process for shared arena's), re-mark it and continue searching
     const bool was_zero = _mi_bitmap_claim(arena->blocks_abandoned, arena->field_count, 1, bitmap_idx, NULL);
     mi_assert_internal(was_zero); MI_UNUSED(was_zero);
     return NULL;
@@ -229,14 +280,30 @@ static mi_segment_t* mi_arena_segment_clear_abandoned_at(mi_arena_t* arena, mi_s
   }
 }
 
+// Try to reclaim the abandoned segment at a specific arena block (as hinted by a `free`, see `segment.c:_mi_segment_reclaim_hinted`).
+// The segment may have been reclaimed (or freed) since, so it is only accessed if it is still marked as abandoned.
+// This does not set the thread id (so it appears as still abandoned)
+mi_segment_t* _mi_arena_segment_clear_abandoned_at_block(mi_arena_id_t arena_id, size_t block_index, mi_subproc_t* subproc) {
+  const size_t arena_idx = mi_arena_id_index(arena_id);
+  if (!mi_arena_index_is_valid(arena_idx)) return NULL;
+  mi_arena_t* const arena = mi_arena_from_index(arena_idx);
+  if (arena == NULL || block_index >= arena->block_count) return NULL;
+  // like the cursor, we need the visit lock if abandoned visiting is enabled (but we never block on it)
+  const bool needs_lock = mi_option_is_enabled(mi_option_visit_abandoned);
+  if (needs_lock && !mi_arena_visit_lock_try_acquire(arena)) return NULL;
+  mi_segment_t* const segment = mi_arena_segment_clear_abandoned_at(arena, subproc, block_index);
+  if (needs_lock) { mi_arena_visit_lock_release(arena); }
+  return segment;
+}
+
 static mi_segment_t* mi_arena_segment_clear_abandoned_next_field(mi_arena_field_cursor_t* previous) {
-  const size_t max_arena = mi_arena_get_count();
+  const size_t max_arena = previous->arena_count;
   size_t field_idx = mi_bitmap_index_field(previous->bitmap_idx);
   size_t bit_idx = mi_bitmap_index_bit_in_field(previous->bitmap_idx);
   // visit arena's (from the previous cursor)
   for (; previous->start < previous->end; previous->start++, field_idx = 0, bit_idx = 0) {
-    // index wraps around
-    size_t arena_idx = (previous->start >= max_arena ? previous->start % max_arena : previous->start);
+    // index wraps around (unless visiting the single arena of a bound heap)
+    size_t arena_idx = (max_arena > 0 && previous->start >= max_arena ? previous->start % max_arena : previous->start);
     mi_arena_t* arena = mi_arena_from_index(arena_idx);
     if (arena != NULL) {
       bool has_lock = false;
@@ -246,7 +313,7 @@ static mi_segment_t* mi_arena_segment_clear_abandoned_next_field(mi_arena_field_
         if mi_unlikely(field != 0) { // skip zero fields quickly
           // we only take the arena lock if there are actually abandoned segments present
           if (!has_lock && mi_option_is_enabled(mi_option_visit_abandoned)) {
-            has_lock = (previous->visit_all ? (mi_lock_acquire(&arena->abandoned_visit_lock),true) : mi_lock_try_acquire(&arena->abandoned_visit_lock));
+            has_lock = (previous->visit_all ? (mi_arena_visit_lock_acquire(arena),true) : mi_arena_visit_lock_try_acquire(arena));
             if (!has_lock) {
               if (previous->visit_all) {
                 _mi_error_message(EFAULT, "internal error: failed to visit all abandoned segments due to failure to acquire the visitor lock");
@@ -265,7 +332,7 @@ static mi_segment_t* mi_arena_segment_clear_abandoned_next_field(mi_arena_field_
               mi_segment_t* const segment = mi_arena_segment_clear_abandoned_at(arena, previous->subproc, bitmap_idx);
               if (segment != NULL) {
                 //mi_assert_internal(arena->blocks_committed == NULL || _mi_bitmap_is_claimed(arena->blocks_committed, arena->field_count, 1, bitmap_idx));
-                if (has_lock) { mi_lock_release(&arena->abandoned_visit_lock); }
+                if (has_lock) { mi_arena_visit_lock_release(arena); }
                 previous->bitmap_idx = mi_bitmap_index_create_ex(field_idx, bit_idx + 1); // start at next one for the next iteration
                 return segment;
               }
@@ -273,13 +340,14 @@ static mi_segment_t* mi_arena_segment_clear_abandoned_next_field(mi_arena_field_
           }
         }
       }
-      if (has_lock) { mi_lock_release(&arena->abandoned_visit_lock); }
+      if (has_lock) { mi_arena_visit_lock_release(arena); }
     }
   }
   return NULL;
 }
 
 static mi_segment_t* mi_arena_segment_clear_abandoned_next_list(mi_arena_field_cursor_t* previous) {
+  if (previous->os_list_count == 0) return NULL;
   // go through the abandoned_os_list
   // we only allow one thread per sub-process to do to visit guarded by the `abandoned_os_visit_lock`.
   // The lock is released when the cursor is released.
@@ -293,22 +361,23 @@ static mi_segment_t* mi_arena_segment_clear_abandoned_next_list(mi_arena_field_c
       return NULL; // we cannot get the lock, give up
     }
   }
-  // One list entry at a time
-  while (previous->os_list_count > 0) {
-    previous->os_list_count--;
-    mi_lock_acquire(&previous->subproc->abandoned_os_lock); // this could contend with concurrent OS block abandonment and reclaim from `free`
-    mi_segment_t* segment = previous->subproc->abandoned_os_list;
-    // pop from head of the list, a subsequent mark will push at the end (and thus we iterate through os_list_count entries)
-    if (segment == NULL || mi_arena_segment_os_clear_abandoned(segment, false /* we already have the lock */)) {
-      mi_lock_release(&previous->subproc->abandoned_os_lock);
-      return segment;
-    }
-    // already abandoned, try again
-    mi_lock_release(&previous->subproc->abandoned_os_lock);
+  if (!previous->os_list_taken) {
+    // take the whole stack at once; segments that are abandoned again while we visit are
+    // pushed on the (fresh) shared stack so we visit each segment at most once.
+    // We visit the oldest segments first as those are the most likely to be (almost) free.
+    // Any segments that are left are pushed back in `_mi_arena_field_cursor_done`.
+    previous->os_list = mi_abandoned_os_list_reverse(mi_atomic_exchange_ptr_acq_rel(mi_segment_t, &previous->subproc->abandoned_os_list, NULL));
+    previous->os_list_taken = true;
   }
-  // done
-  mi_assert_internal(previous->os_list_count == 0);
-  return NULL;
+  // One list entry at a time
+  mi_segment_t* const segment = previous->os_list;
+  if (segment == NULL) return NULL;
+  previous->os_list_count--;
+  previous->os_list = segment->abandoned_os_next;
+  segment->abandoned_os_next = NULL;
+  mi_atomic_decrement_relaxed(&previous->subproc->abandoned_count);
+  mi_atomic_decrement_relaxed(&previous->subproc->abandoned_os_list_count);
+  return segment;
 }
 
 
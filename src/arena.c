@@ -22,6 +22,7 @@ The arena allocation needs to be thread safe and we use an atomic bitmap to allo
 #include "mimalloc.h"
 #include "mimalloc/internal.h"
 #include "mimalloc/atomic.h"
+#include "mimalloc/prim.h"  // _mi_prim_thread_start
 #include "bitmap.h"
 
 
@@ -41,7 +42,9 @@ typedef struct mi_arena_s {
   int                 numa_node;            // associated NUMA node
   bool                exclusive;            // only allow allocations if specifically for this arena
   bool                is_large;             // memory area consists of large- or huge OS pages (always committed)
+  bool                is_shared;            // memory area is shared between processes (see `mi_manage_shared_memory`)
   mi_lock_t           abandoned_visit_lock; // lock is only used when abandoned segments are being visited
+  _Atomic(uintptr_t)  shared_visit_lock;    // used instead of `abandoned_visit_lock` in a shared arena (as it must work across processes)
   _Atomic(size_t)     search_idx;           // optimization to start the search for free blocks
   _Atomic(mi_msecs_t) purge_expire;         // expiration time when blocks should be purged from `blocks_purge`.
   
@@ -57,10 +60,13 @@ typedef struct mi_arena_s {
 #define MI_ARENA_BLOCK_SIZE   (MI_SEGMENT_SIZE)        // 64MiB  (must be at least MI_SEGMENT_ALIGN)
 #define MI_ARENA_MIN_OBJ_SIZE (MI_ARENA_BLOCK_SIZE/2)  // 32MiB
 #define MI_MAX_ARENAS         (132)                    // Limited as the reservation exponentially increases (and takes up .bss)
+#define MI_MAX_SHARED_ARENAS  (4)                      // Shared arena's use separate slots after the regular ones (see `mi_shared_arena_create`)
+#define MI_ARENA_SLOTS        (MI_MAX_ARENAS + MI_MAX_SHARED_ARENAS)
 
 // The available arenas
-static mi_decl_cache_align _Atomic(mi_arena_t*) mi_arenas[MI_MAX_ARENAS];
-static mi_decl_cache_align _Atomic(size_t)      mi_arena_count; // = 0
+static mi_decl_cache_align _Atomic(mi_arena_t*) mi_arenas[MI_ARENA_SLOTS];
+static mi_decl_cache_align _Atomic(size_t)      mi_arena_count; // = 0  (of the regular arena's only)
+static mi_decl_cache_align _Atomic(size_t)      mi_shared_arena_segments[MI_MAX_SHARED_ARENAS]; // segments of this process in each shared arena
 static mi_decl_cache_align _Atomic(int64_t)     mi_arenas_purge_expire; // set if there exist purgeable arenas
 
 #define MI_IN_ARENA_C
@@ -73,11 +79,11 @@ static mi_decl_cache_align _Atomic(int64_t)     mi_arenas_purge_expire; // set i
 ----------------------------------------------------------- */
 
 size_t mi_arena_id_index(mi_arena_id_t id) {
-  return (size_t)(id <= 0 ? MI_MAX_ARENAS : id - 1);
+  return (size_t)(id <= 0 ? MI_ARENA_SLOTS : id - 1);
 }
 
 static mi_arena_id_t mi_arena_id_create(size_t arena_index) {
-  mi_assert_internal(arena_index < MI_MAX_ARENAS);
+  mi_assert_internal(arena_index < MI_ARENA_SLOTS);
   return (int)arena_index + 1;
 }
 
@@ -99,12 +105,36 @@ bool _mi_arena_memid_is_suitable(mi_memid_t memid, mi_arena_id_t request_arena_i
   }
 }
 
+// Is the memory allocated from the OS (directly or through an arena), and not external memory?
+bool _mi_arena_memid_is_os(mi_memid_t memid) {
+  if (memid.memkind == MI_MEM_ARENA) {
+    mi_arena_t* arena = mi_atomic_load_ptr_relaxed(mi_arena_t, &mi_arenas[mi_arena_id_index(memid.mem.arena.id)]);
+    return (arena != NULL && mi_memkind_is_os(arena->memid.memkind));
+  }
+  else {
+    return mi_memkind_is_os(memid.memkind);
+  }
+}
+
+// Is the arena shared between processes? (see `mi_manage_shared_memory`)
+bool _mi_arena_id_is_shared(mi_arena_id_t arena_id) {
+  const size_t arena_index = mi_arena_id_index(arena_id);
+  if (arena_index >= MI_ARENA_SLOTS) return false;
+  mi_arena_t* arena = mi_atomic_load_ptr_relaxed(mi_arena_t, &mi_arenas[arena_index]);
+  return (arena != NULL && arena->is_shared);
+}
+
 size_t mi_arena_get_count(void) {
   return mi_atomic_load_relaxed(&mi_arena_count);
 }
 
+// Is this the index of a regular arena or of a shared arena slot?
+bool mi_arena_index_is_valid(size_t idx) {
+  return (idx < mi_arena_get_count() || (idx >= MI_MAX_ARENAS && idx < MI_ARENA_SLOTS));
+}
+
 mi_arena_t* mi_arena_from_index(size_t idx) {
-  mi_assert_internal(idx < mi_arena_get_count());
+  mi_assert_internal(mi_arena_index_is_valid(idx));
   return mi_atomic_load_ptr_acquire(mi_arena_t, &mi_arenas[idx]);
 }
 
@@ -204,7 +234,7 @@ void _mi_arena_meta_free(void* p, mi_memid_t memid, size_t size) {
     _mi_os_free(p, size, memid);
   }
   else {
-    mi_assert(memid.memkind == MI_MEM_STATIC);
+    mi_assert(memid.memkind == MI_MEM_STATIC || memid.memkind == MI_MEM_EXTERNAL);  // external for shared arenas
   }
 }
 
@@ -228,24 +258,44 @@ static bool mi_arena_try_claim(mi_arena_t* arena, size_t blocks, mi_bitmap_index
   return false;
 }
 
+// claim the `blocks_inuse` bits such that the start of the blocks plus `align_offset` is aligned to `alignment`.
+// This is used for large alignments (> MI_ARENA_BLOCK_SIZE) or with an offset (for huge aligned segments),
+// where we search only the block indices that satisfy the alignment (instead of over-allocating from the OS).
+static bool mi_arena_try_claim_aligned(mi_arena_t* arena, size_t blocks, size_t alignment, size_t align_offset, mi_bitmap_index_t* bitmap_idx)
+{
+  mi_assert_internal(_mi_is_aligned(arena->start, MI_ARENA_BLOCK_SIZE));
+  mi_assert_internal(alignment % MI_ARENA_BLOCK_SIZE == 0 && align_offset % MI_ARENA_BLOCK_SIZE == 0);
+  const size_t bit_align = alignment / MI_ARENA_BLOCK_SIZE;
+  const size_t start_bit = ((uintptr_t)mi_atomic_load_ptr_relaxed(uint8_t,&arena->start) + align_offset) / MI_ARENA_BLOCK_SIZE;  // the block at bit index 0 (plus offset)
+  const size_t bit_start = (bit_align - (start_bit % bit_align)) % bit_align;
+  return _mi_bitmap_try_find_claim_aligned_across(arena->blocks_inuse, arena->field_count, blocks, bit_align, bit_start, bitmap_idx);
+}
+
 
 /* -----------------------------------------------------------
   Arena Allocation
 ----------------------------------------------------------- */
 
 static mi_decl_noinline void* mi_arena_try_alloc_at(mi_arena_t* arena, size_t arena_index, size_t needed_bcount,
-                                                    bool commit, mi_memid_t* memid)
+                                                    size_t alignment, size_t align_offset, bool commit, mi_memid_t* memid)
 {
   MI_UNUSED(arena_index);
   mi_assert_internal(mi_arena_id_index(arena->id) == arena_index);
 
   mi_bitmap_index_t bitmap_index;
-  if (!mi_arena_try_claim(arena, needed_bcount, &bitmap_index)) return NULL;
+  if (alignment <= MI_SEGMENT_ALIGN && align_offset == 0) {
+    if (!mi_arena_try_claim(arena, needed_bcount, &bitmap_index)) return NULL;
+  }
+  else {
+    if (!mi_arena_try_claim_aligned(arena, needed_bcount, alignment, align_offset, &bitmap_index)) return NULL;
+  }
 
   // claimed it!
   void* p = mi_arena_block_start(arena, bitmap_index);
   *memid = mi_memid_create_arena(arena->id, arena->exclusive, bitmap_index);
   memid->is_pinned = arena->memid.is_pinned;
+  memid->mem.arena.is_shared = arena->is_shared;
+  if (arena->is_shared) { mi_atomic_increment_relaxed(&mi_shared_arena_segments[arena_index - MI_MAX_ARENAS]); }
 
   // none of the claimed blocks should be scheduled for a decommit
   if (arena->blocks_purge != NULL) {
@@ -287,14 +337,12 @@ static mi_decl_noinline void* mi_arena_try_alloc_at(mi_arena_t* arena, size_t ar
 }
 
 // allocate in a specific arena
-static void* mi_arena_try_alloc_at_id(mi_arena_id_t arena_id, bool match_numa_node, int numa_node, size_t size, size_t alignment,
+static void* mi_arena_try_alloc_at_id(mi_arena_id_t arena_id, bool match_numa_node, int numa_node, size_t size, size_t alignment, size_t align_offset,
                                        bool commit, bool allow_large, mi_arena_id_t req_arena_id, mi_memid_t* memid )
 {
-  MI_UNUSED_RELEASE(alignment);
-  mi_assert(alignment <= MI_SEGMENT_ALIGN);
   const size_t bcount = mi_block_count_of_size(size);
   const size_t arena_index = mi_arena_id_index(arena_id);
-  mi_assert_internal(arena_index < mi_atomic_load_relaxed(&mi_arena_count));
+  mi_assert_internal(mi_arena_index_is_valid(arena_index));
   mi_assert_internal(size <= mi_arena_block_size(bcount));
 
   // Check arena suitability
@@ -309,40 +357,38 @@ static void* mi_arena_try_alloc_at_id(mi_arena_id_t arena_id, bool match_numa_no
   }
 
   // try to allocate
-  void* p = mi_arena_try_alloc_at(arena, arena_index, bcount, commit, memid);
-  mi_assert_internal(p == NULL || _mi_is_aligned(p, alignment));
+  void* p = mi_arena_try_alloc_at(arena, arena_index, bcount, alignment, align_offset, commit, memid);
+  mi_assert_internal(p == NULL || _mi_is_aligned((uint8_t*)p + align_offset, alignment));
   return p;
 }
 
 
 // allocate from an arena with fallback to the OS
-static mi_decl_noinline void* mi_arena_try_alloc(int numa_node, size_t size, size_t alignment,
+static mi_decl_noinline void* mi_arena_try_alloc(int numa_node, size_t size, size_t alignment, size_t align_offset,
                                                   bool commit, bool allow_large,
                                                   mi_arena_id_t req_arena_id, mi_memid_t* memid )
 {
-  MI_UNUSED(alignment);
-  mi_assert_internal(alignment <= MI_SEGMENT_ALIGN);
   const size_t max_arena = mi_atomic_load_relaxed(&mi_arena_count);
-  if mi_likely(max_arena == 0) return NULL;
+  if mi_likely(max_arena == 0 && req_arena_id == _mi_arena_id_none()) return NULL;
 
   if (req_arena_id != _mi_arena_id_none()) {
     // try a specific arena if requested
-    if (mi_arena_id_index(req_arena_id) < max_arena) {
-      void* p = mi_arena_try_alloc_at_id(req_arena_id, true, numa_node, size, alignment, commit, allow_large, req_arena_id, memid);
+    if (mi_arena_index_is_valid(mi_arena_id_index(req_arena_id))) {
+      void* p = mi_arena_try_alloc_at_id(req_arena_id, true, numa_node, size, alignment, align_offset, commit, allow_large, req_arena_id, memid);
       if (p != NULL) return p;
     }
   }
   else {
     // try numa affine allocation
     for (size_t i = 0; i < max_arena; i++) {
-      void* p = mi_arena_try_alloc_at_id(mi_arena_id_create(i), true, numa_node, size, alignment, commit, allow_large, req_arena_id, memid);
+      void* p = mi_arena_try_alloc_at_id(mi_arena_id_create(i), true, numa_node, size, alignment, align_offset, commit, allow_large, req_arena_id, memid);
       if (p != NULL) return p;
     }
 
     // try from another numa node instead..
     if (numa_node >= 0) {  // if numa_node was < 0 (no specific affinity requested), all arena's have been tried already
       for (size_t i = 0; i < max_arena; i++) {
-        void* p = mi_arena_try_alloc_at_id(mi_arena_id_create(i), false /* only proceed if not numa local */, numa_node, size, alignment, commit, allow_large, req_arena_id, memid);
+        void* p = mi_arena_try_alloc_at_id(mi_arena_id_create(i), false /* only proceed if not numa local */, numa_node, size, alignment, align_offset, commit, allow_large, req_arena_id, memid);
         if (p != NULL) return p;
       }
     }
@@ -394,20 +440,25 @@ void* _mi_arena_alloc_aligned(size_t size, size_t alignment, size_t align_offset
 
   const int numa_node = _mi_os_numa_node(); // current numa node
 
-  // try to allocate in an arena if the alignment is small enough and the object is not too small (as for heap meta data)
+  // try to allocate in an arena if the alignment is a multiple of the arena block size (or small enough) and the object is not too small (as for heap meta data)
   if (!mi_option_is_enabled(mi_option_disallow_arena_alloc)) {  // is arena allocation allowed?
-    if (size >= MI_ARENA_MIN_OBJ_SIZE && alignment <= MI_SEGMENT_ALIGN && align_offset == 0) 
+    // large alignments (and offsets) are supported directly by searching aligned block indices in the arena
+    const bool arena_aligned = ((alignment <= MI_SEGMENT_ALIGN && align_offset == 0) ||
+                                (alignment % MI_ARENA_BLOCK_SIZE == 0 && align_offset % MI_ARENA_BLOCK_SIZE == 0));
+    // small objects are allowed as well if a specific arena is requested (as we cannot fall back to the OS)
+    if ((size >= MI_ARENA_MIN_OBJ_SIZE || req_arena_id != _mi_arena_id_none()) && arena_aligned)
     {
-      void* p = mi_arena_try_alloc(numa_node, size, alignment, commit, allow_large, req_arena_id, memid);
+      void* p = mi_arena_try_alloc(numa_node, size, alignment, align_offset, commit, allow_large, req_arena_id, memid);
       if (p != NULL) return p;
 
       // otherwise, try to first eagerly reserve a new arena
       if (req_arena_id == _mi_arena_id_none()) {
         mi_arena_id_t arena_id = 0;
-        if (mi_arena_reserve(size, allow_large, &arena_id)) {
+        const size_t req_size = (alignment > MI_SEGMENT_ALIGN ? size + alignment : size);  // ensure an aligned range can fit
+        if (mi_arena_reserve(req_size, allow_large, &arena_id)) {
           // and try allocate in there
           mi_assert_internal(req_arena_id == _mi_arena_id_none());
-          p = mi_arena_try_alloc_at_id(arena_id, true, numa_node, size, alignment, commit, allow_large, req_arena_id, memid);
+          p = mi_arena_try_alloc_at_id(arena_id, true, numa_node, size, alignment, align_offset, commit, allow_large, req_arena_id, memid);
           if (p != NULL) return p;
         }
       }
@@ -438,7 +489,7 @@ void* _mi_arena_alloc(size_t size, bool commit, bool allow_large, mi_arena_id_t
 void* mi_arena_area(mi_arena_id_t arena_id, size_t* size) {
   if (size != NULL) *size = 0;
   size_t arena_index = mi_arena_id_index(arena_id);
-  if (arena_index >= MI_MAX_ARENAS) return NULL;
+  if (arena_index >= MI_ARENA_SLOTS) return NULL;
   mi_arena_t* arena = mi_atomic_load_ptr_acquire(mi_arena_t, &mi_arenas[arena_index]);
   if (arena == NULL) return NULL;
   if (size != NULL) { *size = mi_arena_block_size(arena->block_count); }
@@ -452,7 +503,7 @@ void* mi_arena_area(mi_arena_id_t arena_id, size_t* size) {
 
 static long mi_arena_purge_delay(void) {
   // <0 = no purging allowed, 0=immediate purging, >0=milli-second delay
-  return (mi_option_get(mi_option_purge_delay) * mi_option_get(mi_option_arena_purge_mult));
+  return (_mi_os_purge_delay(mi_option_get(mi_option_purge_delay)) * mi_option_get(mi_option_arena_purge_mult));  // shortened under memory pressure
 }
 
 // reset or decommit in an arena and update the committed/decommit bitmaps
@@ -464,9 +515,10 @@ static void mi_arena_purge(mi_arena_t* arena, size_t bitmap_idx, size_t blocks)
   const size_t size = mi_arena_block_size(blocks);
   void* const p = mi_arena_block_start(arena, bitmap_idx);
   bool needs_recommit;
+  bool is_zero = false;
   if (_mi_bitmap_is_claimed_across(arena->blocks_committed, arena->field_count, blocks, bitmap_idx)) {
     // all blocks are committed, we can purge freely
-    needs_recommit = _mi_os_purge(p, size);
+    needs_recommit = _mi_os_purge_ex(p, size, true /* allow reset? */, size, &is_zero);
   }
   else {
     // some blocks are not committed -- this can happen when a partially committed block is freed
@@ -474,7 +526,7 @@ static void mi_arena_purge(mi_arena_t* arena, size_t bitmap_idx, size_t blocks)
     // we need to ensure we do not try to reset (as that may be invalid for uncommitted memory),
     // and also undo the decommit stats (as it was already adjusted)
     mi_assert_internal(mi_option_is_enabled(mi_option_purge_decommits));
-    needs_recommit = _mi_os_purge_ex(p, size, false /* allow reset? */, 0);    
+    needs_recommit = _mi_os_purge_ex(p, size, false /* allow reset? */, 0, &is_zero);
   }
 
   // clear the purged blocks
@@ -483,6 +535,16 @@ static void mi_arena_purge(mi_arena_t* arena, size_t bitmap_idx, size_t blocks)
   if (needs_recommit) {
     _mi_bitmap_unclaim_across(arena->blocks_committed, arena->field_count, blocks, bitmap_idx);
   }
+  // and mark the blocks as clean again if the purge zero'd them (so a next allocation knows they are zero)
+  if (is_zero && arena->memid.initially_zero && mi_memkind_is_os(arena->memid.memkind)) {
+    _mi_bitmap_unclaim_across(arena->blocks_dirty, arena->field_count, blocks, bitmap_idx);
+  }
+}
+
+// Set an expiration if it was not set yet, or move it earlier (as the delay is shortened under memory pressure)
+static void mi_arena_expire_at_most(_Atomic(mi_msecs_t)* pexpire, mi_msecs_t expire) {
+  mi_msecs_t current = mi_atomic_loadi64_relaxed(pexpire);
+  while ((current == 0 || current > expire) && !mi_atomic_casi64_strong_acq_rel(pexpire, &current, expire)) { };
 }
 
 // Schedule a purge. This is usually delayed to avoid repeated decommit/commit calls.
@@ -499,15 +561,8 @@ static void mi_arena_schedule_purge(mi_arena_t* arena, size_t bitmap_idx, size_t
   else {
     // schedule purge
     const mi_msecs_t expire = _mi_clock_now() + delay;
-    mi_msecs_t expire0 = 0;
-    if (mi_atomic_casi64_strong_acq_rel(&arena->purge_expire, &expire0, expire)) {
-      // expiration was not yet set
-      // maybe set the global arenas expire as well (if it wasn't set already)
-      mi_atomic_casi64_strong_acq_rel(&mi_arenas_purge_expire, &expire0, expire);
-    }
-    else {
-      // already an expiration was set
-    }
+    mi_arena_expire_at_most(&arena->purge_expire, expire);
+    mi_arena_expire_at_most(&mi_arenas_purge_expire, expire);
     _mi_bitmap_claim_across(arena->blocks_purge, arena->field_count, blocks, bitmap_idx, NULL);
   }
 }
@@ -599,12 +654,12 @@ static bool mi_arena_try_purge(mi_arena_t* arena, mi_msecs_t now, bool force)
 
 static void mi_arenas_try_purge( bool force, bool visit_all ) 
 {
-  if (_mi_preloading() || mi_arena_purge_delay() <= 0) return;  // nothing will be scheduled
+  if (_mi_preloading() || mi_option_get(mi_option_purge_delay) <= 0) return;  // nothing will be scheduled (note: not `mi_arena_purge_delay` as that can be 0 under memory pressure)
 
   // check if any arena needs purging?
   const mi_msecs_t now = _mi_clock_now();
   mi_msecs_t arenas_expire = mi_atomic_loadi64_acquire(&mi_arenas_purge_expire);
-  if (!force && (arenas_expire == 0 || arenas_expire < now)) return;
+  if (!force && (arenas_expire == 0 || arenas_expire > now)) return;
 
   const size_t max_arena = mi_atomic_load_acquire(&mi_arena_count);
   if (max_arena == 0) return;
@@ -614,9 +669,11 @@ static void mi_arenas_try_purge( bool force, bool visit_all )
   mi_atomic_guard(&purge_guard)
   {
     // increase global expire: at most one purge per delay cycle
-    mi_atomic_storei64_release(&mi_arenas_purge_expire, now + mi_arena_purge_delay());  
+    const mi_msecs_t next_expire = now + mi_arena_purge_delay();
+    mi_atomic_storei64_release(&mi_arenas_purge_expire, next_expire);
     size_t max_purge_count = (visit_all ? max_arena : 2);
     bool all_visited = true;
+    mi_msecs_t pending_expire = 0;  // the earliest purge still pending in a visited arena
     for (size_t i = 0; i < max_arena; i++) {
       mi_arena_t* arena = mi_atomic_load_ptr_acquire(mi_arena_t, &mi_arenas[i]);
       if (arena != NULL) {
@@ -627,16 +684,60 @@ static void mi_arenas_try_purge( bool force, bool visit_all )
           }
           max_purge_count--;
         }
+        const mi_msecs_t expire = mi_atomic_loadi64_relaxed(&arena->purge_expire);
+        if (expire != 0 && (pending_expire == 0 || expire < pending_expire)) { pending_expire = expire; }
       }
     }
     if (all_visited) {
-      // all arena's were visited and purged: reset global expire
-      mi_atomic_storei64_release(&mi_arenas_purge_expire, 0);
+      if (pending_expire == 0) {
+        // all arena's were visited and purged: reset global expire (unless a purge was scheduled concurrently)
+        mi_msecs_t expected = next_expire;
+        mi_atomic_casi64_strong_acq_rel(&mi_arenas_purge_expire, &expected, (mi_msecs_t)0);
+      }
+      else {
+        // some arenas have a purge that did not expire yet: visit again once the earliest one expires
+        mi_arena_expire_at_most(&mi_arenas_purge_expire, pending_expire);
+      }
     }
   }
 }
 
 
+/* -----------------------------------------------------------
+  Arena shrink
+----------------------------------------------------------- */
+
+// Shrink an allocation of `size` bytes in place to at least `*newsize` bytes by releasing the tail.
+// For arena memory this happens at the granularity of arena blocks, and `*newsize` is set to the actual new size.
+// Returns `false` if no memory could be released.
+bool _mi_arena_shrink(void* p, size_t size, size_t* newsize, bool still_committed, mi_memid_t* memid) {
+  mi_assert_internal(*newsize > 0 && *newsize <= size);
+  if (mi_memkind_is_os(memid->memkind)) {
+    const size_t osize = _mi_align_up(*newsize, _mi_os_page_size());
+    if (osize >= size || !_mi_os_shrink(p, size, osize, still_committed, memid)) return false;
+    *newsize = osize;
+    return true;
+  }
+  else if (memid->memkind == MI_MEM_ARENA) {
+    const size_t bcount = mi_block_count_of_size(size);
+    const size_t new_bcount = mi_block_count_of_size(*newsize);
+    if (new_bcount >= bcount) return false;
+    size_t arena_idx;
+    size_t bitmap_idx;
+    mi_arena_memid_indices(*memid, &arena_idx, &bitmap_idx);
+    // free the tail blocks as if they were a separate allocation
+    mi_memid_t tail_memid = mi_memid_create_arena(memid->mem.arena.id, memid->mem.arena.is_exclusive, bitmap_idx + new_bcount);
+    tail_memid.is_pinned = memid->is_pinned;
+    const size_t tail_size = mi_arena_block_size(bcount - new_bcount);
+    _mi_arena_free((uint8_t*)p + mi_arena_block_size(new_bcount), tail_size, (still_committed ? tail_size : 0), tail_memid);
+    *newsize = mi_arena_block_size(new_bcount);
+    return true;
+  }
+  else {
+    return false;
+  }
+}
+
 /* -----------------------------------------------------------
   Arena free
 ----------------------------------------------------------- */
@@ -654,17 +755,17 @@ void _mi_arena_free(void* p, size_t size, size_t committed_size, mi_memid_t memi
   if (mi_memkind_is_os(memid.memkind)) {
     // was a direct OS allocation, pass through
     if (!all_committed && committed_size > 0) {
-      // if partially committed, adjust the committed stats (as `_mi_os_free` will increase decommit by the full size)
+      // if partially committed, adjust the committed stats (as `_mi_os_free_ex` only decreases them if all is committed)
       _mi_stat_decrease(&_mi_stats_main.committed, committed_size);
     }
-    _mi_os_free(p, size, memid);
+    _mi_os_free_ex(p, size, all_committed, memid);
   }
   else if (memid.memkind == MI_MEM_ARENA) {
     // allocated in an arena
     size_t arena_idx;
     size_t bitmap_idx;
     mi_arena_memid_indices(memid, &arena_idx, &bitmap_idx);
-    mi_assert_internal(arena_idx < MI_MAX_ARENAS);
+    mi_assert_internal(arena_idx < MI_ARENA_SLOTS);
     mi_arena_t* arena = mi_atomic_load_ptr_acquire(mi_arena_t,&mi_arenas[arena_idx]);
     mi_assert_internal(arena != NULL);
     const size_t blocks = mi_block_count_of_size(size);
@@ -711,6 +812,7 @@ void _mi_arena_free(void* p, size_t size, size_t committed_size, mi_memid_t memi
       _mi_error_message(EAGAIN, "trying to free an already freed arena block: %p, size %zu\n", p, size);
       return;
     };
+    if (arena->is_shared) { mi_atomic_decrement_relaxed(&mi_shared_arena_segments[arena_idx - MI_MAX_ARENAS]); }
   }
   else {
     // arena was none, external, or static; nothing to do
@@ -758,14 +860,19 @@ void _mi_arena_unsafe_destroy_all(void) {
   _mi_arenas_collect(true /* force purge */);  // purge non-owned arenas
 }
 
+static bool mi_arena_contains(size_t arena_index, const void* p) {
+  mi_arena_t* arena = mi_atomic_load_ptr_relaxed(mi_arena_t, &mi_arenas[arena_index]);
+  return (arena != NULL && arena->start <= (const uint8_t*)p && arena->start + mi_arena_block_size(arena->block_count) > (const uint8_t*)p);
+}
+
 // Is a pointer inside any of our arenas?
 bool _mi_arena_contains(const void* p) {
   const size_t max_arena = mi_atomic_load_relaxed(&mi_arena_count);
   for (size_t i = 0; i < max_arena; i++) {
-    mi_arena_t* arena = mi_atomic_load_ptr_relaxed(mi_arena_t, &mi_arenas[i]);
-    if (arena != NULL && arena->start <= (const uint8_t*)p && arena->start + mi_arena_block_size(arena->block_count) > (const uint8_t*)p) {
-      return true;
-    }
+    if (mi_arena_contains(i, p)) return true;
+  }
+  for (size_t i = MI_MAX_ARENAS; i < MI_ARENA_SLOTS; i++) {
+    if (mi_arena_contains(i, p)) return true;
   }
   return false;
 }
@@ -774,55 +881,47 @@ bool _mi_arena_contains(const void* p) {
   Add an arena.
 ----------------------------------------------------------- */
 
+// Claim the arena slot `i` and raise the arena count to include it (unless it is a shared arena slot)
+static bool mi_arena_try_add_at(mi_arena_t* arena, size_t i, mi_stats_t* stats) {
+  mi_assert_internal(i < MI_ARENA_SLOTS && arena->id == mi_arena_id_create(i));
+  mi_arena_t* expected = NULL;
+  if (!mi_atomic_cas_ptr_strong_release(mi_arena_t, &mi_arenas[i], &expected, arena)) return false;
+  if (i < MI_MAX_ARENAS) {
+    size_t count = mi_atomic_load_relaxed(&mi_arena_count);
+    while (count <= i && !mi_atomic_cas_weak_acq_rel(&mi_arena_count, &count, i + 1)) { /* nothing */ };
+  }
+  _mi_stat_counter_increase(&stats->arena_count,1);
+  return true;
+}
+
 static bool mi_arena_add(mi_arena_t* arena, mi_arena_id_t* arena_id, mi_stats_t* stats) {
   mi_assert_internal(arena != NULL);
   mi_assert_internal((uintptr_t)mi_atomic_load_ptr_relaxed(uint8_t,&arena->start) % MI_SEGMENT_ALIGN == 0);
   mi_assert_internal(arena->block_count > 0);
   if (arena_id != NULL) { *arena_id = -1; }
 
-  size_t i = mi_atomic_increment_acq_rel(&mi_arena_count);
-  if (i >= MI_MAX_ARENAS) {
-    mi_atomic_decrement_acq_rel(&mi_arena_count);
-    return false;
+  // use the first free slot (shared arena's use separate slots, see `mi_shared_arena_create`)
+  for (size_t i = 0; i < MI_MAX_ARENAS; i++) {
+    arena->id = mi_arena_id_create(i);
+    if (mi_arena_try_add_at(arena, i, stats)) {
+      if (arena_id != NULL) { *arena_id = arena->id; }
+      return true;
+    }
   }
-  _mi_stat_counter_increase(&stats->arena_count,1);
-  arena->id = mi_arena_id_create(i);
-  mi_atomic_store_ptr_release(mi_arena_t,&mi_arenas[i], arena);
-  if (arena_id != NULL) { *arena_id = arena->id; }
-  return true;
+  return false;
 }
 
-static bool mi_manage_os_memory_ex2(void* start, size_t size, bool is_large, int numa_node, bool exclusive, mi_memid_t memid, mi_arena_id_t* arena_id) mi_attr_noexcept
-{
-  if (arena_id != NULL) *arena_id = _mi_arena_id_none();
-  if (size < MI_ARENA_BLOCK_SIZE) {
-    _mi_warning_message("the arena size is too small (memory at %p with size %zu)\n", start, size);
-    return false;
-  }
-  if (is_large) {
-    mi_assert_internal(memid.initially_committed && memid.is_pinned);
-  }
-  if (!_mi_is_aligned(start, MI_SEGMENT_ALIGN)) {
-    void* const aligned_start = mi_align_up_ptr(start, MI_SEGMENT_ALIGN);
-    const size_t diff = (uint8_t*)aligned_start - (uint8_t*)start;
-    if (diff >= size || (size - diff) < MI_ARENA_BLOCK_SIZE) {
-      _mi_warning_message("after alignment, the size of the arena becomes too small (memory at %p with size %zu)\n", start, size);
-      return false;
-    }
-    start = aligned_start;
-    size = size - diff;
-  }
+// Size of the arena structure for `fields` bitmap fields
+static size_t mi_arena_meta_size(size_t fields, bool is_pinned) {
+  const size_t bitmaps = (is_pinned ? 3 : 5);
+  return (sizeof(mi_arena_t) + (bitmaps*fields*sizeof(mi_bitmap_field_t)));
+}
 
-  const size_t bcount = size / MI_ARENA_BLOCK_SIZE;
+// Initialize a zero'd arena structure for `bcount` blocks starting at `start`
+static void mi_arena_init(mi_arena_t* arena, size_t asize, mi_memid_t meta_memid, void* start, size_t bcount,
+                          bool is_large, int numa_node, bool exclusive, mi_memid_t memid)
+{
   const size_t fields = _mi_divide_up(bcount, MI_BITMAP_FIELD_BITS);
-  const size_t bitmaps = (memid.is_pinned ? 3 : 5);
-  const size_t asize  = sizeof(mi_arena_t) + (bitmaps*fields*sizeof(mi_bitmap_field_t));
-  mi_memid_t meta_memid;
-  mi_arena_t* arena   = (mi_arena_t*)_mi_arena_meta_zalloc(asize, &meta_memid);
-  if (arena == NULL) return false;
-
-  // already zero'd due to zalloc
-  // _mi_memzero(arena, asize);
   arena->id = _mi_arena_id_none();
   arena->memid = memid;
   arena->exclusive = exclusive;
@@ -854,6 +953,39 @@ static bool mi_manage_os_memory_ex2(void* start, size_t size, bool is_large, int
     mi_bitmap_index_t postidx = mi_bitmap_index_create(fields - 1, MI_BITMAP_FIELD_BITS - post);
     _mi_bitmap_claim(arena->blocks_inuse, fields, post, postidx, NULL);
   }
+}
+
+static bool mi_manage_os_memory_ex2(void* start, size_t size, bool is_large, int numa_node, bool exclusive, mi_memid_t memid, mi_arena_id_t* arena_id) mi_attr_noexcept
+{
+  if (arena_id != NULL) *arena_id = _mi_arena_id_none();
+  if (size < MI_ARENA_BLOCK_SIZE) {
+    _mi_warning_message("the arena size is too small (memory at %p with size %zu)\n", start, size);
+    return false;
+  }
+  if (is_large) {
+    mi_assert_internal(memid.initially_committed && memid.is_pinned);
+  }
+  if (!_mi_is_aligned(start, MI_SEGMENT_ALIGN)) {
+    void* const aligned_start = mi_align_up_ptr(start, MI_SEGMENT_ALIGN);
+    const size_t diff = (uint8_t*)aligned_start - (uint8_t*)start;
+    if (diff >= size || (size - diff) < MI_ARENA_BLOCK_SIZE) {
+      _mi_warning_message("after alignment, the size of the arena becomes too small (memory at %p with size %zu)\n", start, size);
+      return false;
+    }
+    start = aligned_start;
+    size = size - diff;
+  }
+
+  const size_t bcount = size / MI_ARENA_BLOCK_SIZE;
+  const size_t fields = _mi_divide_up(bcount, MI_BITMAP_FIELD_BITS);
+  const size_t asize  = mi_arena_meta_size(fields, memid.is_pinned);
+  mi_memid_t meta_memid;
+  mi_arena_t* arena   = (mi_arena_t*)_mi_arena_meta_zalloc(asize, &meta_memid);
+  if (arena == NULL) return false;
+
+  // already zero'd due to zalloc
+  // _mi_memzero(arena, asize);
+  mi_arena_init(arena, asize, meta_memid, start, bcount, is_large, numa_node, exclusive, memid);
   return mi_arena_add(arena, arena_id, &_mi_stats_main);
 
 }
@@ -866,6 +998,145 @@ bool mi_manage_os_memory_ex(void* start, size_t size, bool is_committed, bool is
   return mi_manage_os_memory_ex2(start,size,is_large,numa_node,exclusive,memid, arena_id);
 }
 
+
+/* -----------------------------------------------------------
+  Shared arena's
+  A shared memory area (like a `memfd` or POSIX shared memory object mapped
+  with `MAP_SHARED`) that is mapped at the same address in several processes
+  can be managed as a shared arena. The first process to call
+  `mi_manage_shared_memory` initializes the arena structure in-place in the
+  first arena block; others attach to it. Since the structure (and the segment
+  and page meta data) is in the shared memory itself, all processes see the
+  same bitmaps and blocks can be freed from any process into the owning thread.
+  Each process must register the arena at the same index (so the arena id
+  stored in the segment memid is valid everywhere); shared arena's have their
+  own few slots after the regular ones (so they do not count toward the
+  arena count) and the creator takes the first free one. Other processes
+  attach at that same slot which is free as long as all processes manage
+  their shared memory areas in the same order.
+  The memory is pinned (never purged) and exclusive: only heaps created with
+  `mi_heap_new_in_arena` allocate in it.
+----------------------------------------------------------- */
+
+#define MI_SHARED_UNINIT   (0)   // fresh (zero'd) shared memory
+#define MI_SHARED_BUSY     (1)   // the arena is being initialized by the first process
+#define MI_SHARED_READY    (2)
+
+#define MI_SHARED_INIT_TIMEOUT  (2000)  // max milli-seconds to wait for another process to initialize a shared arena
+
+typedef struct mi_shared_header_s {
+  _Atomic(size_t) state;        // MI_SHARED_UNINIT, MI_SHARED_BUSY, or MI_SHARED_READY
+  size_t          size;         // size of the arena area
+  size_t          arena_index;  // index of the arena in every process
+} mi_shared_header_t;
+
+#define MI_SHARED_HEADER_SIZE  (_mi_align_up(sizeof(mi_shared_header_t), MI_CACHE_LINE))
+
+static bool mi_shared_arena_create(mi_shared_header_t* header, uint8_t* start, size_t size, mi_arena_id_t* arena_id) {
+  const size_t bcount = size / MI_ARENA_BLOCK_SIZE;
+  const size_t fields = _mi_divide_up(bcount, MI_BITMAP_FIELD_BITS);
+  const size_t asize  = mi_arena_meta_size(fields, true /* pinned */);
+  if (MI_SHARED_HEADER_SIZE + asize > MI_ARENA_BLOCK_SIZE) {
+    _mi_warning_message("the shared arena is too large (memory at %p with size %zu)\n", start, size);
+    return false;
+  }
+  mi_arena_t* const arena = (mi_arena_t*)(start + MI_SHARED_HEADER_SIZE);
+  _mi_memzero_aligned(arena, asize);
+  mi_memid_t memid = _mi_memid_create(MI_MEM_EXTERNAL);
+  memid.initially_committed = true;
+  memid.initially_zero = true;
+  memid.is_pinned = true;   // never decommit or reset as other processes share the memory
+  mi_arena_init(arena, asize, _mi_memid_create(MI_MEM_EXTERNAL), start, bcount, false /* is_large */, -1 /* numa node */, true /* exclusive */, memid);
+  arena->is_shared = true;
+  _mi_bitmap_claim(arena->blocks_inuse, fields, 1, mi_bitmap_index_create(0, 0), NULL);  // the first block holds the meta data
+  // take the first free shared arena slot
+  for (size_t i = MI_MAX_ARENAS; i < MI_ARENA_SLOTS; i++) {
+    arena->id = mi_arena_id_create(i);
+    if (mi_arena_try_add_at(arena, i, &_mi_stats_main)) {
+      header->size = size;
+      header->arena_index = i;
+      if (arena_id != NULL) { *arena_id = arena->id; }
+      return true;
+    }
+  }
+  _mi_warning_message("cannot manage more than %d shared memory areas (memory at %p)\n", MI_MAX_SHARED_ARENAS, start);
+  return false;
+}
+
+static bool mi_shared_arena_attach(mi_shared_header_t* header, uint8_t* start, size_t size, mi_arena_id_t* arena_id) {
+  if (header->size != size) {
+    _mi_warning_message("the shared arena at %p was created with a different size (%zu instead of %zu)\n", start, header->size, size);
+    return false;
+  }
+  if (header->arena_index < MI_MAX_ARENAS || header->arena_index >= MI_ARENA_SLOTS) {
+    _mi_warning_message("the shared arena at %p has an invalid arena index (%zu)\n", start, header->arena_index);
+    return false;
+  }
+  mi_arena_t* const arena = (mi_arena_t*)(start + MI_SHARED_HEADER_SIZE);
+  const size_t i = header->arena_index;
+  if (mi_atomic_load_ptr_acquire(mi_arena_t, &mi_arenas[i]) != arena) {  // not yet attached? (e.g. not inherited through a `fork`)
+    if (!mi_arena_try_add_at(arena, i, &_mi_stats_main)) {
+      _mi_warning_message("cannot attach the shared arena at %p as its arena index %zu is already in use\n", start, i);
+      return false;
+    }
+  }
+  if (arena_id != NULL) { *arena_id = arena->id; }
+  return true;
+}
+
+bool mi_manage_shared_memory(void* start, size_t size, mi_arena_id_t* arena_id) mi_attr_noexcept {
+  if (arena_id != NULL) *arena_id = _mi_arena_id_none();
+  if (start == NULL || !_mi_is_aligned(start, MI_SEGMENT_ALIGN)) {
+    _mi_warning_message("shared memory must be aligned to %zu KiB (memory at %p)\n", MI_SEGMENT_ALIGN / MI_KiB, start);
+    return false;
+  }
+  size = size - (size % MI_ARENA_BLOCK_SIZE);
+  if (size < 2*MI_ARENA_BLOCK_SIZE) {
+    _mi_warning_message("the shared memory size is too small (memory at %p with size %zu)\n", start, size);
+    return false;
+  }
+  _mi_fork_handlers_install(true);  // in the child of a fork the shared heaps start out empty
+  mi_shared_header_t* const header = (mi_shared_header_t*)start;
+  const mi_msecs_t expire = _mi_clock_now() + MI_SHARED_INIT_TIMEOUT;
+  size_t state;
+  while ((state = mi_atomic_load_acquire(&header->state)) != MI_SHARED_READY) {
+    if (state == MI_SHARED_UNINIT && mi_atomic_cas_strong_acq_rel(&header->state, &state, MI_SHARED_BUSY)) {
+      // we are the first: initialize the arena in-place
+      const bool ok = mi_shared_arena_create(header, (uint8_t*)start, size, arena_id);
+      mi_atomic_store_release(&header->state, (ok ? MI_SHARED_READY : MI_SHARED_UNINIT));
+      return ok;
+    }
+    // wait until another process has initialized the arena (but not forever as it may have crashed while doing so)
+    if (_mi_clock_now() > expire) {
+      _mi_warning_message("timed out waiting for the shared arena at %p to be initialized (the initializing process may have terminated)\n", start);
+      return false;
+    }
+    mi_atomic_yield();
+  }
+  return mi_shared_arena_attach(header, (uint8_t*)start, size, arena_id);
+}
+
+bool mi_unmanage_shared_memory(mi_arena_id_t arena_id) mi_attr_noexcept {
+  const size_t i = mi_arena_id_index(arena_id);
+  if (i < MI_MAX_ARENAS || i >= MI_ARENA_SLOTS) return false;
+  mi_arena_t* const arena = mi_atomic_load_ptr_acquire(mi_arena_t, &mi_arenas[i]);
+  if (arena == NULL) return false;
+  if (mi_atomic_load_acquire(&mi_shared_arena_segments[i - MI_MAX_ARENAS]) != 0) {
+    _mi_warning_message("cannot detach the shared arena at %p as this process still has memory allocated in it\n", mi_atomic_load_ptr_relaxed(uint8_t, &arena->start));
+    return false;
+  }
+  // detach; the shared memory (including the arena structure) stays valid for the other processes
+  mi_atomic_store_ptr_release(mi_arena_t, &mi_arenas[i], NULL);
+  return true;
+}
+
+// Called in the child process after a `fork()`: the segments of the parent in shared arena's are not ours
+void _mi_arenas_fork_child(void) {
+  for (size_t i = 0; i < MI_MAX_SHARED_ARENAS; i++) {
+    mi_atomic_store_relaxed(&mi_shared_arena_segments[i], (size_t)0);
+  }
+}
+
 // Reserve a range of regular OS memory
 int mi_reserve_os_memory_ex(size_t size, bool commit, bool allow_large, bool exclusive, mi_arena_id_t* arena_id) mi_attr_noexcept {
   if (arena_id != NULL) *arena_id = _mi_arena_id_none();
@@ -884,6 +1155,56 @@ int mi_reserve_os_memory_ex(size_t size, bool commit, bool allow_large, bool exc
 }
 
 
+// Reserve an exclusive arena for I/O buffers. The memory is pinned (never decommitted or reset)
+// and optionally locked and pre-faulted so its addresses stay valid and resident.
+int mi_io_arena_new(size_t size, int flags, mi_arena_id_t* arena_id) mi_attr_noexcept {
+  if (arena_id != NULL) *arena_id = _mi_arena_id_none();
+  if (size == 0 || size > PTRDIFF_MAX) return EINVAL;
+  size = _mi_align_up(size, MI_ARENA_BLOCK_SIZE);
+  mi_memid_t memid;
+  void* start = _mi_os_alloc_aligned(size, MI_SEGMENT_ALIGN, true /* commit */, false /* allow large */, &memid);
+  if (start == NULL) return ENOMEM;
+  if ((flags & MI_IO_ARENA_LOCK) != 0 && !_mi_os_lock(start, size)) {
+    _mi_os_free(start, size, memid);
+    return ENOMEM;
+  }
+  if ((flags & MI_IO_ARENA_PREFAULT) != 0) {
+    // touch every OS page (writing a zero keeps fresh memory zero initialized)
+    const size_t psize = _mi_os_page_size();
+    for (size_t i = 0; i < size; i += psize) {
+      ((volatile uint8_t*)start)[i] = 0;
+    }
+  }
+  memid.is_pinned = true;
+  if (!mi_manage_os_memory_ex2(start, size, false /* is_large */, -1 /* numa node */, true /* exclusive */, memid, arena_id)) {
+    _mi_os_free(start, size, memid);
+    _mi_verbose_message("failed to reserve %zu KiB I/O memory\n", _mi_divide_up(size, 1024));
+    return ENOMEM;
+  }
+  _mi_verbose_message("reserved %zu KiB I/O memory%s\n", _mi_divide_up(size, 1024), ((flags & MI_IO_ARENA_LOCK) != 0 ? " (locked)" : ""));
+  return 0;
+}
+
+// Return the number of contiguous ranges of an arena where each range is at most `max_range_size` bytes
+// (or unbounded if 0), and store up to `ranges_count` of them in `ranges`.
+size_t mi_arena_ranges(mi_arena_id_t arena_id, size_t max_range_size, mi_arena_range_t* ranges, size_t ranges_count) mi_attr_noexcept {
+  size_t size;
+  uint8_t* start = (uint8_t*)mi_arena_area(arena_id, &size);
+  if (start == NULL || size == 0) return 0;
+  size_t range_size = size;
+  if (max_range_size != 0 && max_range_size < size) {
+    const size_t psize = _mi_os_page_size();
+    range_size = (max_range_size < psize ? psize : max_range_size - (max_range_size % psize));
+  }
+  const size_t count = _mi_divide_up(size, range_size);
+  for (size_t i = 0; i < count && i < ranges_count; i++) {
+    const size_t ofs = i * range_size;
+    ranges[i].start = start + ofs;
+    ranges[i].size  = (size - ofs < range_size ? size - ofs : range_size);
+  }
+  return count;
+}
+
 // Manage a range of regular OS memory
 bool mi_manage_os_memory(void* start, size_t size, bool is_committed, bool is_large, bool is_zero, int numa_node) mi_attr_noexcept {
   return mi_manage_os_memory_ex(start, size, is_committed, is_large, is_zero, numa_node, false /* exclusive? */, NULL);
@@ -1018,3 +1339,95 @@ int mi_reserve_huge_os_pages(size_t pages, double max_secs, size_t* pages_reserv
   if (err==0 && pages_reserved!=NULL) *pages_reserved = pages;
   return err;
 }
+
+
+/* -----------------------------------------------------------
+  Reserve huge pages in a background thread at startup
+  (with `mi_option_reserve_huge_os_pages_async`).
+  Each arena is added as soon as its huge pages are reserved,
+  and until then allocations use regular OS memory.
+----------------------------------------------------------- */
+
+#define MI_RESERVE_ASYNC_NONE     (0)   // no background reservation was started
+#define MI_RESERVE_ASYNC_RUNNING  (1)
+#define MI_RESERVE_ASYNC_DONE     (2)
+
+typedef struct mi_reserve_async_s {
+  size_t pages;
+  int    numa_node;
+  size_t timeout_msecs;
+} mi_reserve_async_t;
+
+static mi_reserve_async_t                  mi_reserve_async;
+static _Atomic(size_t)                     mi_reserve_async_state; // = MI_RESERVE_ASYNC_NONE
+static _Atomic(size_t)                     mi_reserve_async_err;   // error code (>= 0) of the reservation
+static _Atomic(uintptr_t)                  mi_reserve_done_lock;   // guards the completion function and its argument as a pair
+static mi_reserve_done_fun*                mi_reserve_done;
+static void*                               mi_reserve_done_arg;
+
+static void mi_reserve_done_acquire(void) {
+  uintptr_t expected = 0;
+  while (!mi_atomic_cas_weak_acq_rel(&mi_reserve_done_lock, &expected, (uintptr_t)1)) {
+    expected = 0;
+    mi_atomic_yield();
+  }
+}
+
+static void mi_reserve_done_release(void) {
+  mi_atomic_store_release(&mi_reserve_done_lock, (uintptr_t)0);
+}
+
+// Call the registered completion function (at most once)
+static void mi_reserve_done_notify(void) {
+  mi_reserve_done_acquire();
+  mi_reserve_done_fun* const fun = mi_reserve_done;
+  void* const arg = mi_reserve_done_arg;
+  mi_reserve_done = NULL;
+  mi_reserve_done_arg = NULL;
+  mi_reserve_done_release();
+  if (fun != NULL) {
+    fun((int)mi_atomic_load_acquire(&mi_reserve_async_err), arg);
+  }
+}
+
+static void mi_reserve_huge_os_pages_async_run(void* arg) {
+  const mi_reserve_async_t* const reserve = (const mi_reserve_async_t*)arg;
+  const int err = (reserve->numa_node != -1 ? mi_reserve_huge_os_pages_at(reserve->pages, reserve->numa_node, reserve->timeout_msecs)
+                                            : mi_reserve_huge_os_pages_interleave(reserve->pages, 0, reserve->timeout_msecs));
+  _mi_verbose_message("background reservation of %zu GiB huge pages is done (error: %d)\n", reserve->pages, err);
+  mi_atomic_store_release(&mi_reserve_async_err, (size_t)err);
+  mi_atomic_store_release(&mi_reserve_async_state, (size_t)MI_RESERVE_ASYNC_DONE);
+  mi_reserve_done_notify();
+}
+
+// Start reserving huge pages in a background thread; returns `false` if no thread could be started.
+bool _mi_arena_reserve_huge_os_pages_async(size_t pages, int numa_node, size_t timeout_msecs) {
+  size_t expected = MI_RESERVE_ASYNC_NONE;
+  if (!mi_atomic_cas_strong_acq_rel(&mi_reserve_async_state, &expected, (size_t)MI_RESERVE_ASYNC_RUNNING)) return false;
+  mi_reserve_async.pages = pages;
+  mi_reserve_async.numa_node = numa_node;
+  mi_reserve_async.timeout_msecs = timeout_msecs;
+  if (!_mi_prim_thread_start(&mi_reserve_huge_os_pages_async_run, &mi_reserve_async)) {
+    mi_atomic_store_release(&mi_reserve_async_state, (size_t)MI_RESERVE_ASYNC_NONE);
+    return false;
+  }
+  return true;
+}
+
+// Register a function that is called once the background reservation is done (or right away if there is none pending)
+void mi_register_reserve_huge_os_pages_done(mi_reserve_done_fun* fun, void* arg) mi_attr_noexcept {
+  mi_reserve_done_acquire();
+  mi_reserve_done = fun;
+  mi_reserve_done_arg = arg;
+  mi_reserve_done_release();
+  if (mi_atomic_load_acquire(&mi_reserve_async_state) != MI_RESERVE_ASYNC_RUNNING) {
+    mi_reserve_done_notify();
+  }
+}
+
+// Is the background reservation done? (also `true` if none was started)
+bool mi_reserve_huge_os_pages_is_done(int* err) mi_attr_noexcept {
+  const bool done = (mi_atomic_load_acquire(&mi_reserve_async_state) != MI_RESERVE_ASYNC_RUNNING);
+  if (err != NULL) { *err = (done ? (int)mi_atomic_load_acquire(&mi_reserve_async_err) : 0); }
+  return done;
+}
@@ -416,3 +416,60 @@ bool _mi_bitmap_is_any_claimed_across(mi_bitmap_t bitmap, size_t bitmap_fields,
   mi_bitmap_is_claimedx_across(bitmap, bitmap_fields, count, bitmap_idx, &any_ones);
   return any_ones;
 }
+
+
+// Try to set the `mask` bits in a field from 0 to 1 atomically; returns `true` if all were 0.
+static bool mi_bitmap_try_claim_mask(mi_bitmap_field_t* field, size_t mask) {
+  size_t map = mi_atomic_load_relaxed(field);
+  do {
+    if ((map & mask) != 0) return false;
+  } while (!mi_atomic_cas_strong_acq_rel(field, &map, map | mask));
+  return true;
+}
+
+// Try to set `count` bits at `bitmap_idx` from 0 to 1 atomically (where the sequence may cross fields).
+// Returns `true` if successful when all previous `count` bits were 0; otherwise the bitmap is unchanged.
+bool _mi_bitmap_try_claim_across(mi_bitmap_t bitmap, size_t bitmap_fields, size_t count, mi_bitmap_index_t bitmap_idx) {
+  size_t idx = mi_bitmap_index_field(bitmap_idx);
+  size_t pre_mask;
+  size_t mid_mask;
+  size_t post_mask;
+  size_t mid_count = mi_bitmap_mask_across(bitmap_idx, bitmap_fields, count, &pre_mask, &mid_mask, &post_mask);
+  mi_bitmap_field_t* const initial_field = &bitmap[idx];
+  mi_bitmap_field_t* field = initial_field;
+  if (!mi_bitmap_try_claim_mask(field, pre_mask)) return false;
+  while (mid_count-- > 0) {
+    if (!mi_bitmap_try_claim_mask(++field, mid_mask)) goto rollback;
+  }
+  if (post_mask != 0) {
+    if (!mi_bitmap_try_claim_mask(++field, post_mask)) goto rollback;
+  }
+  return true;
+
+rollback:
+  // we failed to claim `field`; release the fields claimed before it
+  while (--field > initial_field) {
+    mi_atomic_and_acq_rel(field, ~mid_mask);
+  }
+  mi_atomic_and_acq_rel(initial_field, ~pre_mask);
+  mi_stat_counter_increase(_mi_stats_main.arena_rollback_count,1);
+  return false;
+}
+
+// Find `count` bits of zeros at a bit index `i` where `i % bit_align == bit_start` and set them to 1 atomically.
+// Returns `true` on success. This is used in arena allocation for large alignments (where `bit_align` is a power of two).
+bool _mi_bitmap_try_find_claim_aligned_across(mi_bitmap_t bitmap, const size_t bitmap_fields, const size_t count, const size_t bit_align, const size_t bit_start, mi_bitmap_index_t* bitmap_idx) {
+  mi_assert_internal(count > 0);
+  mi_assert_internal(bit_align > 0 && _mi_is_power_of_two(bit_align) && bit_start < bit_align);
+  const size_t bit_count = bitmap_fields * MI_BITMAP_FIELD_BITS;
+  for (size_t i = bit_start; i < bit_count && count <= bit_count - i; i += bit_align) {
+    // check first without atomic updates to avoid contention
+    if (!_mi_bitmap_is_any_claimed_across(bitmap, bitmap_fields, count, i) &&
+        _mi_bitmap_try_claim_across(bitmap, bitmap_fields, count, i))
+    {
+      *bitmap_idx = i;
+      return true;
+    }
+  }
+  return false;
+}
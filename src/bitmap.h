@@ -107,4 +107,12 @@ bool _mi_bitmap_claim_across(mi_bitmap_t bitmap, size_t bitmap_fields, size_t co
 bool _mi_bitmap_is_claimed_across(mi_bitmap_t bitmap, size_t bitmap_fields, size_t count, mi_bitmap_index_t bitmap_idx);
 bool _mi_bitmap_is_any_claimed_across(mi_bitmap_t bitmap, size_t bitmap_fields, size_t count, mi_bitmap_index_t bitmap_idx);
 
+// Try to set `count` bits at `bitmap_idx` from 0 to 1 atomically.
+// Returns `true` if successful when all previous `count` bits were 0.
+bool _mi_bitmap_try_claim_across(mi_bitmap_t bitmap, size_t bitmap_fields, size_t count, mi_bitmap_index_t bitmap_idx);
+
+// Find `count` bits of zeros starting at a bit index `i` with `i % bit_align == bit_start` and set them to 1 atomically.
+// Returns `true` on success.
+bool _mi_bitmap_try_find_claim_aligned_across(mi_bitmap_t bitmap, const size_t bitmap_fields, const size_t count, const size_t bit_align, const size_t bit_start, mi_bitmap_index_t* bitmap_idx);
+
 #endif
@@ -34,7 +34,7 @@ static inline void mi_free_block_local(mi_page_t* page, mi_block_t* block, bool
   if mi_unlikely(mi_check_is_double_free(page, block)) return;
   mi_check_padding(page, block);
   if (track_stats) { mi_stat_free(page, block); }
-  #if (MI_DEBUG>0) && !MI_TRACK_ENABLED  && !MI_TSAN && !MI_GUARDED
+  #if (MI_DEBUG>0) && !MI_TRACK_ENABLED  && !MI_TSAN && !MI_GUARDED_SAMPLING
   memset(block, MI_DEBUG_FREED, mi_page_block_size(page));
   #endif
   if (track_stats) { mi_track_free_size(block, mi_page_usable_size_of(page, block)); } // faster then mi_usable_size as we already know the page and that p is unaligned
@@ -69,8 +69,8 @@ mi_block_t* _mi_page_ptr_unalign(const mi_page_t* page, const void* p) {
   return (mi_block_t*)((uintptr_t)p - adjust);
 }
 
-// forward declaration for a MI_GUARDED build
-#if MI_GUARDED
+// forward declaration for guarded sampling
+#if MI_GUARDED_SAMPLING
 static void mi_block_unguard(mi_page_t* page, mi_block_t* block, void* p); // forward declaration
 static inline void mi_block_check_unguard(mi_page_t* page, mi_block_t* block, void* p) {
   if (mi_block_ptr_is_guarded(block, p)) { mi_block_unguard(page, block, p); }
@@ -91,6 +91,12 @@ static void mi_decl_noinline mi_free_generic_local(mi_page_t* page, mi_segment_t
 
 // free a pointer owned by another thread (page parameter comes first for better codegen)
 static void mi_decl_noinline mi_free_generic_mt(mi_page_t* page, mi_segment_t* segment, void* p) mi_attr_noexcept {
+  if mi_unlikely(mi_segment_is_shared(segment) &&
+                 mi_atomic_load_relaxed(&segment->thread_id) == _mi_segment_owner_id(segment, _mi_prim_thread_id())) {
+    // a local free in shared memory (where the owner id is salted, see `segment.c`)
+    mi_free_generic_local(page, segment, p);
+    return;
+  }
   mi_block_t* const block = _mi_page_ptr_unalign(page, p); // don't check `has_aligned` flag to avoid a race (issue #865)
   mi_block_check_unguard(page, block, p);
   mi_free_block_mt(page, segment, block);
@@ -123,13 +129,13 @@ static inline mi_segment_t* mi_checked_ptr_segment(const void* p, const char* ms
   if mi_unlikely(!mi_is_in_heap_region(p)) {
     _mi_warning_message("%s: pointer might not point to a valid heap region: %p\n"
       "(this may still be a valid very large allocation (over 64MiB))\n", msg, p);
-    if mi_likely(_mi_ptr_cookie(segment) == segment->cookie) {
+    if mi_likely(_mi_segment_cookie_is_valid(segment)) {
       _mi_warning_message("(yes, the previous pointer %p was valid after all)\n", p);
     }
   }
   #endif
   #if (MI_DEBUG>0 || MI_SECURE>=4)
-  if mi_unlikely(_mi_ptr_cookie(segment) != segment->cookie) {
+  if mi_unlikely(!_mi_segment_cookie_is_valid(segment)) {
     _mi_error_message(EINVAL, "%s: pointer does not point to a valid heap space: %p\n", msg, p);
     return NULL;
   }
@@ -244,6 +250,9 @@ static void mi_decl_noinline mi_free_block_delayed_mt( mi_page_t* page, mi_block
 // Multi-threaded free (`_mt`) (or free in huge block if compiled with MI_HUGE_PAGE_ABANDON)
 static void mi_decl_noinline mi_free_block_mt(mi_page_t* page, mi_segment_t* segment, mi_block_t* block)
 {
+  // in the child of a fork, leave the memory of threads that did not survive the fork alone (see `segment.c`)
+  if mi_unlikely(_mi_segment_is_fork_orphan(segment)) return;
+
   // first see if the segment was abandoned and if we can reclaim it into our thread
   if (_mi_option_get_fast(mi_option_abandoned_reclaim_on_free) != 0 &&
       #if MI_HUGE_PAGE_ABANDON
@@ -252,13 +261,9 @@ static void mi_decl_noinline mi_free_block_mt(mi_page_t* page, mi_segment_t* seg
       mi_atomic_load_relaxed(&segment->thread_id) == 0 &&  // segment is abandoned?
       mi_prim_get_default_heap() != (mi_heap_t*)&_mi_heap_empty) // and we did not already exit this thread (without this check, a fresh heap will be initalized (issue #944))
   {
-    // the segment is abandoned, try to reclaim it into our heap
-    if (_mi_segment_attempt_reclaim(mi_heap_get_default(), segment)) {
-      mi_assert_internal(_mi_thread_id() == mi_atomic_load_relaxed(&segment->thread_id));
-      mi_assert_internal(mi_heap_get_default()->tld->segments.subproc == segment->subproc);
-      mi_free(block);  // recursively free as now it will be a local free in our heap
-      return;
-    }
+    // the segment is abandoned, reclaim it into our heap at the next generic allocation
+    // (reclaiming it here would collect all its pages inside this `free`)
+    _mi_segment_reclaim_hint(mi_heap_get_default(), segment);
   }
 
   // The padding check may access the non-thread-owned page for the key values.
@@ -307,7 +312,7 @@ static size_t mi_decl_noinline mi_page_usable_aligned_size_of(const mi_page_t* p
   const ptrdiff_t adjust = (uint8_t*)p - (uint8_t*)block;
   mi_assert_internal(adjust >= 0 && (size_t)adjust <= size);
   const size_t aligned_size = (size - adjust);
-  #if MI_GUARDED
+  #if MI_GUARDED_SAMPLING
   if (mi_block_ptr_is_guarded(block, p)) {
     return aligned_size - _mi_os_page_size();
   }
@@ -541,8 +546,8 @@ static void mi_stat_free(const mi_page_t* page, const mi_block_t* block) {
 #endif
 
 
-// Remove guard page when building with MI_GUARDED
-#if MI_GUARDED
+// Remove guard page of a guarded object
+#if MI_GUARDED_SAMPLING
 static void mi_block_unguard(mi_page_t* page, mi_block_t* block, void* p) {
   MI_UNUSED(p);
   mi_assert_internal(mi_block_ptr_is_guarded(block, p));
@@ -553,9 +558,9 @@ static void mi_block_unguard(mi_page_t* page, mi_block_t* block, void* p) {
   const size_t bsize = mi_page_block_size(page);
   const size_t psize = _mi_os_page_size();
   mi_assert_internal(bsize > psize);
-  mi_assert_internal(_mi_page_segment(page)->allow_decommit);
   void* gpage = (uint8_t*)block + bsize - psize;
-  mi_assert_internal(_mi_is_aligned(gpage, psize));
-  _mi_os_unprotect(gpage, psize);
+  if (_mi_page_segment(page)->allow_decommit && _mi_is_aligned(gpage, psize)) {  // see `alloc.c:mi_block_ptr_set_guarded`
+    _mi_os_unprotect(gpage, psize);
+  }
 }
 #endif
@@ -59,7 +59,7 @@ static bool mi_heap_page_is_valid(mi_heap_t* heap, mi_page_queue_t* pq, mi_page_
   MI_UNUSED(pq);
   mi_assert_internal(mi_page_heap(page) == heap);
   mi_segment_t* segment = _mi_page_segment(page);
-  mi_assert_internal(mi_atomic_load_relaxed(&segment->thread_id) == heap->thread_id);
+  mi_assert_internal(_mi_segment_owner_id(segment, heap->thread_id) == mi_atomic_load_relaxed(&segment->thread_id));
   mi_assert_expensive(_mi_page_is_valid(page));
   return true;
 }
@@ -116,12 +116,13 @@ static bool mi_heap_page_never_delayed_free(mi_heap_t* heap, mi_page_queue_t* pq
   return true; // don't break
 }
 
-static void mi_heap_collect_ex(mi_heap_t* heap, mi_collect_t collect)
+static void mi_heap_collect_mode(mi_heap_t* heap, mi_collect_t collect)
 {
   if (heap==NULL || !mi_heap_is_initialized(heap)) return;
 
   const bool force = (collect >= MI_FORCE);
   _mi_deferred_free(heap, force);
+  if (collect != MI_ABANDON) { _mi_os_memory_pressure_notify(); }  // (before retrying an allocation that ran out of memory)
 
   // python/cpython#112532: we may be called from a thread that is not the owner of the heap
   const bool is_main_thread = (_mi_is_main_thread() && heap->thread_id == _mi_thread_id());
@@ -155,6 +156,8 @@ static void mi_heap_collect_ex(mi_heap_t* heap, mi_collect_t collect)
 
   // collect all pages owned by this thread
   mi_heap_visit_pages(heap, &mi_heap_page_collect, &collect, NULL);
+  heap->collect_bin = 0;   // and restart any incremental collection
+  heap->collect_page = 0;
   mi_assert_internal( collect != MI_ABANDON || mi_atomic_load_ptr_acquire(mi_block_t,&heap->thread_delayed_free) == NULL );
 
   // collect segments (purge pages, this can be expensive so don't force on abandonment)
@@ -165,16 +168,17 @@ static void mi_heap_collect_ex(mi_heap_t* heap, mi_collect_t collect)
     _mi_thread_data_collect();  // collect thread data cache
   }
 
-  // collect arenas (this is program wide so don't force purges on abandonment of threads)
+  // collect the huge segment cache and arenas (this is program wide so don't force purges on abandonment of threads)
+  _mi_segment_cache_collect(collect == MI_FORCE);
   _mi_arenas_collect(collect == MI_FORCE /* force purge? */);
 }
 
 void _mi_heap_collect_abandon(mi_heap_t* heap) {
-  mi_heap_collect_ex(heap, MI_ABANDON);
+  mi_heap_collect_mode(heap, MI_ABANDON);
 }
 
 void mi_heap_collect(mi_heap_t* heap, bool force) mi_attr_noexcept {
-  mi_heap_collect_ex(heap, (force ? MI_FORCE : MI_NORMAL));
+  mi_heap_collect_mode(heap, (force ? MI_FORCE : MI_NORMAL));
 }
 
 void mi_collect(bool force) mi_attr_noexcept {
@@ -182,6 +186,140 @@ void mi_collect(bool force) mi_attr_noexcept {
 }
 
 
+/* -----------------------------------------------------------
+  Incremental collection
+  `mi_heap_collect_ex` performs a normal collection in small steps:
+  it first collects the pages in the page queues, one page at a time,
+  and then purges the expired pages of the thread segments (oldest first).
+  The heap `collect_bin` and `collect_page` fields are the cursor where
+  the previous step stopped. Pages move between queues in the mean time,
+  so the cursor counts pages instead of pointing to one; at worst a page
+  is visited twice, or skipped until the next round.
+----------------------------------------------------------- */
+
+typedef struct mi_collect_budget_s {
+  mi_msecs_t deadline;    // 0 if there is no time limit
+  size_t     target;      // 0 if there is no byte target
+  size_t     freed;       // bytes freed or purged so far
+} mi_collect_budget_t;
+
+static bool mi_collect_budget_is_spent(const mi_collect_budget_t* budget) {
+  if (budget->target > 0 && budget->freed >= budget->target) return true;
+  return (budget->deadline > 0 && _mi_clock_now() >= budget->deadline);
+}
+
+bool mi_heap_collect_ex(mi_heap_t* heap, size_t budget_ns, size_t target_bytes) mi_attr_noexcept {
+  if (heap==NULL || !mi_heap_is_initialized(heap)) return false;
+  if (budget_ns == 0 && target_bytes == 0) {
+    mi_heap_collect_mode(heap, MI_NORMAL);
+    return false;
+  }
+
+  // the clock has millisecond resolution so the time budget is rounded up
+  mi_collect_budget_t budget = { 0, target_bytes, 0 };
+  if (budget_ns > 0) {
+    budget.deadline = _mi_clock_now() + (mi_msecs_t)(1 + (budget_ns - 1)/1000000);
+  }
+
+  // at the start of a round, run the deferred free and collect the retired pages
+  if (heap->collect_bin == 0 && heap->collect_page == 0) {
+    _mi_deferred_free(heap, false);
+    _mi_heap_collect_retired(heap, false);
+  }
+
+  // free the thread delayed blocks (only those that were freed since the previous step)
+  _mi_heap_delayed_free_partial(heap);
+
+  // collect the pages from the cursor onwards
+  while (heap->collect_bin <= MI_BIN_FULL) {
+    mi_page_queue_t* const pq = &heap->pages[heap->collect_bin];
+    mi_page_t* page = pq->first;
+    for (size_t i = 0; page != NULL && i < heap->collect_page; i++) {
+      page = page->next;
+    }
+    while (page != NULL) {
+      if (mi_collect_budget_is_spent(&budget)) return true;
+      mi_assert_internal(mi_page_heap(page) == heap);
+      mi_page_t* const next = page->next;  // save next as the page may be freed
+      _mi_page_free_collect(page, false);
+      if (mi_page_all_free(page)) {
+        budget.freed += (size_t)page->capacity * mi_page_block_size(page);
+        _mi_page_free(page, pq, false);
+      }
+      else {
+        heap->collect_page++;
+      }
+      page = next;
+    }
+    heap->collect_bin++;
+    heap->collect_page = 0;
+  }
+
+  // and purge the expired pages in the segments
+  while (!mi_collect_budget_is_spent(&budget)) {
+    if (!_mi_segments_collect_step(&budget.freed, &heap->tld->segments)) {
+      // the round is done: collect the (program wide) huge segment cache and arenas
+      _mi_segment_cache_collect(false);
+      _mi_arenas_collect(false);
+      heap->collect_bin = 0;
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/* -----------------------------------------------------------
+  Idle threads
+  A thread that is parked (as in a thread pool) can hold on to many
+  free pages in its segments as only the owning thread can free or
+  purge those. The thread releases them when it calls `mi_thread_idle_hint`
+  before going idle or, if the `idle_trim_delay` option is set, when it
+  allocates again after being idle for at least that delay (as measured
+  between two calls to `_mi_malloc_generic`).
+----------------------------------------------------------- */
+
+// Free the empty and retired pages of all heaps of the thread and purge
+// the free pages in its segments (where empty segments are freed as well).
+// Unlike a forced collection this never reclaims abandoned segments.
+// The arenas are only force purged if `purge_arenas` is set as this is
+// shared with other threads and too expensive on the allocation path.
+static void mi_thread_trim(mi_tld_t* tld, bool purge_arenas) {
+  for (mi_heap_t* heap = tld->heaps; heap != NULL; heap = heap->next) {
+    _mi_heap_delayed_free_all(heap);
+    _mi_heap_collect_retired(heap, true);
+    mi_collect_t collect = MI_FORCE;
+    mi_heap_visit_pages(heap, &mi_heap_page_collect, &collect, NULL);
+    heap->collect_bin = 0;
+    heap->collect_page = 0;
+  }
+  _mi_segments_collect(true, &tld->segments);
+  _mi_arenas_collect(purge_arenas /* force purge */);
+}
+
+void mi_thread_idle_hint(void) mi_attr_noexcept {
+  mi_heap_t* heap = mi_prim_get_default_heap();
+  if (!mi_heap_is_initialized(heap)) return;
+  mi_thread_trim(heap->tld, true);
+  heap->tld->last_generic = 0;  // no need to trim again when the thread allocates next
+}
+
+// Called from `_mi_malloc_generic`: if the time since the previous call is longer than the
+// `idle_trim_delay`, the thread did not allocate (beyond its free lists) in between and was idle.
+// (a busy thread regularly calls `_mi_malloc_generic` as its free lists run out)
+void _mi_thread_idle_check(mi_tld_t* tld) {
+  const long delay = mi_option_get(mi_option_idle_trim_delay);
+  if mi_likely(delay <= 0) return;
+  const mi_msecs_t now = _mi_clock_now();
+  const mi_msecs_t last = tld->last_generic;
+  tld->last_generic = now;
+  if (last != 0 && now - last >= delay) {
+    _mi_verbose_message("trim the heaps of an idle thread (idle for at least %lld ms)\n", (long long)(now - last));
+    mi_thread_trim(tld, false);
+  }
+}
+
+
 /* -----------------------------------------------------------
   Heap new
 ----------------------------------------------------------- */
@@ -245,6 +383,22 @@ mi_decl_nodiscard mi_heap_t* mi_heap_new(void) {
   return mi_heap_new_ex(0 /* default heap tag */, true /* no reclaim */, _mi_arena_id_none());
 }
 
+void mi_heap_policy_init(mi_heap_policy_t* policy) mi_attr_noexcept {
+  policy->purge_delay = mi_option_get(mi_option_purge_delay);
+  policy->purge_decommits = mi_option_is_enabled(mi_option_purge_decommits);
+  policy->eager_commit = mi_option_is_enabled(mi_option_eager_commit);
+}
+
+mi_decl_nodiscard mi_heap_t* mi_heap_new_with_policy(const mi_heap_policy_t* policy) {
+  mi_heap_t* heap = mi_heap_new();
+  if (heap == NULL) return NULL;
+  if (policy != NULL) {
+    heap->policy = *policy;
+    heap->has_policy = true;
+  }
+  return heap;
+}
+
 bool _mi_heap_memid_is_suitable(mi_heap_t* heap, mi_memid_t memid) {
   return _mi_arena_memid_is_suitable(memid, heap->arena_id);
 }
@@ -258,7 +412,7 @@ static void mi_heap_reset_pages(mi_heap_t* heap) {
   mi_assert_internal(heap != NULL);
   mi_assert_internal(mi_heap_is_initialized(heap));
   // TODO: copy full empty heap instead?
-  memset(&heap->pages_free_direct, 0, sizeof(heap->pages_free_direct));
+  _mi_memcpy_aligned(&heap->pages_free_direct, &_mi_heap_empty.pages_free_direct, sizeof(heap->pages_free_direct));
   _mi_memcpy_aligned(&heap->pages, &_mi_heap_empty.pages, sizeof(heap->pages));
   heap->thread_delayed_free = NULL;
   heap->page_count = 0;
@@ -346,7 +500,7 @@ static bool _mi_heap_page_destroy(mi_heap_t* heap, mi_page_queue_t* pq, mi_page_
   // mi_page_free(page,false);
   page->next = NULL;
   page->prev = NULL;
-  _mi_segment_page_free(page,false /* no force? */, &heap->tld->segments);
+  _mi_segment_page_free(page,false /* no force? */, _mi_heap_policy(heap), &heap->tld->segments);
 
   return true; // keep going
 }
@@ -370,11 +524,14 @@ void mi_heap_destroy(mi_heap_t* heap) {
   mi_assert(heap->no_reclaim);
   mi_assert_expensive(mi_heap_is_valid(heap));
   if (heap==NULL || !mi_heap_is_initialized(heap)) return;
-  #if MI_GUARDED
-  // _mi_warning_message("'mi_heap_destroy' called but MI_GUARDED is enabled -- using `mi_heap_delete` instead (heap at %p)\n", heap);
-  mi_heap_delete(heap);
-  return;
-  #else
+  #if MI_GUARDED_SAMPLING
+  if (heap->guarded_sample_rate != 0) {
+    // guarded objects need to be freed one by one to remove their guard page
+    // _mi_warning_message("'mi_heap_destroy' called but guarded sampling is enabled -- using `mi_heap_delete` instead (heap at %p)\n", heap);
+    mi_heap_delete(heap);
+    return;
+  }
+  #endif
   if (!heap->no_reclaim) {
     _mi_warning_message("'mi_heap_destroy' called but ignored as the heap was not created with 'allow_destroy' (heap at %p)\n", heap);
     // don't free in case it may contain reclaimed pages
@@ -389,7 +546,6 @@ void mi_heap_destroy(mi_heap_t* heap) {
     _mi_heap_destroy_pages(heap);
     mi_heap_free(heap);
   }
-  #endif
 }
 
 // forcefully destroy all heaps in the current thread
@@ -409,6 +565,31 @@ void _mi_heap_unsafe_destroy_all(mi_heap_t* heap) {
   }
 }
 
+static bool mi_heap_page_fork_freeze(mi_heap_t* heap, mi_page_queue_t* pq, mi_page_t* page, void* arg1, void* arg2) {
+  MI_UNUSED(heap); MI_UNUSED(pq); MI_UNUSED(arg1); MI_UNUSED(arg2);
+  _mi_segment_fork_freeze(_mi_page_segment(page));
+  return true;
+}
+
+// In the child of a fork: heaps in a shared arena start out empty as their pages still belong
+// to the parent. With `mi_option_fork_freeze` (`freeze`), leave all pages of the heaps
+// in the current thread to the parent and continue with empty heaps.
+void _mi_heap_fork_child(mi_heap_t* heap, bool freeze) {
+  mi_assert_internal(heap != NULL);
+  if (heap == NULL) return;
+  for (mi_heap_t* curr = heap->tld->heaps; curr != NULL; curr = curr->next) {
+    if (_mi_arena_id_is_shared(curr->arena_id)) {
+      mi_heap_reset_pages(curr);  // don't visit the pages as the parent can change them concurrently
+    }
+    else if (freeze) {
+      mi_heap_visit_pages(curr, &mi_heap_page_fork_freeze, NULL, NULL);
+      mi_heap_reset_pages(curr);
+    }
+  }
+  _mi_segments_fork_leave_shared(&heap->tld->segments);
+  if (freeze) { _mi_segments_fork_freeze(&heap->tld->segments); }
+}
+
 /* -----------------------------------------------------------
   Safe Heap delete
 ----------------------------------------------------------- */
@@ -495,7 +676,7 @@ mi_heap_t* mi_heap_set_default(mi_heap_t* heap) {
 static mi_heap_t* mi_heap_of_block(const void* p) {
   if (p == NULL) return NULL;
   mi_segment_t* segment = _mi_ptr_segment(p);
-  bool valid = (_mi_ptr_cookie(segment) == segment->cookie);
+  bool valid = _mi_segment_cookie_is_valid(segment);
   mi_assert_internal(valid);
   if mi_unlikely(!valid) return NULL;
   return mi_page_heap(_mi_segment_page_of(segment,p));
@@ -508,23 +689,18 @@ bool mi_heap_contains_block(mi_heap_t* heap, const void* p) {
 }
 
 
-static bool mi_heap_page_check_owned(mi_heap_t* heap, mi_page_queue_t* pq, mi_page_t* page, void* p, void* vfound) {
-  MI_UNUSED(heap);
-  MI_UNUSED(pq);
-  bool* found = (bool*)vfound;
-  void* start = mi_page_start(page);
-  void* end   = (uint8_t*)start + (page->capacity * mi_page_block_size(page));
-  *found = (p >= start && p < end);
-  return (!*found); // continue if not found
-}
-
+// Check in O(1) if `p` points into a block of `heap`: we find the segment through the segment map,
+// and check the page belongs to the heap and that `p` is within the blocks that are initialized in the page.
 bool mi_heap_check_owned(mi_heap_t* heap, const void* p) {
   mi_assert(heap != NULL);
   if (heap==NULL || !mi_heap_is_initialized(heap)) return false;
   if (((uintptr_t)p & (MI_INTPTR_SIZE - 1)) != 0) return false;  // only aligned pointers
-  bool found = false;
-  mi_heap_visit_pages(heap, &mi_heap_page_check_owned, (void*)p, &found);
-  return found;
+  mi_segment_t* const segment = _mi_segment_of(p);
+  if (segment == NULL || mi_atomic_load_relaxed(&segment->thread_id) != _mi_segment_owner_id(segment, heap->thread_id)) return false;
+  const mi_page_t* const page = (segment->page_kind == MI_PAGE_HUGE ? &segment->pages[0] : _mi_segment_page_of(segment, p));
+  if (!page->segment_in_use || mi_page_heap(page) != heap) return false;
+  const uint8_t* const start = mi_page_start(page);
+  return ((const uint8_t*)p >= start && (const uint8_t*)p < start + (page->capacity * mi_page_block_size(page)));
 }
 
 bool mi_check_owned(const void* p) {
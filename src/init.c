@@ -15,7 +15,7 @@ terms of the MIT license. A copy of the license can be found in the file
 // Empty page used to initialize the small free pages array
 const mi_page_t _mi_page_empty = {
   0,
-  false, false, false, false,
+  false, false, false, false, false, false, false,
   0,       // capacity
   0,       // reserved capacity
   { 0 },   // flags
@@ -112,9 +112,13 @@ mi_decl_cache_align const mi_heap_t _mi_heap_empty = {
   NULL,             // next
   false,            // can reclaim
   0,                // tag
-  #if MI_GUARDED
-  0, 0, 0, 0, 1,    // count is 1 so we never write to it (see `internal.h:mi_heap_malloc_use_guarded`)
+  false,            // has policy
+  { 0, false, false }, // policy
+  0, 0,             // collect cursor
+  #if MI_GUARDED_SAMPLING
+  0, 0, 0, 0, 0,    // rate is 0 so we never write to it (see `page.c:mi_heap_guarded_reserve`)
   #endif
+  { {0, 0, false, false, 0} }, // bin churn
   MI_SMALL_PAGES_EMPTY,
   MI_PAGE_QUEUES_EMPTY
 };
@@ -132,10 +136,10 @@ extern mi_heap_t _mi_heap_main;
 static mi_decl_cache_align mi_subproc_t mi_subproc_default;
 
 static mi_decl_cache_align mi_tld_t tld_main = {
-  0, false,
+  0, false, 0,
   &_mi_heap_main, &_mi_heap_main,
-  { { NULL, NULL }, {NULL ,NULL}, {NULL ,NULL, 0},
-    0, 0, 0, 0, 0, &mi_subproc_default,
+  { { { NULL, NULL } }, { { NULL, NULL } }, { { NULL, NULL } }, { { NULL, NULL } }, {NULL ,NULL, 0},
+    0, 0, 0, 0, 0, 0, 0, NULL, &mi_subproc_default,
     &tld_main.stats
   }, // segments
   { MI_STATS_NULL }       // stats
@@ -154,9 +158,13 @@ mi_decl_cache_align mi_heap_t _mi_heap_main = {
   NULL,             // next heap
   false,            // can reclaim
   0,                // tag
-  #if MI_GUARDED
+  false,            // has policy
+  { 0, false, false }, // policy
+  0, 0,             // collect cursor
+  #if MI_GUARDED_SAMPLING
   0, 0, 0, 0, 0,
   #endif
+  { {0, 0, false, false, 0} }, // bin churn
   MI_SMALL_PAGES_EMPTY,
   MI_PAGE_QUEUES_EMPTY
 };
@@ -165,8 +173,11 @@ bool _mi_process_is_initialized = false;  // set to `true` in `mi_process_init`.
 
 mi_stats_t _mi_stats_main = { MI_STATS_NULL };
 
-#if MI_GUARDED
+bool _mi_guarded_sampling_enabled = false;
+
+#if MI_GUARDED_SAMPLING
 mi_decl_export void mi_heap_guarded_set_sample_rate(mi_heap_t* heap, size_t sample_rate, size_t seed) {
+  if (sample_rate != 0) { _mi_guarded_sampling_enabled = true; }  // page-align the segment info of new segments (see `segment.c`)
   heap->guarded_sample_seed = seed;
   if (heap->guarded_sample_seed == 0) {
     heap->guarded_sample_seed = _mi_heap_random_next(heap);
@@ -175,7 +186,7 @@ mi_decl_export void mi_heap_guarded_set_sample_rate(mi_heap_t* heap, size_t samp
   if (heap->guarded_sample_rate >= 1) {
     heap->guarded_sample_seed = heap->guarded_sample_seed % heap->guarded_sample_rate;
   }
-  heap->guarded_sample_count = heap->guarded_sample_seed;  // count down samples
+  heap->guarded_sample_count = heap->guarded_sample_seed;  // count down samples (in the allocation slow path)
 }
 
 mi_decl_export void mi_heap_guarded_set_size_bound(mi_heap_t* heap, size_t min, size_t max) {
@@ -217,7 +228,6 @@ static void mi_heap_main_init(void) {
     _mi_heap_main.cookie  = _mi_heap_random_next(&_mi_heap_main);
     _mi_heap_main.keys[0] = _mi_heap_random_next(&_mi_heap_main);
     _mi_heap_main.keys[1] = _mi_heap_random_next(&_mi_heap_main);
-    mi_lock_init(&mi_subproc_default.abandoned_os_lock);
     mi_lock_init(&mi_subproc_default.abandoned_os_visit_lock);
     _mi_heap_guarded_init(&_mi_heap_main);
   }
@@ -242,8 +252,6 @@ mi_subproc_id_t mi_subproc_new(void) {
   mi_subproc_t* subproc = (mi_subproc_t*)_mi_arena_meta_zalloc(sizeof(mi_subproc_t), &memid);
   if (subproc == NULL) return NULL;
   subproc->memid = memid;
-  subproc->abandoned_os_list = NULL;
-  mi_lock_init(&subproc->abandoned_os_lock);
   mi_lock_init(&subproc->abandoned_os_visit_lock);
   return subproc;
 }
@@ -256,16 +264,9 @@ void mi_subproc_delete(mi_subproc_id_t subproc_id) {
   if (subproc_id == NULL) return;
   mi_subproc_t* subproc = _mi_subproc_from_id(subproc_id);
   // check if there are no abandoned segments still..
-  bool safe_to_delete = false;
-  mi_lock(&subproc->abandoned_os_lock) {
-    if (subproc->abandoned_os_list == NULL) {
-      safe_to_delete = true;
-    }
-  }
-  if (!safe_to_delete) return;
+  if (mi_atomic_load_acquire(&subproc->abandoned_os_list_count) != 0) return;
   // safe to release
   // todo: should we refcount subprocesses?
-  mi_lock_done(&subproc->abandoned_os_lock);
   mi_lock_done(&subproc->abandoned_os_visit_lock);
   _mi_arena_meta_free(subproc, subproc->memid, sizeof(mi_subproc_t));
 }
@@ -486,6 +487,49 @@ size_t  _mi_current_thread_count(void) {
   return mi_atomic_load_relaxed(&thread_count);
 }
 
+// --------------------------------------------------------
+// Fork handlers (installed with `mi_option_fork_handlers` or `mi_option_fork_freeze`)
+// Only the forking thread survives in the child; the segments
+// of the other threads are orphaned in O(1) by `_mi_segments_fork_child`.
+// --------------------------------------------------------
+
+static _Atomic(size_t) mi_fork_handlers_installed;
+
+// Install the fork handlers once if enabled or `always` (called in `mi_process_init`, when the options are set,
+// and when managing shared memory as the child of a fork must leave the shared heaps to the parent)
+void _mi_fork_handlers_install(bool always) {
+  if (mi_atomic_load_relaxed(&mi_fork_handlers_installed) != 0) return;
+  if (!always && !mi_option_is_enabled(mi_option_fork_handlers) && !mi_option_is_enabled(mi_option_fork_freeze)) return;
+  size_t expected = 0;
+  if (mi_atomic_cas_strong_acq_rel(&mi_fork_handlers_installed, &expected, 1)) {
+    if (!_mi_prim_fork_handlers_install()) {  // not supported on all platforms
+      _mi_verbose_message("unable to install fork handlers\n");
+    }
+  }
+}
+
+// Called in the forking thread just before a `fork()`
+void _mi_fork_prepare(void) {
+  mi_lock_acquire(&mi_subproc_default.abandoned_os_visit_lock);
+}
+
+// Called in the parent process after a `fork()`
+void _mi_fork_parent(void) {
+  mi_lock_release(&mi_subproc_default.abandoned_os_visit_lock);
+}
+
+// Called in the child process after a `fork()` (by the only thread)
+void _mi_fork_child(void) {
+  mi_lock_release(&mi_subproc_default.abandoned_os_visit_lock);  // acquired in `_mi_fork_prepare` by this thread
+  mi_atomic_store_relaxed(&thread_count, 1);
+  _mi_segments_fork_child();
+  _mi_arenas_fork_child();
+  mi_heap_t* heap = mi_prim_get_default_heap();  // use prim to not initialize any heap
+  if (mi_heap_is_initialized(heap)) {
+    _mi_heap_fork_child(heap, mi_option_is_enabled(mi_option_fork_freeze));
+  }
+}
+
 // This is called from the `mi_malloc_generic`
 void mi_thread_init(void) mi_attr_noexcept
 {
@@ -583,18 +627,47 @@ void _mi_process_load(void) {
   _mi_random_reinit_if_weak(&_mi_heap_main.random);
 }
 
-#if defined(_WIN32) && (defined(_M_IX86) || defined(_M_X64))
-#include <intrin.h>
+// cpu features used by `_mi_memcpy` (fsrm, erms) and the non-temporal kernels in `libc.c` (avx2, avx512)
 mi_decl_cache_align bool _mi_cpu_has_fsrm = false;
 mi_decl_cache_align bool _mi_cpu_has_erms = false;
+mi_decl_cache_align bool _mi_cpu_has_avx2 = false;
+mi_decl_cache_align bool _mi_cpu_has_avx512 = false;
 
+#if defined(_WIN32) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
 static void mi_detect_cpu_features(void) {
   // FSRM for fast short rep movsb/stosb support (AMD Zen3+ (~2020) or Intel Ice Lake+ (~2017))
   // EMRS for fast enhanced rep movsb/stosb support
   int32_t cpu_info[4];
-  __cpuid(cpu_info, 7);
+  __cpuidex(cpu_info, 7, 0);
   _mi_cpu_has_fsrm = ((cpu_info[3] & (1 << 4)) != 0); // bit 4 of EDX : see <https://en.wikipedia.org/wiki/CPUID#EAX=7,_ECX=0:_Extended_Features>
   _mi_cpu_has_erms = ((cpu_info[2] & (1 << 9)) != 0); // bit 9 of ECX : see <https://en.wikipedia.org/wiki/CPUID#EAX=7,_ECX=0:_Extended_Features>
+  // AVX2 and AVX-512 need both cpu support and the OS saving the ymm/zmm state (XCR0)
+  const bool has_avx2   = ((cpu_info[1] & (1 << 5)) != 0);   // bit 5 of EBX
+  const bool has_avx512 = ((cpu_info[1] & (1 << 16)) != 0);  // bit 16 of EBX (AVX512F)
+  __cpuid(cpu_info, 1);
+  if ((cpu_info[2] & (1 << 27)) != 0) {  // bit 27 of ECX: OSXSAVE
+    const uint64_t xcr0 = _xgetbv(0);
+    _mi_cpu_has_avx2   = has_avx2 && ((xcr0 & 0x06) == 0x06);
+    _mi_cpu_has_avx512 = has_avx512 && ((xcr0 & 0xE6) == 0xE6);
+  }
+}
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#include <cpuid.h>
+static void mi_detect_cpu_features(void) {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return;
+  _mi_cpu_has_fsrm = ((edx & (1 << 4)) != 0);
+  _mi_cpu_has_erms = ((ecx & (1 << 9)) != 0);
+  const bool has_avx2   = ((ebx & (1 << 5)) != 0);
+  const bool has_avx512 = ((ebx & (1 << 16)) != 0);
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return;
+  if ((ecx & (1 << 27)) != 0) {  // OSXSAVE
+    unsigned int xcr0_lo, xcr0_hi;
+    __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    _mi_cpu_has_avx2   = has_avx2 && ((xcr0_lo & 0x06) == 0x06);
+    _mi_cpu_has_avx512 = has_avx512 && ((xcr0_lo & 0xE6) == 0xE6);
+  }
 }
 #else
 static void mi_detect_cpu_features(void) {
@@ -640,12 +713,22 @@ void mi_process_init(void) mi_attr_noexcept {
   if (mi_option_is_enabled(mi_option_reserve_huge_os_pages)) {
     size_t pages = mi_option_get_clamp(mi_option_reserve_huge_os_pages, 0, 128*1024);
     long reserve_at = mi_option_get(mi_option_reserve_huge_os_pages_at);
-    if (reserve_at != -1) {
+    if (mi_option_is_enabled(mi_option_reserve_huge_os_pages_async) &&
+        _mi_arena_reserve_huge_os_pages_async(pages, (int)reserve_at, pages*500)) {
+      // reserving in a background thread
+    }
+    else if (reserve_at != -1) {
       mi_reserve_huge_os_pages_at(pages, reserve_at, pages*500);
     } else {
       mi_reserve_huge_os_pages_interleave(pages, 0, pages*500);
     }
   }
+  if (mi_option_is_enabled(mi_option_watch_memory_pressure)) {
+    if (!_mi_prim_memory_pressure_watch()) {
+      _mi_verbose_message("unable to watch for memory pressure events\n");
+    }
+  }
+  _mi_fork_handlers_install(false);
   if (mi_option_is_enabled(mi_option_reserve_os_memory)) {
     long ksize = mi_option_get(mi_option_reserve_os_memory);
     if (ksize > 0) {
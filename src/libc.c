@@ -275,3 +275,187 @@ int _mi_snprintf(char* buf, size_t buflen, const char* fmt, ...) {
   va_end(args);
   return written;
 }
+
+
+// --------------------------------------------------------
+// Non-temporal `_mi_memcpy_nt` and `_mi_memzero_nt`
+// These are used for large blocks (`MI_MEMOP_NT_MIN_SIZE`) in
+// realloc and calloc where regular stores would evict the
+// working set from the cache. The (unaligned) head and tail
+// use regular stores; the body uses streaming stores with
+// the widest vector width the cpu supports (AVX-512, AVX2,
+// or SSE2 on x64; NEON `stnp` on arm64). Otherwise (and in
+// C++ builds on x64, see `MI_NO_X86_INTRINSICS`) we fall
+// back to `_mi_memcpy` and `_mi_memzero`.
+// --------------------------------------------------------
+
+#if !MI_TRACK_ENABLED && (defined(__x86_64__) || defined(_M_X64)) && !defined(_M_ARM64EC) && !defined(MI_NO_X86_INTRINSICS)
+#include <immintrin.h>
+
+extern bool _mi_cpu_has_avx2;     // in init.c
+extern bool _mi_cpu_has_avx512;
+
+#if defined(__GNUC__) || defined(__clang__)
+#define mi_decl_target(x)  __attribute__((target(x)))
+#else
+#define mi_decl_target(x)
+#endif
+
+// align `dst` to `align` bytes using regular stores; returns the number of bytes handled
+static size_t mi_nt_head(uint8_t* dst, const uint8_t* src, size_t align) {
+  const size_t head = (align - ((uintptr_t)dst % align)) % align;
+  if (src != NULL) { _mi_memcpy(dst, src, head); }
+              else { _mi_memzero(dst, head); }
+  return head;
+}
+
+static void mi_nt_sse2(uint8_t* dst, const uint8_t* src, size_t n) {
+  const size_t head = mi_nt_head(dst, src, 16);
+  dst += head; n -= head;
+  if (src != NULL) src += head;
+  const __m128i zero = _mm_setzero_si128();
+  for (; n >= 64; n -= 64, dst += 64) {
+    if (src != NULL) {
+      const __m128i x0 = _mm_loadu_si128((const __m128i*)src);
+      const __m128i x1 = _mm_loadu_si128((const __m128i*)(src + 16));
+      const __m128i x2 = _mm_loadu_si128((const __m128i*)(src + 32));
+      const __m128i x3 = _mm_loadu_si128((const __m128i*)(src + 48));
+      _mm_stream_si128((__m128i*)dst, x0);
+      _mm_stream_si128((__m128i*)(dst + 16), x1);
+      _mm_stream_si128((__m128i*)(dst + 32), x2);
+      _mm_stream_si128((__m128i*)(dst + 48), x3);
+      src += 64;
+    }
+    else {
+      _mm_stream_si128((__m128i*)dst, zero);
+      _mm_stream_si128((__m128i*)(dst + 16), zero);
+      _mm_stream_si128((__m128i*)(dst + 32), zero);
+      _mm_stream_si128((__m128i*)(dst + 48), zero);
+    }
+  }
+  _mm_sfence();
+  if (src != NULL) { _mi_memcpy(dst, src, n); }
+              else { _mi_memzero(dst, n); }
+}
+
+mi_decl_target("avx2")
+static void mi_nt_avx2(uint8_t* dst, const uint8_t* src, size_t n) {
+  const size_t head = mi_nt_head(dst, src, 32);
+  dst += head; n -= head;
+  if (src != NULL) src += head;
+  const __m256i zero = _mm256_setzero_si256();
+  for (; n >= 128; n -= 128, dst += 128) {
+    if (src != NULL) {
+      const __m256i x0 = _mm256_loadu_si256((const __m256i*)src);
+      const __m256i x1 = _mm256_loadu_si256((const __m256i*)(src + 32));
+      const __m256i x2 = _mm256_loadu_si256((const __m256i*)(src + 64));
+      const __m256i x3 = _mm256_loadu_si256((const __m256i*)(src + 96));
+      _mm256_stream_si256((__m256i*)dst, x0);
+      _mm256_stream_si256((__m256i*)(dst + 32), x1);
+      _mm256_stream_si256((__m256i*)(dst + 64), x2);
+      _mm256_stream_si256((__m256i*)(dst + 96), x3);
+      src += 128;
+    }
+    else {
+      _mm256_stream_si256((__m256i*)dst, zero);
+      _mm256_stream_si256((__m256i*)(dst + 32), zero);
+      _mm256_stream_si256((__m256i*)(dst + 64), zero);
+      _mm256_stream_si256((__m256i*)(dst + 96), zero);
+    }
+  }
+  _mm_sfence();
+  _mm256_zeroupper();
+  if (src != NULL) { _mi_memcpy(dst, src, n); }
+              else { _mi_memzero(dst, n); }
+}
+
+mi_decl_target("avx512f")
+static void mi_nt_avx512(uint8_t* dst, const uint8_t* src, size_t n) {
+  const size_t head = mi_nt_head(dst, src, 64);
+  dst += head; n -= head;
+  if (src != NULL) src += head;
+  const __m512i zero = _mm512_setzero_si512();
+  for (; n >= 128; n -= 128, dst += 128) {
+    if (src != NULL) {
+      const __m512i x0 = _mm512_loadu_si512((const void*)src);
+      const __m512i x1 = _mm512_loadu_si512((const void*)(src + 64));
+      _mm512_stream_si512((__m512i*)dst, x0);
+      _mm512_stream_si512((__m512i*)(dst + 64), x1);
+      src += 128;
+    }
+    else {
+      _mm512_stream_si512((__m512i*)dst, zero);
+      _mm512_stream_si512((__m512i*)(dst + 64), zero);
+    }
+  }
+  _mm_sfence();
+  _mm256_zeroupper();
+  if (src != NULL) { _mi_memcpy(dst, src, n); }
+              else { _mi_memzero(dst, n); }
+}
+
+static void mi_nt_store(uint8_t* dst, const uint8_t* src, size_t n) {
+  if (_mi_cpu_has_avx512)    { mi_nt_avx512(dst, src, n); }
+  else if (_mi_cpu_has_avx2) { mi_nt_avx2(dst, src, n); }
+  else                       { mi_nt_sse2(dst, src, n); }
+}
+
+void _mi_memcpy_nt(void* dst, const void* src, size_t n) {
+  mi_nt_store((uint8_t*)dst, (const uint8_t*)src, n);
+}
+
+void _mi_memzero_nt(void* dst, size_t n) {
+  mi_nt_store((uint8_t*)dst, NULL, n);
+}
+
+#elif !MI_TRACK_ENABLED && defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+
+// arm64 has no cpu feature to detect here: NEON is always present and `stnp` is a
+// non-temporal hint that is part of the base instruction set.
+static void mi_nt_store(uint8_t* dst, const uint8_t* src, size_t n) {
+  const size_t head = (16 - ((uintptr_t)dst % 16)) % 16;
+  if (src != NULL) { _mi_memcpy(dst, src, head); src += head; }
+              else { _mi_memzero(dst, head); }
+  dst += head; n -= head;
+  for (; n >= 64; n -= 64, dst += 64) {
+    if (src != NULL) {
+      __asm__ volatile("ldp q0, q1, [%1]\n\t"
+                       "ldp q2, q3, [%1, #32]\n\t"
+                       "stnp q0, q1, [%0]\n\t"
+                       "stnp q2, q3, [%0, #32]"
+                       : : "r"(dst), "r"(src) : "v0", "v1", "v2", "v3", "memory");
+      src += 64;
+    }
+    else {
+      __asm__ volatile("stnp xzr, xzr, [%0]\n\t"
+                       "stnp xzr, xzr, [%0, #16]\n\t"
+                       "stnp xzr, xzr, [%0, #32]\n\t"
+                       "stnp xzr, xzr, [%0, #48]"
+                       : : "r"(dst) : "memory");
+    }
+  }
+  // order the non-temporal stores before any later stores (like publishing the pointer)
+  __asm__ volatile("dmb ishst" : : : "memory");
+  if (src != NULL) { _mi_memcpy(dst, src, n); }
+              else { _mi_memzero(dst, n); }
+}
+
+void _mi_memcpy_nt(void* dst, const void* src, size_t n) {
+  mi_nt_store((uint8_t*)dst, (const uint8_t*)src, n);
+}
+
+void _mi_memzero_nt(void* dst, size_t n) {
+  mi_nt_store((uint8_t*)dst, NULL, n);
+}
+
+#else
+
+void _mi_memcpy_nt(void* dst, const void* src, size_t n) {
+  _mi_memcpy(dst, src, n);
+}
+
+void _mi_memzero_nt(void* dst, size_t n) {
+  _mi_memzero(dst, n);
+}
+
+#endif
@@ -149,25 +149,33 @@ static mi_option_desc_t options[_mi_option_last] =
   { 1,   UNINIT, MI_OPTION_LEGACY(purge_extend_delay, decommit_extend_delay) },
   { 0,   UNINIT, MI_OPTION(abandoned_reclaim_on_free) },// reclaim an abandoned segment on a free
   { MI_DEFAULT_DISALLOW_ARENA_ALLOC,   UNINIT, MI_OPTION(disallow_arena_alloc) }, // 1 = do not use arena's for allocation (except if using specific arena id's)
-  { 400, UNINIT, MI_OPTION(retry_on_oom) },             // windows only: retry on out-of-memory for N milli seconds (=400), set to 0 to disable retries.
+  { 400, UNINIT, MI_OPTION(retry_on_oom) },             // retry on out-of-memory after purging (and on windows, for N milli seconds (=400)), set to 0 to disable retries.
 #if defined(MI_VISIT_ABANDONED)
   { 1,   INITIALIZED, MI_OPTION(visit_abandoned) },     // allow visiting heap blocks in abandoned segments; requires taking locks during reclaim.
 #else
   { 0,   UNINIT, MI_OPTION(visit_abandoned) },
 #endif
-  { 0,   UNINIT, MI_OPTION(guarded_min) },              // only used when building with MI_GUARDED: minimal rounded object size for guarded objects
-  { MI_GiB, UNINIT, MI_OPTION(guarded_max) },           // only used when building with MI_GUARDED: maximal rounded object size for guarded objects
+  { 0,   UNINIT, MI_OPTION(guarded_min) },              // minimal rounded object size for guarded objects
+  { MI_GiB, UNINIT, MI_OPTION(guarded_max) },           // maximal rounded object size for guarded objects
   { 0,   UNINIT, MI_OPTION(guarded_precise) },          // disregard minimal alignment requirement to always place guarded blocks exactly in front of a guard page (=0)
   { MI_DEFAULT_GUARDED_SAMPLE_RATE,
-         UNINIT, MI_OPTION(guarded_sample_rate)},       // 1 out of N allocations in the min/max range will be guarded (=4000)
+         UNINIT, MI_OPTION(guarded_sample_rate)},       // 1 out of N allocations in the min/max range will be guarded (=0, or 4000 when building with MI_GUARDED)
   { 0,   UNINIT, MI_OPTION(guarded_sample_seed)},
   { 0,   UNINIT, MI_OPTION(target_segments_per_thread) }, // abandon segments beyond this point, or 0 to disable.
+  { 0,   UNINIT, MI_OPTION(reserve_huge_os_pages_async) }, // reserve huge OS pages in a background thread at startup
+  { 0,   UNINIT, MI_OPTION(watch_memory_pressure) },    // watch for OS memory pressure events in a background thread
+  { 0,   UNINIT, MI_OPTION(commit_pressure_threshold) },// signal memory pressure when the committed memory exceeds N KiB (0 = disabled)
+  { 0,   UNINIT, MI_OPTION(huge_segment_cache) },       // keep up to N KiB of freed huge segments committed for reuse (0 = disabled)
+  { 0,   UNINIT, MI_OPTION(fork_freeze) },              // in the child of a fork, ignore frees of blocks allocated before the fork
+  { 0,   UNINIT, MI_OPTION(idle_trim_delay) },          // trim the heaps of a thread that allocates again after being idle for N milli seconds (0 = disabled)
+  { 0,   UNINIT, MI_OPTION(fork_handlers) },            // install `pthread_atfork` handlers (also installed when `fork_freeze` is enabled)
 };
 
 static void mi_option_init(mi_option_desc_t* desc);
 
 static bool mi_option_has_size_in_kib(mi_option_t option) {
-  return (option == mi_option_reserve_os_memory || option == mi_option_arena_reserve);
+  return (option == mi_option_reserve_os_memory || option == mi_option_arena_reserve ||
+          option == mi_option_commit_pressure_threshold || option == mi_option_huge_segment_cache);
 }
 
 void _mi_options_init(void) {
@@ -184,14 +192,18 @@ void _mi_options_init(void) {
   }
   mi_max_error_count = mi_option_get(mi_option_max_errors);
   mi_max_warning_count = mi_option_get(mi_option_max_warnings);
-  #if MI_GUARDED
+  #if MI_GUARDED_SAMPLING
   if (mi_option_get(mi_option_guarded_sample_rate) > 0) {
     if (mi_option_is_enabled(mi_option_allow_large_os_pages)) {
       mi_option_disable(mi_option_allow_large_os_pages);
       _mi_warning_message("option 'allow_large_os_pages' is disabled to allow for guarded objects\n");
     }
   }
-  _mi_verbose_message("guarded build: %s\n", mi_option_get(mi_option_guarded_sample_rate) != 0 ? "enabled" : "disabled");
+  _mi_verbose_message("guarded sampling: %s\n", mi_option_get(mi_option_guarded_sample_rate) != 0 ? "enabled" : "disabled");
+  #else
+  if (mi_option_get(mi_option_guarded_sample_rate) > 0) {
+    _mi_warning_message("option 'guarded_sample_rate' is ignored as guarded objects are not supported in builds with padding\n");
+  }
   #endif
 }
 
@@ -243,6 +255,9 @@ void mi_option_set(mi_option_t option, long value) {
   else if (desc->option == mi_option_guarded_max && _mi_option_get_fast(mi_option_guarded_min) > value) {
     mi_option_set(mi_option_guarded_min, value);
   }
+  else if ((desc->option == mi_option_fork_handlers || desc->option == mi_option_fork_freeze) && value != 0) {
+    _mi_fork_handlers_install(false);  // enabled at runtime
+  }
 }
 
 void mi_option_set_default(mi_option_t option, long value) {
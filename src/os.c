@@ -40,7 +40,8 @@ static mi_os_mem_config_t mi_os_mem_config = {
   MI_DEFAULT_VIRTUAL_ADDRESS_BITS,
   true,     // has overcommit?  (if true we use MAP_NORESERVE on mmap systems)
   false,    // can we partially free allocated blocks? (on mmap systems we can free anywhere in a mapped range, but on Windows we must free the entire span)
-  true      // has virtual reserve? (if true we can reserve virtual address space without using commit or physical memory)
+  true,     // has virtual reserve? (if true we can reserve virtual address space without using commit or physical memory)
+  false     // is decommitted memory zero when re-used?
 };
 
 bool _mi_os_has_overcommit(void) {
@@ -164,6 +165,8 @@ void* _mi_os_get_aligned_hint(size_t try_alignment, size_t size) {
 -------------------------------------------------------------- */
 
 static void mi_os_free_huge_os_pages(void* p, size_t size);
+static bool mi_os_retry_on_oom(size_t size);
+static void mi_os_commit_check_threshold(size_t size);
 
 static void mi_os_prim_free(void* addr, size_t size, size_t commit_size) {
   mi_assert_internal((size % _mi_os_page_size()) == 0);
@@ -181,7 +184,7 @@ static void mi_os_prim_free(void* addr, size_t size, size_t commit_size) {
 void _mi_os_free_ex(void* addr, size_t size, bool still_committed, mi_memid_t memid) {
   if (mi_memkind_is_os(memid.memkind)) {
     size_t csize = memid.mem.os.size;
-    if (csize==0) { _mi_os_good_alloc_size(size); }
+    if (csize==0) { csize = _mi_os_good_alloc_size(size); }
     size_t commit_size = (still_committed ? csize : 0);
     void* base = addr;
     // different base? (due to alignment)
@@ -215,6 +218,20 @@ void  _mi_os_free(void* p, size_t size, mi_memid_t memid) {
   _mi_os_free_ex(p, size, true, memid);
 }
 
+// Shrink an OS allocation of `size` bytes in place to `newsize` bytes by freeing the tail.
+// This is only possible if the OS can free parts of an allocation and `p` is the start of it.
+bool _mi_os_shrink(void* p, size_t size, size_t newsize, bool still_committed, mi_memid_t* memid) {
+  mi_assert_internal(newsize > 0 && newsize <= size);
+  mi_assert_internal((newsize % _mi_os_page_size()) == 0);
+  if (!mi_os_mem_config.has_partial_free) return false;
+  if (memid->memkind != MI_MEM_OS || memid->mem.os.base != p) return false;
+  const size_t csize = (memid->mem.os.size == 0 ? _mi_os_good_alloc_size(size) : memid->mem.os.size);
+  if (newsize >= csize) return false;
+  mi_os_prim_free((uint8_t*)p + newsize, csize - newsize, (still_committed ? csize - newsize : 0));
+  memid->mem.os.size = newsize;
+  return true;
+}
+
 
 /* -----------------------------------------------------------
    Primitive allocation from the OS.
@@ -232,17 +249,23 @@ static void* mi_os_prim_alloc_at(void* hint_addr, size_t size, size_t try_alignm
   *is_zero = false;
   void* p = NULL;
   int err = _mi_prim_alloc(hint_addr, size, try_alignment, commit, allow_large, is_large, is_zero, &p);
+  if (err != 0 && mi_os_retry_on_oom(size)) {
+    // try once more as memory may have been released
+    // (except on Windows where `_mi_prim_alloc` already retries for a while on out-of-memory)
+    #if !defined(_WIN32)
+    err = _mi_prim_alloc(hint_addr, size, try_alignment, commit, allow_large, is_large, is_zero, &p);
+    #endif
+  }
   if (err != 0) {
     _mi_warning_message("unable to allocate OS memory (error: %d (0x%x), addr: %p, size: 0x%zx bytes, align: 0x%zx, commit: %d, allow large: %d)\n", err, err, hint_addr, size, try_alignment, commit, allow_large);
   }
 
-
-
   mi_os_stat_counter_increase(mmap_calls, 1);
   if (p != NULL) {
     mi_os_stat_increase(reserved, size);
     if (commit) {
       mi_os_stat_increase(committed, size);
+      mi_os_commit_check_threshold(size);
       // seems needed for asan (or `mimalloc-test-api` fails)
       #ifdef MI_TRACK_ASAN
       if (*is_zero) { mi_track_mem_defined(p,size); }
@@ -432,6 +455,7 @@ bool _mi_os_commit_ex(void* addr, size_t size, bool* is_zero, size_t stat_size)
   if (is_zero != NULL) { *is_zero = false; }
   mi_os_stat_increase(committed, stat_size);  // use size for precise commit vs. decommit
   mi_os_stat_counter_increase(commit_calls, 1);
+  mi_os_commit_check_threshold(stat_size);
 
   // page align range
   size_t csize;
@@ -441,6 +465,9 @@ bool _mi_os_commit_ex(void* addr, size_t size, bool* is_zero, size_t stat_size)
   // commit
   bool os_is_zero = false;
   int err = _mi_prim_commit(start, csize, &os_is_zero);
+  if (err != 0 && mi_os_retry_on_oom(csize)) {
+    err = _mi_prim_commit(start, csize, &os_is_zero);
+  }
   if (err != 0) {
     _mi_warning_message("cannot commit OS memory (error: %d (0x%x), address: %p, size: 0x%zx bytes)\n", err, err, start, csize);
     return false;
@@ -512,17 +539,31 @@ bool _mi_os_reset(void* addr, size_t size) {
 
 // either resets or decommits memory, returns true if the memory needs
 // to be recommitted if it is to be re-used later on.
-bool _mi_os_purge_ex(void* p, size_t size, bool allow_reset, size_t stat_size)
+// If `is_zero` is not NULL, it is set to `true` if private memory is known to be zero after the purge.
+bool _mi_os_purge_ex(void* p, size_t size, bool allow_reset, size_t stat_size, bool* is_zero)
 {
+  if (is_zero != NULL) { *is_zero = false; }
   if (mi_option_get(mi_option_purge_delay) < 0) return false;  // is purging allowed?
+  return _mi_os_purge_policy_ex(p, size, mi_option_is_enabled(mi_option_purge_decommits), allow_reset, stat_size, is_zero);
+}
+
+// as `_mi_os_purge_ex` but with an explicit policy (from a heap) to `decommit` or reset,
+// regardless of the `purge_decommits` and `purge_delay` options.
+bool _mi_os_purge_policy_ex(void* p, size_t size, bool decommit, bool allow_reset, size_t stat_size, bool* is_zero)
+{
+  if (is_zero != NULL) { *is_zero = false; }
   mi_os_stat_counter_increase(purge_calls, 1);
   mi_os_stat_increase(purged, size);
 
-  if (mi_option_is_enabled(mi_option_purge_decommits) &&   // should decommit?
-    !_mi_preloading())                                     // don't decommit during preloading (unsafe)
+  if (decommit &&             // should decommit?
+    !_mi_preloading())        // don't decommit during preloading (unsafe)
   {
     bool needs_recommit = true;
-    mi_os_decommit_ex(p, size, &needs_recommit, stat_size);
+    const bool ok = mi_os_decommit_ex(p, size, &needs_recommit, stat_size);
+    if (ok && is_zero != NULL) {
+      // only if the full range was decommitted
+      *is_zero = (mi_os_mem_config.has_decommit_zero && _mi_is_aligned(p, _mi_os_page_size()) && _mi_is_aligned((uint8_t*)p + size, _mi_os_page_size()));
+    }
     return needs_recommit;
   }
   else {
@@ -536,7 +577,7 @@ bool _mi_os_purge_ex(void* p, size_t size, bool allow_reset, size_t stat_size)
 // either resets or decommits memory, returns true if the memory needs
 // to be recommitted if it is to be re-used later on.
 bool _mi_os_purge(void* p, size_t size) {
-  return _mi_os_purge_ex(p, size, true, size);
+  return _mi_os_purge_ex(p, size, true, size, NULL);
 }
 
 
@@ -566,6 +607,18 @@ bool _mi_os_unprotect(void* addr, size_t size) {
   return mi_os_protectx(addr, size, false);
 }
 
+// Lock a region into physical memory (which also faults in all its pages)
+bool _mi_os_lock(void* addr, size_t size) {
+  size_t csize = 0;
+  void* start = mi_os_page_align_area_conservative(addr, size, &csize);
+  if (csize == 0) return false;
+  int err = _mi_prim_lock(start, csize);
+  if (err != 0) {
+    _mi_warning_message("cannot lock OS memory (error: %d (0x%x), address: %p, size: 0x%zx bytes)\n", err, err, start, csize);
+  }
+  return (err == 0);
+}
+
 
 
 /* ----------------------------------------------------------------------------
@@ -593,7 +646,7 @@ static uint8_t* mi_os_claim_huge_pages(size_t pages, size_t* total_size) {
       // Initialize the start address after the 32TiB area
       start = ((uintptr_t)32 << 40);  // 32TiB virtual start address
     #if (MI_SECURE>0 || MI_DEBUG==0)      // security: randomize start of huge pages unless in debug mode
-      uintptr_t r = _mi_heap_random_next(mi_prim_get_default_heap());
+      uintptr_t r = _mi_heap_random_next(mi_heap_get_default());  // initializes the thread if needed (as for the background reservation)
       start = start + ((uintptr_t)MI_HUGE_OS_PAGE_SIZE * ((r>>17) & 0x0FFF));  // (randomly 12bits)*1GiB == between 0 to 4TiB
     #endif
     }
@@ -727,3 +780,145 @@ int _mi_os_numa_node_get(void) {
   if (numa_node >= numa_count) { numa_node = numa_node % numa_count; }
   return (int)numa_node;
 }
+
+
+/* ----------------------------------------------------------------------------
+Memory pressure
+Signalled by the OS (like cgroup v2 PSI triggers on Linux, see `prim.c`),
+when the committed memory crosses the `commit_pressure_threshold`, or
+when an OS allocation or commit fails.
+While under pressure, we shorten the purge delay (or purge immediately when
+critical), and we notify the user so application caches can shrink too.
+-----------------------------------------------------------------------------*/
+
+#define MI_PRESSURE_DURATION  (2000)   // pressure lasts for 2 seconds after the last event (the PSI trigger window)
+
+static _Atomic(uintptr_t)         mi_pressure_lock;    // guards the handler and its argument as a pair
+static mi_pressure_fun*           mi_pressure_handler; // = NULL
+static void*                      mi_pressure_arg;     // = NULL
+static _Atomic(size_t)            mi_pressure_level;   // = mi_pressure_none
+static _Atomic(mi_msecs_t)        mi_pressure_expire;  // = 0
+
+static void mi_pressure_lock_acquire(void) {
+  uintptr_t expected = 0;
+  while (!mi_atomic_cas_weak_acq_rel(&mi_pressure_lock, &expected, (uintptr_t)1)) {
+    expected = 0;
+    mi_atomic_yield();
+  }
+}
+
+static void mi_pressure_lock_release(void) {
+  mi_atomic_store_release(&mi_pressure_lock, (uintptr_t)0);
+}
+
+void mi_register_pressure_handler(mi_pressure_fun* fun, void* arg) mi_attr_noexcept {
+  mi_pressure_lock_acquire();
+  mi_pressure_handler = fun;  // can be NULL
+  mi_pressure_arg = arg;
+  mi_pressure_lock_release();
+}
+
+static mi_decl_thread bool mi_pressure_recurse; // = false, are we handling pressure in this thread?
+
+// Raise the pressure level, and purge our delayed memory right away if the pressure is critical
+// (this is safe to call from within the allocator as arena and cache purges are lock-free)
+static void mi_os_pressure_raise(mi_pressure_t level, size_t size) {
+  const mi_msecs_t now = _mi_clock_now();
+  if (now > mi_atomic_loadi64_acquire(&mi_pressure_expire)) {
+    mi_atomic_store_release(&mi_pressure_level, (size_t)mi_pressure_none);  // the previous pressure has passed
+  }
+  mi_atomic_storei64_release(&mi_pressure_expire, now + MI_PRESSURE_DURATION);
+  size_t current = mi_atomic_load_relaxed(&mi_pressure_level);
+  while (current < (size_t)level && !mi_atomic_cas_weak_acq_rel(&mi_pressure_level, &current, (size_t)level)) { };
+  _mi_verbose_message("memory pressure: %s (0x%zx bytes)\n", (level == mi_pressure_critical ? "critical" : "moderate"), size);
+  // only critical pressure purges right away; otherwise the shortened purge delay takes effect
+  if (level == mi_pressure_critical) {
+    _mi_segment_cache_collect(true);
+    _mi_arenas_collect(true);
+  }
+}
+
+// Call the user handler (if any)
+static void mi_os_pressure_call_handler(mi_pressure_t level, size_t size) {
+  mi_pressure_lock_acquire();
+  mi_pressure_fun* const handler = mi_pressure_handler;
+  void* const arg = mi_pressure_arg;
+  mi_pressure_lock_release();
+  if (handler != NULL) {
+    handler(level, size, arg);
+  }
+}
+
+// Signal memory pressure from outside the allocator (like the OS pressure watch thread);
+// `size` is the size of the request that caused it (or 0).
+// Returns `false` if not signalled as we are already handling pressure in this thread.
+bool _mi_os_memory_pressure(mi_pressure_t level, size_t size) {
+  if (level == mi_pressure_none || mi_pressure_recurse) return false;
+  mi_pressure_recurse = true;
+  mi_os_pressure_raise(level, size);
+  mi_os_pressure_call_handler(level, size);
+  mi_pressure_recurse = false;
+  return true;
+}
+
+// Pressure that is detected inside the allocator (in the OS allocation and commit paths) is
+// not signalled to the user handler right away as we may be in the middle of an allocation.
+// Instead, it is pending until `_mi_os_memory_pressure_notify` is called at a safe point.
+// The pending level and size are kept as one word: `(size << 2) | level`.
+static _Atomic(size_t) mi_pressure_pending;  // = 0
+
+static bool mi_os_memory_pressure_defer(mi_pressure_t level, size_t size) {
+  if (mi_pressure_recurse) return false;
+  mi_pressure_recurse = true;
+  mi_os_pressure_raise(level, size);
+  const size_t pending = ((size > (SIZE_MAX >> 2) ? (SIZE_MAX >> 2) : size) << 2) | (size_t)level;
+  size_t current = mi_atomic_load_relaxed(&mi_pressure_pending);
+  while ((current & 3) <= (size_t)level && !mi_atomic_cas_weak_acq_rel(&mi_pressure_pending, &current, pending)) { };
+  mi_pressure_recurse = false;
+  return true;
+}
+
+// Call the user handler for pending pressure; called from `_mi_malloc_generic` and `mi_heap_collect`
+// where the heap is consistent, so the handler can allocate and free.
+void _mi_os_memory_pressure_notify(void) {
+  if mi_likely(mi_atomic_load_relaxed(&mi_pressure_pending) == 0 || mi_pressure_recurse) return;
+  const size_t pending = mi_atomic_exchange_acq_rel(&mi_pressure_pending, (size_t)0);
+  if (pending == 0) return;
+  mi_pressure_recurse = true;
+  mi_os_pressure_call_handler((mi_pressure_t)(pending & 3), pending >> 2);
+  mi_pressure_recurse = false;
+}
+
+// Called when an OS allocation or commit of `size` bytes failed: signal critical pressure,
+// which purges our delayed memory (and lets the user release memory later on), and
+// return `true` if the allocation should be tried again.
+static bool mi_os_retry_on_oom(size_t size) {
+  if (mi_option_get(mi_option_retry_on_oom) <= 0) return false;
+  return mi_os_memory_pressure_defer(mi_pressure_critical, size);
+}
+
+// Called after committing `size` bytes: signal moderate pressure if the committed
+// memory crossed the `commit_pressure_threshold` (if set).
+static void mi_os_commit_check_threshold(size_t size) {
+  const size_t threshold = mi_option_get_size(mi_option_commit_pressure_threshold);
+  if mi_likely(threshold == 0 || size == 0) return;
+  const int64_t committed = _mi_stats_main.committed.current;  // note: racy read but this is just a heuristic
+  if mi_unlikely(committed >= (int64_t)threshold && committed - (int64_t)size < (int64_t)threshold) {
+    mi_os_memory_pressure_defer(mi_pressure_moderate, size);
+  }
+}
+
+static mi_decl_noinline long mi_os_purge_delay_under_pressure(long delay) {
+  if (_mi_clock_now() > mi_atomic_loadi64_acquire(&mi_pressure_expire)) {
+    mi_atomic_store_release(&mi_pressure_level, (size_t)mi_pressure_none);  // the pressure has passed
+    return delay;
+  }
+  return (mi_atomic_load_relaxed(&mi_pressure_level) >= mi_pressure_critical ? 0 : delay / 10);
+}
+
+// The effective purge delay in milli-seconds for a given `delay` (like the `purge_delay` option)
+// (<0 = no purging allowed, 0 = immediate purging)
+long _mi_os_purge_delay(long delay) {
+  if mi_likely(delay <= 0 || mi_atomic_load_relaxed(&mi_pressure_level) == mi_pressure_none) return delay;
+  return mi_os_purge_delay_under_pressure(delay);
+}
@@ -36,8 +36,13 @@ static inline mi_block_t* mi_page_block_at(const mi_page_t* page, void* page_sta
   return (mi_block_t*)((uint8_t*)page_start + (i * block_size));
 }
 
-static void mi_page_init(mi_heap_t* heap, mi_page_t* page, size_t size, mi_tld_t* tld);
-static void mi_page_extend_free(mi_heap_t* heap, mi_page_t* page, mi_tld_t* tld);
+static bool mi_page_init(mi_heap_t* heap, mi_page_t* page, size_t size, mi_tld_t* tld);
+static bool mi_page_extend_free(mi_heap_t* heap, mi_page_t* page, mi_tld_t* tld);
+
+#define MI_RETIRE_CYCLES      (16)   // keep a retired page for N collection cycles (see `_mi_page_retire`)
+#define MI_RETIRE_LEVEL_MAX   (2)    // size classes that churn keep retired pages up to 4x longer (note: `retire_expire` has 7 bits)
+#define MI_EXTEND_LEVEL_MAX   (2)    // size classes that fill up their pages extend up to 4x more at a time (see `mi_page_extend_free`)
+#define MI_CHURN_HOT_BEATS    (4)    // a size class whose free list runs out again within N heartbeats allocates at a high rate
 
 #if (MI_DEBUG>=3)
 static size_t mi_page_list_count(mi_page_t* page, mi_block_t* head) {
@@ -123,7 +128,7 @@ bool _mi_page_is_valid(mi_page_t* page) {
   #endif
   if (mi_page_heap(page)!=NULL) {
     mi_segment_t* segment = _mi_page_segment(page);
-    mi_assert_internal(!_mi_process_is_initialized || segment->thread_id == mi_page_heap(page)->thread_id || segment->thread_id==0);
+    mi_assert_internal(!_mi_process_is_initialized || segment->thread_id == _mi_segment_owner_id(segment, mi_page_heap(page)->thread_id) || segment->thread_id==0);
     #if MI_HUGE_PAGE_ABANDON
     if (segment->page_kind != MI_PAGE_HUGE)
     #endif
@@ -250,6 +255,27 @@ void _mi_page_free_collect(mi_page_t* page, bool force) {
 
 
 
+/* -----------------------------------------------------------
+  Size class churn
+----------------------------------------------------------- */
+
+// Track the allocation rate of a size class by the number of heartbeats (calls to `_mi_malloc_generic`)
+// between two times its free list ran out. If it runs out again within a few heartbeats the size class
+// dominates the allocations of the thread and is `hot`.
+static void mi_bin_churn_update(mi_heap_t* heap, const mi_page_queue_t* pq) {
+  mi_assert_internal(pq >= heap->pages && pq - heap->pages < MI_BIN_FULL);
+  mi_bin_churn_t* const churn = &heap->bin_churn[pq - heap->pages];
+  const uint32_t beat = (uint32_t)heap->tld->heartbeat;
+  churn->hot = (beat - churn->beat <= MI_CHURN_HOT_BEATS);
+  churn->beat = beat;
+}
+
+// A hot size class retires and extends its pages as if it were one level higher
+static size_t mi_bin_churn_level(const mi_bin_churn_t* churn, size_t level, size_t level_max) {
+  return (churn->hot && level < level_max ? level + 1 : level);
+}
+
+
 /* -----------------------------------------------------------
   Page fresh and retire
 ----------------------------------------------------------- */
@@ -258,7 +284,7 @@ void _mi_page_free_collect(mi_page_t* page, bool force) {
 void _mi_page_reclaim(mi_heap_t* heap, mi_page_t* page) {
   mi_assert_expensive(mi_page_is_valid_init(page));
   mi_assert_internal(mi_page_heap(page) == heap);
-  mi_assert_internal(mi_page_thread_free_flag(page) != MI_NEVER_DELAYED_FREE);
+  mi_assert_internal(mi_page_thread_free_flag(page) != MI_NEVER_DELAYED_FREE || mi_segment_is_shared(_mi_page_segment(page)));
   #if MI_HUGE_PAGE_ABANDON
   mi_assert_internal(_mi_page_segment(page)->page_kind != MI_PAGE_HUGE);
   #endif
@@ -288,7 +314,12 @@ static mi_page_t* mi_page_fresh_alloc(mi_heap_t* heap, mi_page_queue_t* pq, size
   // a fresh page was found, initialize it
   const size_t full_block_size = (pq == NULL || mi_page_is_huge(page) ? mi_page_block_size(page) : block_size); // see also: mi_segment_huge_page_alloc
   mi_assert_internal(full_block_size >= block_size);
-  mi_page_init(heap, page, full_block_size, heap->tld);
+  if (!mi_page_init(heap, page, full_block_size, heap->tld)) {
+    // could not commit the initial blocks
+    mi_page_set_heap(page, NULL);
+    _mi_segment_page_free(page, false, _mi_heap_policy(heap), &heap->tld->segments);
+    return NULL;
+  }
   mi_heap_stat_increase(heap, pages, 1);
   if (pq != NULL) { mi_page_queue_push(heap, pq, page); }
   mi_assert_expensive(_mi_page_is_valid(page));
@@ -298,6 +329,12 @@ static mi_page_t* mi_page_fresh_alloc(mi_heap_t* heap, mi_page_queue_t* pq, size
 // Get a fresh page to use
 static mi_page_t* mi_page_fresh(mi_heap_t* heap, mi_page_queue_t* pq) {
   mi_assert_internal(mi_heap_contains_queue(heap, pq));
+  mi_bin_churn_t* const churn = &heap->bin_churn[pq - heap->pages];
+  if (churn->retire_freed) {
+    // we freed a retired page of this size class but need a fresh one again: retire longer next time
+    churn->retire_freed = false;
+    if (churn->retire_level < MI_RETIRE_LEVEL_MAX) { churn->retire_level++; }
+  }
   mi_page_t* page = mi_page_fresh_alloc(heap, pq, pq->block_size, 0);
   if (page==NULL) return NULL;
   mi_assert_internal(pq->block_size==mi_page_block_size(page));
@@ -366,6 +403,7 @@ static void mi_page_to_full(mi_page_t* page, mi_page_queue_t* pq) {
   mi_assert_internal(!mi_page_is_in_full(page));
 
   if (mi_page_is_in_full(page)) return;
+  if (mi_segment_is_shared(_mi_page_segment(page))) return;  // never delayed freed so it would not be unfull'ed on a free
   mi_page_queue_enqueue_from(&mi_page_heap(page)->pages[MI_BIN_FULL], pq, page);
   _mi_page_free_collect(page,false);  // try to collect right away in case another thread freed just before MI_USE_DELAYED_FREE was set
 }
@@ -374,7 +412,7 @@ static void mi_page_to_full(mi_page_t* page, mi_page_queue_t* pq) {
 // Abandon a page with used blocks at the end of a thread.
 // Note: only call if it is ensured that no references exist from
 // the `page->heap->thread_delayed_free` into this page.
-// Currently only called through `mi_heap_collect_ex` which ensures this.
+// Currently only called through `mi_heap_collect_mode` which ensures this.
 void _mi_page_abandon(mi_page_t* page, mi_page_queue_t* pq) {
   mi_assert_internal(page != NULL);
   mi_assert_expensive(_mi_page_is_valid(page));
@@ -438,16 +476,16 @@ void _mi_page_free(mi_page_t* page, mi_page_queue_t* pq, bool force) {
 
   // remove from the page list
   // (no need to do _mi_heap_delayed_free first as all blocks are already free)
-  mi_segments_tld_t* segments_tld = &mi_page_heap(page)->tld->segments;
+  mi_heap_t* const heap = mi_page_heap(page);
+  mi_segments_tld_t* segments_tld = &heap->tld->segments;
   mi_page_queue_remove(pq, page);
 
   // and free it
   mi_page_set_heap(page,NULL);
-  _mi_segment_page_free(page, force, segments_tld);
+  _mi_segment_page_free(page, force, _mi_heap_policy(heap), segments_tld);
 }
 
 #define MI_MAX_RETIRE_SIZE    MI_LARGE_OBJ_SIZE_MAX   // should be less than size for MI_BIN_HUGE
-#define MI_RETIRE_CYCLES      (16)
 
 // Retire a page with no more used blocks
 // Important to not retire too quickly though as new
@@ -462,6 +500,10 @@ void _mi_page_retire(mi_page_t* page) mi_attr_noexcept {
 
   mi_page_set_has_aligned(page, false);
 
+  // the page was never fully extended: extend pages of this size class in smaller steps again
+  mi_bin_churn_t* const churn = &mi_page_heap(page)->bin_churn[mi_bin(mi_page_block_size(page))];
+  if (page->capacity < page->reserved && churn->extend_level > 0) { churn->extend_level--; }
+
   // don't retire too often..
   // (or we end up retiring and re-allocating most of the time)
   // NOTE: refine this more: we should not retire if this
@@ -474,11 +516,12 @@ void _mi_page_retire(mi_page_t* page) mi_attr_noexcept {
   if mi_likely( /* bsize < MI_MAX_RETIRE_SIZE && */ !mi_page_queue_is_special(pq)) {  // not full or huge queue?
     if (pq->last==page && pq->first==page) { // the only page in the queue?
       mi_stat_counter_increase(_mi_stats_main.page_no_retire,1);
-      page->retire_expire = (bsize <= MI_SMALL_OBJ_SIZE_MAX ? MI_RETIRE_CYCLES : MI_RETIRE_CYCLES/4);
       mi_heap_t* heap = mi_page_heap(page);
       mi_assert_internal(pq >= heap->pages);
       const size_t index = pq - heap->pages;
       mi_assert_internal(index < MI_BIN_FULL && index < MI_BIN_HUGE);
+      const mi_bin_churn_t* const churn = &heap->bin_churn[index];
+      page->retire_expire = (bsize <= MI_SMALL_OBJ_SIZE_MAX ? MI_RETIRE_CYCLES : MI_RETIRE_CYCLES/4) << mi_bin_churn_level(churn, churn->retire_level, MI_RETIRE_LEVEL_MAX);
       if (index < heap->page_retired_min) heap->page_retired_min = index;
       if (index > heap->page_retired_max) heap->page_retired_max = index;
       mi_assert_internal(mi_page_all_free(page));
@@ -501,6 +544,12 @@ void _mi_heap_collect_retired(mi_heap_t* heap, bool force) {
       if (mi_page_all_free(page)) {
         page->retire_expire--;
         if (force || page->retire_expire == 0) {
+          mi_bin_churn_t* const churn = &heap->bin_churn[bin];
+          if (churn->retire_freed && churn->retire_level > 0) {
+            // no fresh page was needed since the last retired page was freed: retire sooner
+            churn->retire_level--;
+          }
+          churn->retire_freed = true;
           _mi_page_free(pq->first, pq, force);
         }
         else {
@@ -528,6 +577,7 @@ void _mi_heap_collect_retired(mi_heap_t* heap, bool force) {
 #define MI_MAX_SLICE_SHIFT  (6)   // at most 64 slices
 #define MI_MAX_SLICES       (1UL << MI_MAX_SLICE_SHIFT)
 #define MI_MIN_SLICES       (2)
+#define MI_EXTEND_RANDOM_WORDS  (16)  // random words drawn at once (enough for 128 blocks)
 
 static void mi_page_free_list_extend_secure(mi_heap_t* const heap, mi_page_t* const page, const size_t bsize, const size_t extend, mi_stats_t* const stats) {
   MI_UNUSED(stats);
@@ -556,20 +606,23 @@ static void mi_page_free_list_extend_secure(mi_heap_t* const heap, mi_page_t* co
   }
   counts[slice_count-1] += (extend % slice_count);  // final slice holds the modulus too (todo: distribute evenly?)
 
-  // and initialize the free list by randomly threading through them
+  // and initialize the free list by randomly threading through them;
+  // the random bytes are drawn in batches of `MI_EXTEND_RANDOM_WORDS` words (one byte per block)
+  uintptr_t rnd[MI_EXTEND_RANDOM_WORDS];
+  const size_t rnd_words = _mi_divide_up(extend, MI_INTPTR_SIZE);
+  const size_t rnd_count = (rnd_words < MI_EXTEND_RANDOM_WORDS ? rnd_words : MI_EXTEND_RANDOM_WORDS);
+  _mi_random_fill(&heap->random, rnd, rnd_count);
   // set up first element
-  const uintptr_t r = _mi_heap_random_next(heap);
-  size_t current = r % slice_count;
+  size_t current = rnd[0] % slice_count;
   counts[current]--;
   mi_block_t* const free_start = blocks[current];
-  // and iterate through the rest; use `random_shuffle` for performance
-  uintptr_t rnd = _mi_random_shuffle(r|1); // ensure not 0
+  // and iterate through the rest
   for (size_t i = 1; i < extend; i++) {
-    // call random_shuffle only every INTPTR_SIZE rounds
-    const size_t round = i%MI_INTPTR_SIZE;
-    if (round == 0) rnd = _mi_random_shuffle(rnd);
+    const size_t idx = i % (MI_EXTEND_RANDOM_WORDS*MI_INTPTR_SIZE);
+    if (idx == 0) { _mi_random_fill(&heap->random, rnd, rnd_count); }
     // select a random next slice index
-    size_t next = ((rnd >> 8*round) & (slice_count-1));
+    const size_t round = idx % MI_INTPTR_SIZE;
+    size_t next = ((rnd[idx / MI_INTPTR_SIZE] >> 8*round) & (slice_count-1));
     while (counts[next]==0) {                            // ensure it still has space
       next++;
       if (next==slice_count) next = 0;
@@ -616,7 +669,7 @@ static mi_decl_noinline void mi_page_free_list_extend( mi_page_t* const page, co
   Page initialize and extend the capacity
 ----------------------------------------------------------- */
 
-#define MI_MAX_EXTEND_SIZE    (4*1024)      // heuristic, one OS page seems to work well.
+#define MI_MAX_EXTEND_SIZE    (4*1024)      // heuristic, one OS page seems to work well (but see `extend_level`)
 #if (MI_SECURE>0)
 #define MI_MIN_EXTEND         (8*MI_SECURE) // extend at least by this many
 #else
@@ -628,14 +681,15 @@ static mi_decl_noinline void mi_page_free_list_extend( mi_page_t* const page, co
 // Note: we also experimented with "bump" allocation on the first
 // allocations but this did not speed up any benchmark (due to an
 // extra test in malloc? or cache effects?)
-static void mi_page_extend_free(mi_heap_t* heap, mi_page_t* page, mi_tld_t* tld) {
+// Returns `false` if the memory for the new blocks could not be committed.
+static bool mi_page_extend_free(mi_heap_t* heap, mi_page_t* page, mi_tld_t* tld) {
   mi_assert_expensive(mi_page_is_valid_init(page));
   #if (MI_SECURE<=2)
   mi_assert(page->free == NULL);
   mi_assert(page->local_free == NULL);
-  if (page->free != NULL) return;
+  if (page->free != NULL) return true;
   #endif
-  if (page->capacity >= page->reserved) return;
+  if (page->capacity >= page->reserved) return true;
 
   size_t page_size;
   //uint8_t* page_start =
@@ -647,7 +701,10 @@ static void mi_page_extend_free(mi_heap_t* heap, mi_page_t* page, mi_tld_t* tld)
   size_t extend = page->reserved - page->capacity;
   mi_assert_internal(extend > 0);
 
-  size_t max_extend = (bsize >= MI_MAX_EXTEND_SIZE ? MI_MIN_EXTEND : MI_MAX_EXTEND_SIZE/bsize);
+  // size classes that keep filling up their pages are extended in larger steps to take the slow path less often
+  mi_bin_churn_t* const churn = &heap->bin_churn[mi_bin(bsize)];
+  const size_t max_extend_size = (size_t)MI_MAX_EXTEND_SIZE << mi_bin_churn_level(churn, churn->extend_level, MI_EXTEND_LEVEL_MAX);
+  size_t max_extend = (bsize >= max_extend_size ? MI_MIN_EXTEND : max_extend_size/bsize);
   if (max_extend < MI_MIN_EXTEND) { max_extend = MI_MIN_EXTEND; }
   mi_assert_internal(max_extend > 0);
 
@@ -656,10 +713,19 @@ static void mi_page_extend_free(mi_heap_t* heap, mi_page_t* page, mi_tld_t* tld)
     // the `lean` benchmark tests this. Going from 1 to 8 increases rss by 50%.
     extend = max_extend;
   }
+  else if (page->capacity > 0 && churn->extend_level < MI_EXTEND_LEVEL_MAX) {
+    // the page is now fully extended in multiple steps
+    churn->extend_level++;
+  }
 
   mi_assert_internal(extend > 0 && extend + page->capacity <= page->reserved);
   mi_assert_internal(extend < (1UL<<16));
 
+  // medium and large pages may be committed on demand (see `_mi_segment_page_commit`)
+  bool is_zero = true;
+  if (!_mi_segment_page_commit(page, (page->capacity + extend) * bsize, &is_zero)) return false;
+  if (!is_zero) { page->free_is_zero = false; }
+
   // and append the extend the free list
   if (extend < MI_MIN_SLICES || MI_SECURE==0) { //!mi_option_is_enabled(mi_option_secure)) {
     mi_page_free_list_extend(page, bsize, extend, &tld->stats );
@@ -671,10 +737,12 @@ static void mi_page_extend_free(mi_heap_t* heap, mi_page_t* page, mi_tld_t* tld)
   page->capacity += (uint16_t)extend;
   mi_stat_increase(tld->stats.page_committed, extend * bsize);
   mi_assert_expensive(mi_page_is_valid_init(page));
+  return true;
 }
 
 // Initialize a fresh page
-static void mi_page_init(mi_heap_t* heap, mi_page_t* page, size_t block_size, mi_tld_t* tld) {
+// Returns `false` if the initial free list could not be committed.
+static bool mi_page_init(mi_heap_t* heap, mi_page_t* page, size_t block_size, mi_tld_t* tld) {
   mi_assert(page != NULL);
   mi_segment_t* segment = _mi_page_segment(page);
   mi_assert(segment != NULL);
@@ -695,8 +763,14 @@ static void mi_page_init(mi_heap_t* heap, mi_page_t* page, size_t block_size, mi
   page->free_is_zero = page->is_zero_init;
   #if MI_DEBUG>2
   if (page->is_zero_init) {
-    mi_track_mem_defined(page->page_start, page_size);
-    mi_assert_expensive(mi_mem_is_zero(page->page_start, page_size));
+    // only the first commit chunk is guaranteed to be committed at this point, and the
+    // page start can be past it due to block alignment so we commit the chunk we check.
+    size_t check_size = MI_COMMIT_CHUNK_SIZE - ((uintptr_t)page->page_start % MI_COMMIT_CHUNK_SIZE);
+    if (check_size > page_size) { check_size = page_size; }
+    if (_mi_segment_page_commit(page, check_size, NULL)) {
+      mi_track_mem_defined(page->page_start, check_size);
+      mi_assert_expensive(mi_mem_is_zero(page->page_start, check_size));
+    }
   }
   #endif
   if (block_size > 0 && _mi_is_power_of_two(block_size)) {
@@ -721,9 +795,15 @@ static void mi_page_init(mi_heap_t* heap, mi_page_t* page, size_t block_size, mi
   mi_assert_internal(page->block_size_shift == 0 || (block_size == ((size_t)1 << page->block_size_shift)));
   mi_assert_expensive(mi_page_is_valid_init(page));
 
+  // frees from other processes into shared memory cannot use the (process local) heap delayed free list
+  if (mi_segment_is_shared(segment)) {
+    _mi_page_use_delayed_free(page, MI_NEVER_DELAYED_FREE, false);
+  }
+
   // initialize an initial free list
-  mi_page_extend_free(heap,page,tld);
+  if (!mi_page_extend_free(heap,page,tld)) return false;
   mi_assert(mi_page_immediate_available(page));
+  return true;
 }
 
 
@@ -817,7 +897,9 @@ static mi_page_t* mi_page_queue_find_free_ex(mi_heap_t* heap, mi_page_queue_t* p
   }
   if (page != NULL && !mi_page_immediate_available(page)) {
     mi_assert_internal(mi_page_is_expandable(page));
-    mi_page_extend_free(heap, page, heap->tld);
+    if (!mi_page_extend_free(heap, page, heap->tld)) {
+      page = NULL;  // out of memory; try a fresh page instead
+    }
   }
 
   if (page == NULL) {
@@ -845,14 +927,16 @@ static mi_page_t* mi_page_queue_find_free_ex(mi_heap_t* heap, mi_page_queue_t* p
 // Find a page with free blocks of `size`.
 static inline mi_page_t* mi_find_free_page(mi_heap_t* heap, size_t size) {
   mi_page_queue_t* pq = mi_page_queue(heap, size);
+  mi_bin_churn_update(heap, pq);
 
   // check the first page: we even do this with candidate search or otherwise we re-search every time
   mi_page_t* page = pq->first;
   if (page != NULL) {
    #if (MI_SECURE>=3) // in secure mode, we extend half the time to increase randomness
     if (page->capacity < page->reserved && ((_mi_heap_random_next(heap) & 1) == 1)) {
-      mi_page_extend_free(heap, page, heap->tld);
-      mi_assert_internal(mi_page_immediate_available(page));
+      if (mi_page_extend_free(heap, page, heap->tld)) {
+        mi_assert_internal(mi_page_immediate_available(page));
+      }
     }
     else
    #endif
@@ -952,6 +1036,51 @@ static mi_page_t* mi_find_page(mi_heap_t* heap, size_t size, size_t huge_alignme
   }
 }
 
+/* -----------------------------------------------------------
+  Guarded sampling
+  The fast path does not count allocations for guarded sampling. Instead, when
+  we are in the slow path, we reserve the current block plus at most
+  `guarded_sample_count` blocks of the page free list for the fast path (and count
+  those down). The remaining blocks are moved to the `local_free` list which is only
+  collected in the slow path. Once the count reaches zero, the next allocation
+  in the size range that comes through here is guarded. Until then, pages that
+  cannot serve such allocation are left to the fast path (like rewinding the count
+  to 1 on a size miss when counting in the fast path).
+----------------------------------------------------------- */
+
+#if MI_GUARDED_SAMPLING
+// Can the page serve allocations in the guarded size range of the heap?
+static bool mi_heap_guarded_page_in_range(const mi_heap_t* heap, const mi_page_t* page) {
+  const size_t bsize = mi_page_block_size(page);
+  if (bsize < heap->guarded_size_min) return false;
+  const uint8_t bin = _mi_bin(bsize);
+  const size_t size_lo = (bin <= 1 ? 0 : heap->pages[bin-1].block_size + 1);  // smallest size served by this page
+  return (size_lo <= heap->guarded_size_max);
+}
+
+static mi_decl_noinline void mi_heap_guarded_reserve(mi_heap_t* heap, mi_page_t* page) {
+  mi_assert_internal(heap->guarded_sample_rate != 0);
+  mi_assert_internal(page->free != NULL);
+  size_t count = heap->guarded_sample_count;
+  if (count == 0 && !mi_heap_guarded_page_in_range(heap, page)) return;  // a sample is due but not from this page
+  // the first block is for the current allocation
+  mi_block_t* last = page->free;
+  mi_block_t* next;
+  while (count > 0 && (next = mi_block_next(page, last)) != NULL) {
+    last = next;
+    count--;
+  }
+  heap->guarded_sample_count = count;
+  // move the rest to the front of the local free list; to do this in constant time the current
+  // local free blocks are appended to the reserved blocks instead (which can delay a sample by at most a page)
+  mi_block_t* const rest = mi_block_next(page, last);
+  if mi_unlikely(rest != NULL) {
+    mi_block_set_next(page, last, page->local_free);
+    page->local_free = rest;
+  }
+}
+#endif
+
 // Generic allocation routine if the fast path (`alloc.c:mi_page_malloc`) does not succeed.
 // Note: in debug mode the size includes MI_PADDING_SIZE and might have overflowed.
 // The `huge_alignment` is normally 0 but is set to a multiple of MI_SEGMENT_SIZE for
@@ -967,12 +1096,26 @@ void* _mi_malloc_generic(mi_heap_t* heap, size_t size, bool zero, size_t huge_al
   }
   mi_assert_internal(mi_heap_is_initialized(heap));
 
-  // call potential deferred free routines
+  // call potential deferred free routines (and a memory pressure handler if pressure is pending)
   _mi_deferred_free(heap, false);
+  _mi_os_memory_pressure_notify();
+
+  // trim the heaps of the thread if it was idle for a while
+  _mi_thread_idle_check(heap->tld);
 
   // free delayed frees from other threads (but skip contended ones)
   _mi_heap_delayed_free_partial(heap);
 
+  // reclaim an abandoned segment we freed into (see `segment.c:_mi_segment_reclaim_hint`)
+  _mi_segment_reclaim_hinted(heap);
+
+  #if MI_GUARDED_SAMPLING
+  // allocate a guarded object if a sample is due
+  if mi_unlikely(huge_alignment == 0 && mi_heap_guarded_sample_due(heap, size - MI_PADDING_SIZE)) {
+    return _mi_heap_malloc_guarded(heap, size - MI_PADDING_SIZE, zero);
+  }
+  #endif
+
   // find (or allocate) a page of the right size
   mi_page_t* page = mi_find_page(heap, size, huge_alignment);
   if mi_unlikely(page == NULL) { // first time out of memory, try to collect and retry the allocation once more
@@ -989,13 +1132,26 @@ void* _mi_malloc_generic(mi_heap_t* heap, size_t size, bool zero, size_t huge_al
   mi_assert_internal(mi_page_immediate_available(page));
   mi_assert_internal(mi_page_block_size(page) >= size);
 
+  #if MI_GUARDED_SAMPLING
+  if mi_unlikely(heap->guarded_sample_rate != 0) {
+    mi_heap_guarded_reserve(heap, page);
+  }
+  #endif
+
   // and try again, this time succeeding! (i.e. this should never recurse through _mi_page_malloc)
   void* p;
   if mi_unlikely(zero && mi_page_is_huge(page)) {
     // note: we cannot call _mi_page_malloc with zeroing for huge blocks; we zero it afterwards in that case.
     p = _mi_page_malloc(heap, page, size);
     mi_assert_internal(p != NULL);
-    _mi_memzero_aligned(p, mi_page_usable_block_size(page));
+    if (page->free_is_zero) {
+      // fresh (or purged) memory: only the free list pointer may be non-zero
+      ((mi_block_t*)p)->next = 0;
+      mi_track_mem_defined(p, mi_page_usable_block_size(page));
+    }
+    else {
+      _mi_memzero_large(p, mi_page_usable_block_size(page));
+    }
   }
   else {
     p = _mi_page_malloc_zero(heap, page, size, zero);
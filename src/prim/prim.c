@@ -61,6 +61,64 @@ terms of the MIT license. A copy of the license can be found in the file
 #endif
 #endif
 
+// Generic helper threads (using pthreads on unix and emscripten)
+#ifndef MI_PRIM_HAS_THREAD_START
+#if defined(MI_USE_PTHREADS)
+
+typedef struct mi_prim_thread_start_s {
+  _Atomic(uintptr_t)    busy;   // claimed until the started thread has read `fn` and `arg`
+  mi_prim_thread_fun_t* fn;
+  void* arg;
+} mi_prim_thread_start_t;
+
+#define MI_PRIM_THREADS_MAX  (4)   // we only start a few helper threads (see `arena.c` and the memory pressure watch)
+static mi_prim_thread_start_t mi_prim_thread_starts[MI_PRIM_THREADS_MAX];
+
+// Claim a free start slot; it is released by the started thread once it has read `fn` and `arg`
+static mi_prim_thread_start_t* mi_prim_thread_start_claim(mi_prim_thread_fun_t* fn, void* arg) {
+  for (size_t i = 0; i < MI_PRIM_THREADS_MAX; i++) {
+    mi_prim_thread_start_t* const start = &mi_prim_thread_starts[i];
+    uintptr_t expected = 0;
+    if (mi_atomic_cas_strong_acq_rel(&start->busy, &expected, (uintptr_t)1)) {
+      start->fn = fn;
+      start->arg = arg;
+      return start;
+    }
+  }
+  return NULL;
+}
+
+static void* mi_pthread_start(void* vstart) {
+  mi_prim_thread_start_t* start = (mi_prim_thread_start_t*)vstart;
+  mi_prim_thread_fun_t* const fn = start->fn;
+  void* const arg = start->arg;
+  mi_atomic_store_release(&start->busy, (uintptr_t)0);
+  fn(arg);
+  return NULL;
+}
+
+bool _mi_prim_thread_start(mi_prim_thread_fun_t* fn, void* arg) {
+  mi_prim_thread_start_t* const start = mi_prim_thread_start_claim(fn, arg);
+  if (start == NULL) return false;
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, &mi_pthread_start, start) != 0) {
+    mi_atomic_store_release(&start->busy, (uintptr_t)0);
+    return false;
+  }
+  pthread_detach(thread);
+  return true;
+}
+
+#else
+
+bool _mi_prim_thread_start(mi_prim_thread_fun_t* fn, void* arg) {
+  MI_UNUSED(fn); MI_UNUSED(arg);
+  return false;
+}
+
+#endif
+#endif
+
 // Generic allocator init/done callback 
 #ifndef MI_PRIM_HAS_ALLOCATOR_INIT
 bool _mi_is_redirected(void) {
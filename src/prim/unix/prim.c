@@ -104,6 +104,74 @@ static inline int mi_prim_access(const char *fpath, int mode) {
 
 
 
+//---------------------------------------------
+// cgroup v2 (Linux)
+// (only read when watching for memory pressure)
+//---------------------------------------------
+
+#if defined(__linux__) && defined(MI_USE_PTHREADS)
+
+#define MI_CGROUP_PATH_MAX  (512)
+
+// Get the cgroup v2 directory of this process (like `/sys/fs/cgroup/kubepods/pod1`)
+static bool mi_cgroup_dir(char* dir, size_t dir_size) {
+  // find the `0::<path>` line (there can be cgroup v1 lines before it on hybrid systems)
+  int fd = mi_prim_open("/proc/self/cgroup", O_RDONLY);
+  if (fd < 0) return false;
+  char buf[1024];
+  ssize_t nread = mi_prim_read(fd, buf, sizeof(buf) - 1);
+  mi_prim_close(fd);
+  if (nread <= 0) return false;
+  buf[nread] = 0;
+  char* path = NULL;
+  for (char* line = buf; *line != 0; ) {
+    char* eol = line;
+    while (*eol != 0 && *eol != '\n') { eol++; }
+    if (line[0] == '0' && line[1] == ':' && line[2] == ':') {
+      *eol = 0;
+      path = line + 3;
+      break;
+    }
+    line = (*eol == 0 ? eol : eol + 1);
+  }
+  if (path == NULL) return false;
+  // the unified hierarchy is mounted at `/sys/fs/cgroup` (or at `/sys/fs/cgroup/unified` on hybrid systems)
+  _mi_strlcpy(dir, (mi_prim_access("/sys/fs/cgroup/cgroup.controllers", R_OK) == 0 ? "/sys/fs/cgroup" : "/sys/fs/cgroup/unified"), dir_size);
+  if (!(path[0] == '/' && path[1] == 0)) { _mi_strlcat(dir, path, dir_size); }
+  return true;
+}
+
+static int mi_cgroup_open(const char* dir, const char* fname, int open_flags) {
+  char fpath[MI_CGROUP_PATH_MAX];
+  _mi_strlcpy(fpath, dir, sizeof(fpath));
+  _mi_strlcat(fpath, fname, sizeof(fpath));
+  return mi_prim_open(fpath, open_flags);
+}
+
+// Read a memory limit like `memory.high`; returns 0 if there is no limit (`max`)
+static size_t mi_cgroup_read_limit(const char* dir, const char* fname) {
+  int fd = mi_cgroup_open(dir, fname, O_RDONLY);
+  if (fd < 0) return 0;
+  char buf[32];
+  ssize_t nread = mi_prim_read(fd, buf, sizeof(buf));
+  mi_prim_close(fd);
+  size_t limit = 0;
+  for (ssize_t i = 0; i < nread && buf[i] >= '0' && buf[i] <= '9'; i++) {
+    limit = 10*limit + (size_t)(buf[i] - '0');
+  }
+  return limit;
+}
+
+// The smallest of the `memory.high` and `memory.max` limits, or 0 if there is none
+static size_t mi_cgroup_memory_limit(const char* dir) {
+  const size_t high = mi_cgroup_read_limit(dir, "/memory.high");
+  const size_t max  = mi_cgroup_read_limit(dir, "/memory.max");
+  return (high == 0 || (max != 0 && max < high) ? max : high);
+}
+
+#endif
+
+
 //---------------------------------------------
 // init
 //---------------------------------------------
@@ -151,6 +219,9 @@ void _mi_prim_mem_init( mi_os_mem_config_t* config )
   config->has_overcommit = unix_detect_overcommit();
   config->has_partial_free = true;    // mmap can free in parts
   config->has_virtual_reserve = true; // todo: check if this true for NetBSD?  (for anonymous mmap with PROT_NONE)
+  #if defined(__linux__)
+  config->has_decommit_zero = true;   // `MADV_DONTNEED` zero-fills private anonymous memory on the next access
+  #endif
 
   // disable transparent huge pages for this process?
   #if (defined(__linux__) || defined(__ANDROID__)) && defined(PR_GET_THP_DISABLE)
@@ -455,6 +526,12 @@ int _mi_prim_protect(void* start, size_t size, bool protect) {
   return err;
 }
 
+int _mi_prim_lock(void* start, size_t size) {
+  int err = mlock(start, size);
+  if (err != 0) { err = errno; }
+  return err;
+}
+
 
 
 //---------------------------------------------
@@ -888,3 +965,111 @@ void _mi_prim_thread_associate_default_heap(mi_heap_t* heap) {
 }
 
 #endif
+
+//----------------------------------------------------------------
+// Memory pressure
+// On Linux we use a cgroup v2 PSI trigger on `memory.pressure`, and
+// watch `memory.events` for the `high` and `max` limits being hit.
+//----------------------------------------------------------------
+
+#if defined(__linux__) && defined(MI_USE_PTHREADS)
+#include <poll.h>
+
+#define MI_PSI_TRIGGER  "some 200000 2000000"   // 200ms of stalls in a 2s window (unprivileged triggers need a multiple of 2s)
+
+static int mi_pressure_psi_fd    = -1;
+static int mi_pressure_events_fd = -1;
+
+// Read the `high` and `max` event counts from `memory.events`
+static void mi_cgroup_read_events(int fd, size_t* high, size_t* max) {
+  char buf[256];
+  ssize_t nread = pread(fd, buf, sizeof(buf) - 1, 0);  // also re-arms the poll notification
+  if (nread <= 0) return;
+  buf[nread] = 0;
+  for (const char* line = buf; *line != 0; ) {
+    size_t* count = NULL;
+    if (line[0] == 'h' && line[1] == 'i' && line[2] == 'g' && line[3] == 'h' && line[4] == ' ') { count = high; line += 5; }
+    else if (line[0] == 'm' && line[1] == 'a' && line[2] == 'x' && line[3] == ' ') { count = max; line += 4; }
+    size_t n = 0;
+    while (*line >= '0' && *line <= '9') { n = 10*n + (size_t)(*line - '0'); line++; }
+    if (count != NULL) { *count = n; }
+    while (*line != 0 && *line != '\n') { line++; }
+    if (*line == '\n') { line++; }
+  }
+}
+
+static void mi_memory_pressure_watch(void* arg) {
+  MI_UNUSED(arg);
+  struct pollfd fds[2];
+  fds[0].fd = mi_pressure_psi_fd;    fds[0].events = POLLPRI;  // a negative fd is ignored by `poll`
+  fds[1].fd = mi_pressure_events_fd; fds[1].events = POLLPRI;
+  size_t high = 0;
+  size_t max = 0;
+  if (mi_pressure_events_fd >= 0) { mi_cgroup_read_events(mi_pressure_events_fd, &high, &max); }
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    mi_pressure_t level = mi_pressure_none;
+    if ((fds[0].revents & POLLERR) != 0) break;            // the PSI trigger is gone (the cgroup was removed)
+    if ((fds[0].revents & POLLPRI) != 0) { level = mi_pressure_moderate; }
+    if ((fds[1].revents & POLLPRI) != 0) {                 // `memory.events` changed
+      const size_t prev_high = high;
+      const size_t prev_max = max;
+      mi_cgroup_read_events(mi_pressure_events_fd, &high, &max);
+      if (max > prev_max) { level = mi_pressure_critical; }
+      else if (high > prev_high && level == mi_pressure_none) { level = mi_pressure_moderate; }
+    }
+    if (level != mi_pressure_none) {
+      _mi_os_memory_pressure(level, 0);
+    }
+  }
+  _mi_verbose_message("stopped watching for memory pressure events\n");
+}
+
+bool _mi_prim_memory_pressure_watch(void) {
+  char dir[MI_CGROUP_PATH_MAX];
+  if (!mi_cgroup_dir(dir, sizeof(dir))) return false;
+  // create a PSI trigger (this requires write access to the cgroup)
+  mi_pressure_psi_fd = mi_cgroup_open(dir, "/memory.pressure", O_RDWR | O_NONBLOCK);
+  if (mi_pressure_psi_fd >= 0 && write(mi_pressure_psi_fd, MI_PSI_TRIGGER, sizeof(MI_PSI_TRIGGER)) < 0) {
+    mi_prim_close(mi_pressure_psi_fd);
+    mi_pressure_psi_fd = -1;
+  }
+  // and watch the `memory.events` (which is read-only and usually accessible)
+  mi_pressure_events_fd = mi_cgroup_open(dir, "/memory.events", O_RDONLY);
+  if (mi_pressure_psi_fd < 0 && mi_pressure_events_fd < 0) return false;
+  _mi_verbose_message("watching for memory pressure events in %s (%s%s)\n", dir,
+                      (mi_pressure_psi_fd >= 0 ? "memory.pressure " : ""), (mi_pressure_events_fd >= 0 ? "memory.events" : ""));
+  const size_t limit = mi_cgroup_memory_limit(dir);
+  if (limit > 0) { _mi_verbose_message("cgroup memory limit: %zu MiB\n", limit / MI_MiB); }
+  return _mi_prim_thread_start(&mi_memory_pressure_watch, NULL);
+}
+
+#else
+
+bool _mi_prim_memory_pressure_watch(void) {
+  return false;
+}
+
+#endif
+
+
+//----------------------------------------------------------------
+// Fork
+//----------------------------------------------------------------
+
+#if defined(MI_USE_PTHREADS)
+
+bool _mi_prim_fork_handlers_install(void) {
+  return (pthread_atfork(&_mi_fork_prepare, &_mi_fork_parent, &_mi_fork_child) == 0);
+}
+
+#else
+
+bool _mi_prim_fork_handlers_install(void) {
+  return false;
+}
+
+#endif
@@ -24,6 +24,7 @@ void _mi_prim_mem_init( mi_os_mem_config_t* config ) {
   config->has_overcommit = false;
   config->has_partial_free = false;
   config->has_virtual_reserve = false;
+  config->has_decommit_zero = false;
 }
 
 //---------------------------------------------
@@ -154,6 +155,11 @@ int _mi_prim_protect(void* addr, size_t size, bool protect) {
   return 0;
 }
 
+int _mi_prim_lock(void* addr, size_t size) {
+  MI_UNUSED(addr); MI_UNUSED(size);
+  return 0;
+}
+
 
 //---------------------------------------------
 // Huge pages and NUMA nodes
@@ -277,3 +283,21 @@ void _mi_prim_thread_done_auto_done(void) {
 void _mi_prim_thread_associate_default_heap(mi_heap_t* heap) {
   MI_UNUSED(heap);
 }
+
+
+//----------------------------------------------------------------
+// Memory pressure
+//----------------------------------------------------------------
+
+bool _mi_prim_memory_pressure_watch(void) {
+  return false;
+}
+
+
+//----------------------------------------------------------------
+// Fork
+//----------------------------------------------------------------
+
+bool _mi_prim_fork_handlers_install(void) {
+  return false;
+}
@@ -116,6 +116,7 @@ void _mi_prim_mem_init( mi_os_mem_config_t* config )
   config->has_overcommit = false;
   config->has_partial_free = false;
   config->has_virtual_reserve = true;
+  config->has_decommit_zero = true;   // `MEM_COMMIT` of decommitted pages zero initializes them
   // get the page size
   SYSTEM_INFO si;
   GetSystemInfo(&si);
@@ -358,6 +359,11 @@ int _mi_prim_protect(void* addr, size_t size, bool protect) {
   return (ok ? 0 : (int)GetLastError());
 }
 
+int _mi_prim_lock(void* addr, size_t size) {
+  BOOL ok = VirtualLock(addr, size);
+  return (ok ? 0 : (int)GetLastError());
+}
+
 
 //---------------------------------------------
 // Huge page allocation
@@ -779,6 +785,55 @@ static void NTAPI mi_win_main(PVOID module, DWORD reason, LPVOID reserved) {
   }
 #endif
 
+//----------------------------------------------------------------
+// Helper threads
+//----------------------------------------------------------------
+
+#define MI_PRIM_HAS_THREAD_START 1
+
+typedef struct mi_prim_thread_start_s {
+  _Atomic(uintptr_t)    busy;   // claimed until the started thread has read `fn` and `arg`
+  mi_prim_thread_fun_t* fn;
+  void* arg;
+} mi_prim_thread_start_t;
+
+#define MI_PRIM_THREADS_MAX  (4)   // we only start a few helper threads (see `arena.c` and the memory pressure watch)
+static mi_prim_thread_start_t mi_prim_thread_starts[MI_PRIM_THREADS_MAX];
+
+static mi_prim_thread_start_t* mi_prim_thread_start_claim(mi_prim_thread_fun_t* fn, void* arg) {
+  for (size_t i = 0; i < MI_PRIM_THREADS_MAX; i++) {
+    mi_prim_thread_start_t* const start = &mi_prim_thread_starts[i];
+    uintptr_t expected = 0;
+    if (mi_atomic_cas_strong_acq_rel(&start->busy, &expected, (uintptr_t)1)) {
+      start->fn = fn;
+      start->arg = arg;
+      return start;
+    }
+  }
+  return NULL;
+}
+
+static DWORD WINAPI mi_win_thread_start(LPVOID vstart) {
+  mi_prim_thread_start_t* start = (mi_prim_thread_start_t*)vstart;
+  mi_prim_thread_fun_t* const fn = start->fn;
+  void* const arg = start->arg;
+  mi_atomic_store_release(&start->busy, (uintptr_t)0);
+  fn(arg);
+  return 0;
+}
+
+bool _mi_prim_thread_start(mi_prim_thread_fun_t* fn, void* arg) {
+  mi_prim_thread_start_t* const start = mi_prim_thread_start_claim(fn, arg);
+  if (start == NULL) return false;
+  HANDLE thread = CreateThread(NULL, 0, &mi_win_thread_start, start, 0, NULL);
+  if (thread == NULL) {
+    mi_atomic_store_release(&start->busy, (uintptr_t)0);
+    return false;
+  }
+  CloseHandle(thread);
+  return true;
+}
+
 // ----------------------------------------------------
 // Communicate with the redirection module on Windows
 // ----------------------------------------------------
@@ -823,3 +878,34 @@ static void NTAPI mi_win_main(PVOID module, DWORD reason, LPVOID reserved) {
     mi_allocator_done();
   }
 #endif
+
+
+//----------------------------------------------------------------
+// Memory pressure
+// We wait on the low memory resource notification of the system.
+//----------------------------------------------------------------
+
+static HANDLE mi_low_memory_notification;
+
+static void mi_memory_pressure_watch(void* arg) {
+  MI_UNUSED(arg);
+  while (WaitForSingleObject(mi_low_memory_notification, INFINITE) == WAIT_OBJECT_0) {
+    _mi_os_memory_pressure(mi_pressure_moderate, 0);
+    Sleep(2000);  // the notification stays signaled as long as memory is low
+  }
+}
+
+bool _mi_prim_memory_pressure_watch(void) {
+  mi_low_memory_notification = CreateMemoryResourceNotification(LowMemoryResourceNotification);
+  if (mi_low_memory_notification == NULL) return false;
+  return _mi_prim_thread_start(&mi_memory_pressure_watch, NULL);
+}
+
+
+//----------------------------------------------------------------
+// Fork
+//----------------------------------------------------------------
+
+bool _mi_prim_fork_handlers_install(void) {
+  return false;
+}
@@ -29,8 +29,10 @@ Position  4 to 11: the key
 Position 12 to 13: the counter.
 Position 14 to 15: the nonce.
 
-The implementation uses regular C code which compiles very well on modern compilers.
-(gcc x64 has no register spills, and clang 6+ uses SSE instructions)
+We generate `MI_RANDOM_BLOCKS` (4) consecutive blocks at once. With SSE2 or NEON
+each vector lane computes one block; otherwise we use regular C code which
+compiles very well on modern compilers (gcc x64 has no register spills, and
+clang 6+ uses SSE instructions).
 -----------------------------------------------------------------------------*/
 
 static inline uint32_t rotl(uint32_t x, uint32_t shift) {
@@ -44,33 +46,121 @@ static inline void qround(uint32_t x[16], size_t a, size_t b, size_t c, size_t d
   x[c] += x[d]; x[b] = rotl(x[b] ^ x[c], 7);
 }
 
-static void chacha_block(mi_random_ctx_t* ctx)
-{
+#if (MI_RANDOM_BLOCKS==4) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)) && !defined(MI_NO_X86_INTRINSICS)
+#include <emmintrin.h>
+#define MI_CHACHA_SIMD  1
+typedef __m128i mi_chacha_vec_t;
+#define chacha_vadd(x,y)          _mm_add_epi32(x,y)
+#define chacha_vxor(x,y)          _mm_xor_si128(x,y)
+#define chacha_vrotl(x,n)         _mm_or_si128(_mm_slli_epi32(x,n), _mm_srli_epi32(x,32-(n)))
+#define chacha_vdup(x)            _mm_set1_epi32((int)(x))
+#define chacha_vload(p)           _mm_loadu_si128((const __m128i*)(p))
+#define chacha_vstore(p,x)        _mm_storeu_si128((__m128i*)(p),x)
+#elif (MI_RANDOM_BLOCKS==4) && (defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON))
+#include <arm_neon.h>
+#define MI_CHACHA_SIMD  1
+typedef uint32x4_t mi_chacha_vec_t;
+#define chacha_vadd(x,y)          vaddq_u32(x,y)
+#define chacha_vxor(x,y)          veorq_u32(x,y)
+#define chacha_vrotl(x,n)         vorrq_u32(vshlq_n_u32(x,n), vshrq_n_u32(x,32-(n)))
+#define chacha_vdup(x)            vdupq_n_u32(x)
+#define chacha_vload(p)           vld1q_u32(p)
+#define chacha_vstore(p,x)        vst1q_u32(p,x)
+#else
+#define MI_CHACHA_SIMD  0
+#endif
+
+#if MI_CHACHA_SIMD
+#define chacha_vqround(x,a,b,c,d) \
+  x[a] = chacha_vadd(x[a],x[b]); x[d] = chacha_vrotl(chacha_vxor(x[d],x[a]),16); \
+  x[c] = chacha_vadd(x[c],x[d]); x[b] = chacha_vrotl(chacha_vxor(x[b],x[c]),12); \
+  x[a] = chacha_vadd(x[a],x[b]); x[d] = chacha_vrotl(chacha_vxor(x[d],x[a]),8);  \
+  x[c] = chacha_vadd(x[c],x[d]); x[b] = chacha_vrotl(chacha_vxor(x[b],x[c]),7);
+
+// compute the blocks for counters `input[12..13] + 0..3` where each lane computes one block
+static void chacha_blocks(const uint32_t input[16], uint32_t output[16*MI_RANDOM_BLOCKS]) {
+  uint32_t ctr_lo[4];
+  uint32_t ctr_hi[4];
+  for (uint32_t i = 0; i < 4; i++) {
+    ctr_lo[i] = input[12] + i;
+    ctr_hi[i] = input[13] + (ctr_lo[i] < input[12] ? 1 : 0);
+  }
+  mi_chacha_vec_t in[16];
+  for (size_t i = 0; i < 16; i++) {
+    in[i] = chacha_vdup(input[i]);
+  }
+  in[12] = chacha_vload(ctr_lo);
+  in[13] = chacha_vload(ctr_hi);
+
   // scramble into `x`
-  uint32_t x[16];
+  mi_chacha_vec_t x[16];
   for (size_t i = 0; i < 16; i++) {
-    x[i] = ctx->input[i];
+    x[i] = in[i];
   }
   for (size_t i = 0; i < MI_CHACHA_ROUNDS; i += 2) {
-    qround(x, 0, 4,  8, 12);
-    qround(x, 1, 5,  9, 13);
-    qround(x, 2, 6, 10, 14);
-    qround(x, 3, 7, 11, 15);
-    qround(x, 0, 5, 10, 15);
-    qround(x, 1, 6, 11, 12);
-    qround(x, 2, 7,  8, 13);
-    qround(x, 3, 4,  9, 14);
+    chacha_vqround(x, 0, 4,  8, 12);
+    chacha_vqround(x, 1, 5,  9, 13);
+    chacha_vqround(x, 2, 6, 10, 14);
+    chacha_vqround(x, 3, 7, 11, 15);
+    chacha_vqround(x, 0, 5, 10, 15);
+    chacha_vqround(x, 1, 6, 11, 12);
+    chacha_vqround(x, 2, 7,  8, 13);
+    chacha_vqround(x, 3, 4,  9, 14);
   }
 
-  // add scrambled data to the initial state
+  // add scrambled data to the initial state and transpose the lanes into consecutive blocks
+  uint32_t lanes[4];
   for (size_t i = 0; i < 16; i++) {
-    ctx->output[i] = x[i] + ctx->input[i];
+    chacha_vstore(lanes, chacha_vadd(x[i], in[i]));
+    for (size_t j = 0; j < 4; j++) {
+      output[16*j + i] = lanes[j];
+    }
+  }
+}
+#else
+static void chacha_blocks(const uint32_t input[16], uint32_t output[16*MI_RANDOM_BLOCKS]) {
+  for (size_t j = 0; j < MI_RANDOM_BLOCKS; j++) {
+    // the input with the counter for this block
+    uint32_t in[16];
+    for (size_t i = 0; i < 16; i++) {
+      in[i] = input[i];
+    }
+    in[12] = input[12] + (uint32_t)j;
+    in[13] = input[13] + (in[12] < input[12] ? 1 : 0);
+
+    // scramble into `x`
+    uint32_t x[16];
+    for (size_t i = 0; i < 16; i++) {
+      x[i] = in[i];
+    }
+    for (size_t i = 0; i < MI_CHACHA_ROUNDS; i += 2) {
+      qround(x, 0, 4,  8, 12);
+      qround(x, 1, 5,  9, 13);
+      qround(x, 2, 6, 10, 14);
+      qround(x, 3, 7, 11, 15);
+      qround(x, 0, 5, 10, 15);
+      qround(x, 1, 6, 11, 12);
+      qround(x, 2, 7,  8, 13);
+      qround(x, 3, 4,  9, 14);
+    }
+
+    // add scrambled data to the initial state
+    for (size_t i = 0; i < 16; i++) {
+      output[16*j + i] = x[i] + in[i];
+    }
   }
-  ctx->output_available = 16;
+}
+#endif
+
+static void chacha_block(mi_random_ctx_t* ctx)
+{
+  chacha_blocks(ctx->input, ctx->output);
+  ctx->output_available = MI_RANDOM_OUTPUT;
 
   // increment the counter for the next round
-  ctx->input[12] += 1;
-  if (ctx->input[12] == 0) {
+  const uint32_t ctr = ctx->input[12];
+  ctx->input[12] += MI_RANDOM_BLOCKS;
+  if (ctx->input[12] < ctr) {
     ctx->input[13] += 1;
     if (ctx->input[13] == 0) {  // and keep increasing into the nonce
       ctx->input[14] += 1;
@@ -81,10 +171,10 @@ static void chacha_block(mi_random_ctx_t* ctx)
 static uint32_t chacha_next32(mi_random_ctx_t* ctx) {
   if (ctx->output_available <= 0) {
     chacha_block(ctx);
-    ctx->output_available = 16; // (assign again to suppress static analysis warning)
+    ctx->output_available = MI_RANDOM_OUTPUT; // (assign again to suppress static analysis warning)
   }
-  const uint32_t x = ctx->output[16 - ctx->output_available];
-  ctx->output[16 - ctx->output_available] = 0; // reset once the data is handed out
+  const uint32_t x = ctx->output[MI_RANDOM_OUTPUT - ctx->output_available];
+  ctx->output[MI_RANDOM_OUTPUT - ctx->output_available] = 0; // reset once the data is handed out
   ctx->output_available--;
   return x;
 }
@@ -152,6 +242,26 @@ uintptr_t _mi_random_next(mi_random_ctx_t* ctx) {
   #endif
 }
 
+// Fill `buf` with `count` random words at once (taken directly from the batched chacha output)
+void _mi_random_fill(mi_random_ctx_t* ctx, uintptr_t* buf, size_t count) {
+  mi_assert_internal(mi_random_is_initialized(ctx));
+  uint32_t* out = (uint32_t*)buf;
+  size_t n = count * (sizeof(uintptr_t) / sizeof(uint32_t));
+  while (n > 0) {
+    if (ctx->output_available <= 0) {
+      chacha_block(ctx);
+    }
+    const size_t avail = (size_t)ctx->output_available;
+    const size_t take  = (n < avail ? n : avail);
+    uint32_t* const src = &ctx->output[MI_RANDOM_OUTPUT - avail];
+    _mi_memcpy(out, src, take * sizeof(uint32_t));
+    _mi_memzero(src, take * sizeof(uint32_t));  // reset once the data is handed out
+    ctx->output_available -= (int)take;
+    out += take;
+    n -= take;
+  }
+}
+
 
 /* ----------------------------------------------------------------------------
 To initialize a fresh random context.
@@ -249,6 +359,6 @@ static void chacha_test(void)
        0x466482d2, 0x09aa9f07, 0x05d7c214, 0xa2028bd9,
        0xd19c12b5, 0xb94e16de, 0xe883d0cb, 0x4e3c50a2 };
   chacha_block(&r);
-  mi_assert_internal(array_equals(r.output, r_out, 16));
+  mi_assert_internal(array_equals(r.output, r_out, 16));  // the first of the `MI_RANDOM_BLOCKS` blocks
 }
 */
@@ -9,18 +9,24 @@ terms of the MIT license. A copy of the license can be found in the file
   The following functions are to reliably find the segment or
   block that encompasses any pointer p (or NULL if it is not
   in any of our segments).
-  We maintain a bitmap of all memory with 1 bit per MI_SEGMENT_SIZE (64MiB)
-  set to 1 if it contains the segment meta data.
+  We maintain a bitmap of all memory with 1 bit per MI_SEGMENT_SIZE (4MiB)
+  set to 1 if it contains the segment meta data (of OS or arena allocated
+  segments). A second bitmap marks the further 4MiB parts of huge segments
+  so interior pointers of huge blocks can be resolved by going back to the
+  start of the segment.
+
+  The bitmap is a radix tree with a static top level of
+  directories, where each directory points to the bitmap parts.
+  Both directories and parts are allocated on demand. This covers
+  the full 57-bit address space (5-level paging) while keeping the
+  .bss small and a lookup at two (dependent) loads.
 ----------------------------------------------------------- */
 #include "mimalloc.h"
 #include "mimalloc/internal.h"
 #include "mimalloc/atomic.h"
 
-// Reduce total address space to reduce .bss  (due to the `mi_segment_map`)
-#if (MI_INTPTR_SIZE > 4) && MI_TRACK_ASAN
-#define MI_SEGMENT_MAP_MAX_ADDRESS    (128*1024ULL*MI_GiB)  // 128 TiB  (see issue #881)
-#elif (MI_INTPTR_SIZE > 4)
-#define MI_SEGMENT_MAP_MAX_ADDRESS    (48*1024ULL*MI_GiB)   // 48 TiB
+#if (MI_INTPTR_SIZE > 4)
+#define MI_SEGMENT_MAP_MAX_ADDRESS    (MI_ZU(1) << 57)     // 128 PiB (5-level paging)
 #else
 #define MI_SEGMENT_MAP_MAX_ADDRESS    (UINT32_MAX)
 #endif
@@ -29,17 +35,28 @@ terms of the MIT license. A copy of the license can be found in the file
 #define MI_SEGMENT_MAP_PART_BITS      (8*MI_SEGMENT_MAP_PART_SIZE)
 #define MI_SEGMENT_MAP_PART_ENTRIES   (MI_SEGMENT_MAP_PART_SIZE / MI_INTPTR_SIZE)
 #define MI_SEGMENT_MAP_PART_BIT_SPAN  (MI_SEGMENT_ALIGN)
-#define MI_SEGMENT_MAP_PART_SPAN      (MI_SEGMENT_MAP_PART_BITS * MI_SEGMENT_MAP_PART_BIT_SPAN)
+#define MI_SEGMENT_MAP_PART_SPAN      (MI_SEGMENT_MAP_PART_BITS * MI_SEGMENT_MAP_PART_BIT_SPAN)   // ~252 GiB on 64-bit
 #define MI_SEGMENT_MAP_MAX_PARTS      ((MI_SEGMENT_MAP_MAX_ADDRESS / MI_SEGMENT_MAP_PART_SPAN) + 1)
 
+#define MI_SEGMENT_MAP_DIR_SIZE       (MI_INTPTR_SIZE*MI_KiB - 128)
+#define MI_SEGMENT_MAP_DIR_ENTRIES    (MI_SEGMENT_MAP_DIR_SIZE / MI_INTPTR_SIZE)                  // ~248 TiB per directory on 64-bit
+#define MI_SEGMENT_MAP_MAX_DIRS       ((MI_SEGMENT_MAP_MAX_PARTS / MI_SEGMENT_MAP_DIR_ENTRIES) + 1)
+
 // A part of the segment map.
 typedef struct mi_segmap_part_s {
   mi_memid_t memid;
-  _Atomic(uintptr_t) map[MI_SEGMENT_MAP_PART_ENTRIES];
+  _Atomic(uintptr_t) map[MI_SEGMENT_MAP_PART_ENTRIES];    // segment starts
+  _Atomic(uintptr_t) inner[MI_SEGMENT_MAP_PART_ENTRIES];  // inner parts of huge segments
 } mi_segmap_part_t;
 
-// Allocate parts on-demand to reduce .bss footprint
-static _Atomic(mi_segmap_part_t*) mi_segment_map[MI_SEGMENT_MAP_MAX_PARTS]; // = { NULL, .. }
+// A directory of segment map parts.
+typedef struct mi_segmap_dir_s {
+  mi_memid_t memid;
+  _Atomic(mi_segmap_part_t*) parts[MI_SEGMENT_MAP_DIR_ENTRIES];
+} mi_segmap_dir_t;
+
+// Allocate directories and parts on-demand to reduce .bss footprint
+static _Atomic(mi_segmap_dir_t*) mi_segment_map[MI_SEGMENT_MAP_MAX_DIRS]; // = { NULL, .. }
 
 static mi_segmap_part_t* mi_segment_map_index_of(const mi_segment_t* segment, bool create_on_demand, size_t* idx, size_t* bitidx) {
   // note: segment can be invalid or NULL.
@@ -48,10 +65,28 @@ static mi_segmap_part_t* mi_segment_map_index_of(const mi_segment_t* segment, bo
   *bitidx = 0;  
   if ((uintptr_t)segment >= MI_SEGMENT_MAP_MAX_ADDRESS) return NULL;
   const uintptr_t segindex = ((uintptr_t)segment) / MI_SEGMENT_MAP_PART_SPAN;
-  if (segindex >= MI_SEGMENT_MAP_MAX_PARTS) return NULL;
-  mi_segmap_part_t* part = mi_atomic_load_ptr_relaxed(mi_segmap_part_t, &mi_segment_map[segindex]);
+  const uintptr_t dirindex = segindex / MI_SEGMENT_MAP_DIR_ENTRIES;
+  if (dirindex >= MI_SEGMENT_MAP_MAX_DIRS) return NULL;
+  mi_segmap_dir_t* dir = mi_atomic_load_ptr_acquire(mi_segmap_dir_t, &mi_segment_map[dirindex]);
+
+  // allocate directories on demand
+  if (dir == NULL) {
+    if (!create_on_demand) return NULL;
+    mi_memid_t memid;
+    dir = (mi_segmap_dir_t*)_mi_os_alloc(sizeof(mi_segmap_dir_t), &memid);
+    if (dir == NULL) return NULL;
+    dir->memid = memid;
+    mi_segmap_dir_t* expected = NULL;
+    if (!mi_atomic_cas_ptr_strong_release(mi_segmap_dir_t, &mi_segment_map[dirindex], &expected, dir)) {
+      _mi_os_free(dir, sizeof(mi_segmap_dir_t), memid);
+      dir = expected;
+      if (dir == NULL) return NULL;
+    }
+  }
+  const uintptr_t partindex = segindex % MI_SEGMENT_MAP_DIR_ENTRIES;
+  mi_segmap_part_t* part = mi_atomic_load_ptr_acquire(mi_segmap_part_t, &dir->parts[partindex]);
 
-  // allocate on demand to reduce .bss footprint
+  // allocate parts on demand to reduce .bss footprint
   if (part == NULL) {
     if (!create_on_demand) return NULL;
     mi_memid_t memid;
@@ -59,7 +94,7 @@ static mi_segmap_part_t* mi_segment_map_index_of(const mi_segment_t* segment, bo
     if (part == NULL) return NULL;
     part->memid = memid;
     mi_segmap_part_t* expected = NULL;
-    if (!mi_atomic_cas_ptr_strong_release(mi_segmap_part_t, &mi_segment_map[segindex], &expected, part)) {
+    if (!mi_atomic_cas_ptr_strong_release(mi_segmap_part_t, &dir->parts[partindex], &expected, part)) {
       _mi_os_free(part, sizeof(mi_segmap_part_t), memid);
       part = expected;
       if (part == NULL) return NULL;
@@ -73,47 +108,76 @@ static mi_segmap_part_t* mi_segment_map_index_of(const mi_segment_t* segment, bo
   return part;
 }
 
+static void mi_segment_map_set(_Atomic(uintptr_t)* field, size_t bitidx, bool set) {
+  uintptr_t mask = mi_atomic_load_relaxed(field);
+  uintptr_t newmask;
+  do {
+    newmask = (set ? (mask | ((uintptr_t)1 << bitidx)) : (mask & ~((uintptr_t)1 << bitidx)));
+  } while (!mi_atomic_cas_weak_release(field, &mask, newmask));
+}
+
+// Mark (or clear) the inner parts of a huge segment from `from` up to `to` bytes from the segment start
+static void mi_segment_map_set_inner(const mi_segment_t* segment, size_t from, size_t to, bool set) {
+  for (size_t ofs = _mi_align_up(from, MI_SEGMENT_MAP_PART_BIT_SPAN); ofs < to; ofs += MI_SEGMENT_MAP_PART_BIT_SPAN) {
+    size_t index;
+    size_t bitidx;
+    mi_segmap_part_t* part = mi_segment_map_index_of((const mi_segment_t*)((const uint8_t*)segment + ofs), set /* alloc map if needed */, &index, &bitidx);
+    if (part == NULL) return; // outside our address range..
+    mi_segment_map_set(&part->inner[index], bitidx, set);
+  }
+}
+
 void _mi_segment_map_allocated_at(const mi_segment_t* segment) {
-  if (segment->memid.memkind == MI_MEM_ARENA) return; // we lookup segments first in the arena's and don't need the segment map
   size_t index;
   size_t bitidx;
   mi_segmap_part_t* part = mi_segment_map_index_of(segment, true /* alloc map if needed */, &index, &bitidx);
   if (part == NULL) return; // outside our address range..
-  uintptr_t mask = mi_atomic_load_relaxed(&part->map[index]);
-  uintptr_t newmask;
-  do {
-    newmask = (mask | ((uintptr_t)1 << bitidx));
-  } while (!mi_atomic_cas_weak_release(&part->map[index], &mask, newmask));
+  mi_segment_map_set_inner(segment, MI_SEGMENT_MAP_PART_BIT_SPAN, segment->segment_size, true);
+  mi_segment_map_set(&part->map[index], bitidx, true);
 }
 
 void _mi_segment_map_freed_at(const mi_segment_t* segment) {
-  if (segment->memid.memkind == MI_MEM_ARENA) return;
   size_t index;
   size_t bitidx;
   mi_segmap_part_t* part = mi_segment_map_index_of(segment, false /* don't alloc if not present */, &index, &bitidx);
   if (part == NULL) return; // outside our address range..
-  uintptr_t mask = mi_atomic_load_relaxed(&part->map[index]);
-  uintptr_t newmask;
-  do {
-    newmask = (mask & ~((uintptr_t)1 << bitidx));
-  } while (!mi_atomic_cas_weak_release(&part->map[index], &mask, newmask));
+  mi_segment_map_set(&part->map[index], bitidx, false);
+  mi_segment_map_set_inner(segment, MI_SEGMENT_MAP_PART_BIT_SPAN, segment->segment_size, false);
 }
 
-// Determine the segment belonging to a pointer or NULL if it is not in a valid segment.
-static mi_segment_t* _mi_segment_of(const void* p) {
-  if (p == NULL) return NULL;
-  mi_segment_t* segment = _mi_ptr_segment(p);  // segment can be NULL  
+// Called when a huge segment shrinks to `new_size` (before updating its `segment_size`)
+void _mi_segment_map_shrunk_at(const mi_segment_t* segment, size_t new_size) {
+  mi_segment_map_set_inner(segment, new_size, segment->segment_size, false);
+}
+
+static bool mi_segment_map_is_set(const mi_segment_t* segment, bool inner) {
   size_t index;
   size_t bitidx;
   mi_segmap_part_t* part = mi_segment_map_index_of(segment, false /* dont alloc if not present */, &index, &bitidx);
-  if (part == NULL) return NULL;  
-  const uintptr_t mask = mi_atomic_load_relaxed(&part->map[index]);
-  if mi_likely((mask & ((uintptr_t)1 << bitidx)) != 0) {
-    bool cookie_ok = (_mi_ptr_cookie(segment) == segment->cookie);
-    mi_assert_internal(cookie_ok); MI_UNUSED(cookie_ok);
-    return segment; // yes, allocated by us
+  if (part == NULL) return false;
+  const uintptr_t mask = mi_atomic_load_relaxed(inner ? &part->inner[index] : &part->map[index]);
+  return ((mask & ((uintptr_t)1 << bitidx)) != 0);
+}
+
+// Determine the segment belonging to a pointer or NULL if it is not in a valid segment.
+// Segments allocated in arena's are included as well so this is O(1) for any pointer,
+// except for pointers into huge segments beyond the first 4MiB where we go back
+// to the segment start (in steps of 4MiB).
+mi_segment_t* _mi_segment_of(const void* p) {
+  if (p == NULL) return NULL;
+  mi_segment_t* segment = _mi_ptr_segment(p);  // segment can be NULL
+  if mi_unlikely(!mi_segment_map_is_set(segment, false)) {
+    if mi_likely(!mi_segment_map_is_set(segment, true)) return NULL;
+    // an inner part of a huge segment
+    do {
+      segment = (mi_segment_t*)((uint8_t*)segment - MI_SEGMENT_MAP_PART_BIT_SPAN);
+    } while (!mi_segment_map_is_set(segment, false) && mi_segment_map_is_set(segment, true));
+    if (!mi_segment_map_is_set(segment, false)) return NULL;
+    if ((const uint8_t*)p >= (uint8_t*)segment + segment->segment_size) return NULL;
   }
-  return NULL;
+  bool cookie_ok = _mi_segment_cookie_is_valid(segment);
+  mi_assert_internal(cookie_ok); MI_UNUSED(cookie_ok);
+  return segment; // yes, allocated by us
 }
 
 // Is this a valid pointer in our heap?
@@ -127,10 +191,15 @@ mi_decl_nodiscard mi_decl_export bool mi_is_in_heap_region(const void* p) mi_att
 }
 
 void _mi_segment_map_unsafe_destroy(void) {
-  for (size_t i = 0; i < MI_SEGMENT_MAP_MAX_PARTS; i++) {
-    mi_segmap_part_t* part = mi_atomic_exchange_ptr_relaxed(mi_segmap_part_t, &mi_segment_map[i], NULL);
-    if (part != NULL) {
-      _mi_os_free(part, sizeof(mi_segmap_part_t), part->memid);
+  for (size_t i = 0; i < MI_SEGMENT_MAP_MAX_DIRS; i++) {
+    mi_segmap_dir_t* dir = mi_atomic_exchange_ptr_relaxed(mi_segmap_dir_t, &mi_segment_map[i], NULL);
+    if (dir == NULL) continue;
+    for (size_t j = 0; j < MI_SEGMENT_MAP_DIR_ENTRIES; j++) {
+      mi_segmap_part_t* part = mi_atomic_exchange_ptr_relaxed(mi_segmap_part_t, &dir->parts[j], NULL);
+      if (part != NULL) {
+        _mi_os_free(part, sizeof(mi_segmap_part_t), part->memid);
+      }
     }
+    _mi_os_free(dir, sizeof(mi_segmap_dir_t), dir->memid);
   }
 }
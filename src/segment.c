@@ -7,6 +7,7 @@ terms of the MIT license. A copy of the license can be found in the file
 #include "mimalloc.h"
 #include "mimalloc/internal.h"
 #include "mimalloc/atomic.h"
+#include "mimalloc/prim.h"    // _mi_prim_random_buf
 
 #include <string.h>  // memset
 #include <stdio.h>
@@ -24,6 +25,7 @@ static uint8_t* mi_segment_raw_page_start(const mi_segment_t* segment, const mi_
   Currently we have:
   - small pages (64KiB), 64 in one segment
   - medium pages (512KiB), 8 in one segment
+  - medium-large pages (1MiB), 4 in one segment
   - large pages (4MiB), 1 in one segment
   - huge segments have 1 page in one segment that can be larger than `MI_SEGMENT_SIZE`.
     it is used for blocks `> MI_LARGE_OBJ_SIZE_MAX` or with alignment `> MI_BLOCK_ALIGNMENT_MAX`.
@@ -85,14 +87,27 @@ static void mi_segment_enqueue(mi_segment_queue_t* queue, mi_segment_t* segment)
   }
 }
 
-static mi_segment_queue_t* mi_segment_free_queue_of_kind(mi_page_kind_t kind, mi_segments_tld_t* tld) {
-  if (kind == MI_PAGE_SMALL) return &tld->small_free;
-  else if (kind == MI_PAGE_MEDIUM) return &tld->medium_free;
+// The free queues are bucketed by occupancy such that we allocate pages from the fullest
+// segments first; this lets lightly used segments drain so they can be freed.
+static size_t mi_segment_free_bucket(const mi_segment_t* segment) {
+  mi_assert_internal(segment->used < segment->capacity);
+  return (segment->used * MI_SEGMENT_FREE_BUCKETS) / segment->capacity;
+}
+
+static mi_segment_queue_t* mi_segment_free_queue_of_kind(mi_page_kind_t kind, size_t bucket, mi_segments_tld_t* tld) {
+  mi_assert_internal(bucket < MI_SEGMENT_FREE_BUCKETS);
+  if (kind == MI_PAGE_SMALL) return &tld->small_free[bucket];
+  else if (kind == MI_PAGE_MEDIUM) return &tld->medium_free[bucket];
+  else if (kind == MI_PAGE_MLARGE) return &tld->mlarge_free[bucket];
   else return NULL;
 }
 
 static mi_segment_queue_t* mi_segment_free_queue(const mi_segment_t* segment, mi_segments_tld_t* tld) {
-  return mi_segment_free_queue_of_kind(segment->page_kind, tld);
+  if mi_unlikely(mi_segment_is_shared(segment)) {
+    // kept separate so the child of a fork can leave them to the parent without accessing them
+    return (segment->page_kind <= MI_PAGE_MLARGE ? &tld->shared_free[segment->page_kind] : NULL);
+  }
+  return mi_segment_free_queue_of_kind(segment->page_kind, segment->free_bucket, tld);
 }
 
 // remove from free queue if it is in one
@@ -105,9 +120,20 @@ static void mi_segment_remove_from_free_queue(mi_segment_t* segment, mi_segments
 }
 
 static void mi_segment_insert_in_free_queue(mi_segment_t* segment, mi_segments_tld_t* tld) {
+  segment->free_bucket = mi_segment_free_bucket(segment);
   mi_segment_enqueue(mi_segment_free_queue(segment, tld), segment);
 }
 
+// move a segment in a free queue to the bucket of its current occupancy
+static void mi_segment_update_free_queue(mi_segment_t* segment, mi_segments_tld_t* tld) {
+  mi_segment_queue_t* queue = mi_segment_free_queue(segment, tld); // may be NULL
+  bool in_queue = (queue!=NULL && (segment->next != NULL || segment->prev != NULL || queue->first == segment));
+  if (in_queue && segment->free_bucket != mi_segment_free_bucket(segment)) {
+    mi_segment_queue_remove(queue, segment);
+    mi_segment_insert_in_free_queue(segment, tld);
+  }
+}
+
 
 /* -----------------------------------------------------------
  Invariant checking
@@ -116,7 +142,7 @@ static void mi_segment_insert_in_free_queue(mi_segment_t* segment, mi_segments_t
 #if (MI_DEBUG >= 2) || (MI_SECURE >= 2)
 static size_t mi_segment_page_size(const mi_segment_t* segment) {
   if (segment->capacity > 1) {
-    mi_assert_internal(segment->page_kind <= MI_PAGE_MEDIUM);
+    mi_assert_internal(segment->page_kind <= MI_PAGE_MLARGE);
     return ((size_t)1 << segment->page_shift);
   }
   else {
@@ -143,7 +169,7 @@ static bool mi_segment_is_valid(const mi_segment_t* segment, mi_segments_tld_t*
   mi_assert_internal(_mi_ptr_cookie(segment) == segment->cookie);
   mi_assert_internal(segment->used <= segment->capacity);
   mi_assert_internal(segment->abandoned <= segment->used);
-  mi_assert_internal(segment->page_kind <= MI_PAGE_MEDIUM || segment->capacity == 1); // one large or huge page per segment
+  mi_assert_internal(segment->page_kind <= MI_PAGE_MLARGE || segment->capacity == 1); // one large or huge page per segment
   size_t nfree = 0;
   for (size_t i = 0; i < segment->capacity; i++) {
     const mi_page_t* const page = &segment->pages[i];
@@ -234,18 +260,126 @@ static void mi_segment_protect(mi_segment_t* segment, bool protect) {
   Page reset
 ----------------------------------------------------------- */
 
-static void mi_page_purge(mi_segment_t* segment, mi_page_t* page, mi_segments_tld_t* tld) {
+// Medium, medium-large, and large pages are committed in chunks of `MI_COMMIT_CHUNK_SIZE` as their
+// free list is extended (see `page.c:mi_page_extend_free`) so pages that hold just a few blocks
+// do not commit all of their memory. A page is marked `is_committed` once its first chunk is committed,
+// and the committed chunks of all pages are tracked in the `commit_mask` of the segment.
+// (not in secure mode 2 and higher, as there every page has a guard page at its end).
+#define MI_COMMIT_MASK_FULL  (~(uint64_t)0)
+
+static bool mi_segment_has_commit_chunks(const mi_segment_t* segment) {
+  return (MI_SECURE < 2 && segment->page_kind >= MI_PAGE_MEDIUM && segment->page_kind <= MI_PAGE_LARGE &&
+          ((size_t)1 << segment->page_shift) > MI_COMMIT_CHUNK_SIZE);
+}
+
+static size_t mi_commit_mask_count(uint64_t mask) {
+  size_t count = 0;
+  for (; mask != 0; mask &= (mask - 1)) { count++; }
+  return count;
+}
+
+static bool mi_commit_mask_is_set(const mi_segment_t* segment, size_t chunk) {
+  return ((segment->commit_mask & ((uint64_t)1 << chunk)) != 0);
+}
+
+// the chunks of a page in the commit mask
+static uint64_t mi_page_commit_mask(const mi_segment_t* segment, const mi_page_t* page) {
+  const size_t chunks = ((size_t)1 << segment->page_shift) / MI_COMMIT_CHUNK_SIZE;
+  const uint64_t mask = (chunks >= 64 ? MI_COMMIT_MASK_FULL : (((uint64_t)1 << chunks) - 1));
+  return (mask << (page->segment_idx * chunks));
+}
+
+// Find the next run of chunks in `[*chunk,chunk_end)` that are committed (or not) and return it as a memory range
+// within the page area at offset `start` of size `psize` (relative to the segment start).
+static bool mi_page_next_commit_run(const mi_segment_t* segment, size_t* chunk, size_t chunk_end, bool committed,
+                                    size_t start, size_t psize, size_t* run_start, size_t* run_size) {
+  while (*chunk < chunk_end && mi_commit_mask_is_set(segment, *chunk) != committed) { (*chunk)++; }
+  if (*chunk >= chunk_end) return false;
+  size_t end = *chunk + 1;
+  while (end < chunk_end && mi_commit_mask_is_set(segment, end) == committed) { end++; }
+  const size_t p = (*chunk * MI_COMMIT_CHUNK_SIZE < start ? start : *chunk * MI_COMMIT_CHUNK_SIZE);
+  const size_t q = (end * MI_COMMIT_CHUNK_SIZE > start + psize ? start + psize : end * MI_COMMIT_CHUNK_SIZE);
+  *run_start = p;
+  *run_size = q - p;
+  *chunk = end;
+  return true;
+}
+
+// Ensure the first `size` bytes from the raw start of the page are committed
+static bool mi_page_commit_chunks(mi_segment_t* segment, mi_page_t* page, size_t size, bool* is_zero) {
+  mi_assert_internal(mi_segment_has_commit_chunks(segment));
+  size_t psize;
+  const size_t start = (size_t)(mi_segment_raw_page_start(segment, page, &psize) - (uint8_t*)segment);
+  if (size > psize) { size = psize; }
+  size_t chunk = start / MI_COMMIT_CHUNK_SIZE;
+  const size_t chunk_end = (start + size + MI_COMMIT_CHUNK_SIZE - 1) / MI_COMMIT_CHUNK_SIZE;
+  mi_assert_internal(chunk_end <= 64);
+  size_t run_start;
+  size_t run_size;
+  while (mi_page_next_commit_run(segment, &chunk, chunk_end, false, start, psize, &run_start, &run_size)) {
+    bool run_zero = false;
+    if (!_mi_os_commit((uint8_t*)segment + run_start, run_size, &run_zero)) return false;
+    if (!run_zero && is_zero != NULL) { *is_zero = false; }
+    for (size_t i = run_start / MI_COMMIT_CHUNK_SIZE; i < chunk; i++) {
+      segment->commit_mask |= ((uint64_t)1 << i);
+    }
+  }
+  return true;
+}
+
+// Ensure the first `size` bytes of the block area of a page are committed (called from `page.c:mi_page_extend_free`).
+// Returns `false` if the commit failed; `*is_zero` is set to `false` if newly committed memory may not be zero.
+bool _mi_segment_page_commit(mi_page_t* page, size_t size, bool* is_zero) {
+  mi_segment_t* const segment = _mi_page_segment(page);
+  mi_assert_internal(page->is_committed);
+  if (!mi_segment_has_commit_chunks(segment) || segment->commit_mask == MI_COMMIT_MASK_FULL) return true;
+  const size_t ofs = (size_t)(mi_page_start(page) - mi_segment_raw_page_start(segment, page, NULL));
+  return mi_page_commit_chunks(segment, page, ofs + size, is_zero);
+}
+
+static bool mi_page_purge_range(mi_page_t* page, void* start, size_t size, bool* is_zero) {
+  return (page->purge_policy ? _mi_os_purge_policy_ex(start, size, page->purge_decommit, true /* allow reset */, size, is_zero)
+                             : _mi_os_purge_ex(start, size, true /* allow reset */, size, is_zero));
+}
+
+// Purge the committed parts of a free page; returns the number of bytes that were purged.
+static size_t mi_page_purge(mi_segment_t* segment, mi_page_t* page, mi_segments_tld_t* tld) {
   // todo: should we purge the guard page as well when MI_SECURE>=2 ?
   mi_assert_internal(page->is_committed);
   mi_assert_internal(!page->segment_in_use);
-  if (!segment->allow_purge) return;
+  if (!segment->allow_purge) return 0;
   mi_assert_internal(page->used == 0);
   mi_assert_internal(page->free == NULL);
   mi_assert_expensive(!mi_pages_purge_contains(page, tld)); MI_UNUSED(tld);
   size_t psize;
-  void* start = mi_segment_raw_page_start(segment, page, &psize);
-  const bool needs_recommit = _mi_os_purge(start, psize);
+  uint8_t* start = mi_segment_raw_page_start(segment, page, &psize);
+  bool is_zero = false;
+  bool needs_recommit = false;
+  size_t purged = 0;
+  if (mi_segment_has_commit_chunks(segment)) {
+    // purge just the committed chunks
+    const size_t ofs = (size_t)(start - (uint8_t*)segment);
+    size_t chunk = ofs / MI_COMMIT_CHUNK_SIZE;
+    const size_t chunk_end = (ofs + psize + MI_COMMIT_CHUNK_SIZE - 1) / MI_COMMIT_CHUNK_SIZE;
+    size_t run_start;
+    size_t run_size;
+    is_zero = true;
+    while (mi_page_next_commit_run(segment, &chunk, chunk_end, true, ofs, psize, &run_start, &run_size)) {
+      bool run_zero = false;
+      if (mi_page_purge_range(page, (uint8_t*)segment + run_start, run_size, &run_zero)) { needs_recommit = true; }
+      if (!run_zero) { is_zero = false; }
+      purged += run_size;
+    }
+    if (needs_recommit) { segment->commit_mask &= ~mi_page_commit_mask(segment, page); }
+  }
+  else {
+    needs_recommit = mi_page_purge_range(page, start, psize, &is_zero);
+    purged = psize;
+  }
   if (needs_recommit) { page->is_committed = false; }
+  // remember if the page is known to be zero now so a next calloc can skip zero'ing (as long as it is not used)
+  if (is_zero && _mi_arena_memid_is_os(segment->memid)) { page->is_zero_init = true; }
+  return purged;
 }
 
 static bool mi_page_ensure_committed(mi_segment_t* segment, mi_page_t* page, mi_segments_tld_t* tld) {
@@ -257,12 +391,19 @@ static bool mi_page_ensure_committed(mi_segment_t* segment, mi_page_t* page, mi_
   uint8_t* start = mi_segment_raw_page_start(segment, page, &psize);
   bool is_zero = false;
   const size_t gsize = (MI_SECURE >= 2 ? _mi_os_page_size() : 0);
-  bool ok = _mi_os_commit(start, psize + gsize, &is_zero);
+  bool ok;
+  if (mi_segment_has_commit_chunks(segment)) {
+    is_zero = true;
+    ok = mi_page_commit_chunks(segment, page, 1, &is_zero);  // just the first chunk; the rest is committed on demand
+  }
+  else {
+    ok = _mi_os_commit(start, psize + gsize, &is_zero);
+  }
   if (!ok) return false; // failed to commit!
   page->is_committed = true;
   page->used = 0;
   page->free = NULL;
-  page->is_zero_init = is_zero;
+  page->is_zero_init = (is_zero || page->is_zero_init);  // the page may be known to be zero from the purge
   if (gsize > 0) {
     mi_segment_protect_range(start + psize, gsize, true);
   }
@@ -286,9 +427,9 @@ static void mi_page_set_expire( mi_page_t* page, uint32_t expire ) {
   page->free = (mi_block_t*)((uintptr_t)expire);
 }
 
-static void mi_page_purge_set_expire(mi_page_t* page) {
+static void mi_page_purge_set_expire(mi_page_t* page, long delay) {
   mi_assert_internal(mi_page_get_expire(page)==0);
-  uint32_t expire = (uint32_t)_mi_clock_now() + mi_option_get(mi_option_purge_delay);
+  uint32_t expire = (uint32_t)_mi_clock_now() + delay;
   mi_page_set_expire(page, expire);
 }
 
@@ -301,32 +442,36 @@ static bool mi_page_purge_is_expired(mi_page_t* page, mi_msecs_t now) {
   return (((int32_t)now - expire) >= 0);
 }
 
-static void mi_segment_schedule_purge(mi_segment_t* segment, mi_page_t* page, mi_segments_tld_t* tld) {
+// Schedule a purge of a freed page using the purge `policy` of the heap that freed it (or the global options if `NULL`)
+static void mi_segment_schedule_purge(mi_segment_t* segment, mi_page_t* page, const mi_heap_policy_t* policy, mi_segments_tld_t* tld) {
   mi_assert_internal(!page->segment_in_use);
   mi_assert_internal(mi_page_not_in_queue(page,tld));
   mi_assert_expensive(!mi_pages_purge_contains(page, tld));
   mi_assert_internal(_mi_page_segment(page)==segment);
   if (!segment->allow_purge) return;
 
-  if (mi_option_get(mi_option_purge_delay) == 0) {
+  page->purge_policy = (policy != NULL);
+  page->purge_decommit = (policy != NULL && policy->purge_decommits);
+  const long delay = _mi_os_purge_delay(policy != NULL ? policy->purge_delay : mi_option_get(mi_option_purge_delay));  // shortened under memory pressure
+  page->purge_never = (delay < 0);
+  if (delay == 0) {
     // purge immediately?
     mi_page_purge(segment, page, tld);
   }
-  else if (mi_option_get(mi_option_purge_delay) > 0) {   // no purging if the delay is negative
+  else if (delay > 0) {   // no purging if the delay is negative
     // otherwise push on the delayed page reset queue
     mi_page_queue_t* pq = &tld->pages_purge;
-    // push on top
-    mi_page_purge_set_expire(page);
-    page->next = pq->first;
-    page->prev = NULL;
-    if (pq->first == NULL) {
-      mi_assert_internal(pq->last == NULL);
-      pq->first = pq->last = page;
-    }
-    else {
-      pq->first->prev = page;
-      pq->first = page;
+    mi_page_purge_set_expire(page, delay);
+    // push on top; but keep the queue ordered by expiration as heaps can have different purge delays
+    mi_page_t* next = pq->first;
+    while (next != NULL && (int32_t)(mi_page_get_expire(next) - mi_page_get_expire(page)) > 0) {
+      next = next->next;
     }
+    mi_page_t* const prev = (next == NULL ? pq->last : next->prev);
+    page->next = next;
+    page->prev = prev;
+    if (prev == NULL) { pq->first = page; } else { prev->next = page; }
+    if (next == NULL) { pq->last = page; }  else { next->prev = page; }
   }
 }
 
@@ -352,7 +497,7 @@ static void mi_segment_remove_all_purges(mi_segment_t* segment, bool force_purge
     mi_page_t* page = &segment->pages[i];
     if (!page->segment_in_use) {
       mi_page_purge_remove(page, tld);
-      if (force_purge && page->is_committed) {
+      if (force_purge && page->is_committed && !page->purge_never) {  // honour the policy of the heap that freed the page
         mi_page_purge(segment, page, tld);
       }
     }
@@ -363,7 +508,7 @@ static void mi_segment_remove_all_purges(mi_segment_t* segment, bool force_purge
 }
 
 static void mi_pages_try_purge(bool force, mi_segments_tld_t* tld) {
-  if (mi_option_get(mi_option_purge_delay) < 0) return;  // purging is not allowed
+  if (tld->pages_purge.last == NULL) return;  // nothing scheduled (note: heaps can have their own purge delay)
 
   mi_msecs_t now = _mi_clock_now();
   mi_page_queue_t* pq = &tld->pages_purge;
@@ -455,10 +600,16 @@ static size_t mi_segment_calculate_sizes(size_t capacity, size_t required, size_
 
   if (MI_SECURE == 0) {
     // normally no guard pages
-    #if MI_GUARDED
+    #if defined(MI_GUARDED)
     isize = _mi_align_up(minsize, _mi_os_page_size());
     #else
-    isize = _mi_align_up(minsize, 16 * MI_MAX_ALIGN_SIZE);
+    if (_mi_guarded_sampling_enabled) {
+      // page align so guarded objects can end in a guard page
+      isize = _mi_align_up(minsize, _mi_os_page_size());
+    }
+    else {
+      isize = _mi_align_up(minsize, 16 * MI_MAX_ALIGN_SIZE);
+    }
     #endif
   }
   else {
@@ -491,6 +642,126 @@ static void mi_segments_track_size(long segment_size, mi_segments_tld_t* tld) {
   if (tld->current_size > tld->peak_size) tld->peak_size = tld->current_size;
 }
 
+
+/* ----------------------------------------------------------------------------
+Huge segment cache
+Freed huge segments are kept committed in a process wide cache (of at most
+`mi_option_huge_segment_cache` bytes) such that they can be reused by any thread
+without a decommit/commit cycle and the page faults that follow. The cache has
+4 size buckets per power of two, each with a few slots; a slot is claimed by
+an atomic swap of its segment pointer.
+------------------------------------------------------------------------------- */
+
+#define MI_HUGE_CACHE_MIN_SHIFT   (20)                                    // 1 MiB
+#define MI_HUGE_CACHE_MIN_SIZE    ((size_t)1 << MI_HUGE_CACHE_MIN_SHIFT)
+#define MI_HUGE_CACHE_MAX_SIZE    (MI_HUGE_CACHE_MIN_SIZE << 7)           // 128 MiB
+#define MI_HUGE_CACHE_BUCKETS     (4*7)
+#define MI_HUGE_CACHE_SLOTS       (4)                                     // slots per bucket
+#define MI_HUGE_CACHE_BUSY        ((mi_segment_t*)1)                      // marks a slot that is being filled
+
+typedef struct mi_huge_cache_slot_s {
+  _Atomic(mi_segment_t*) segment;   // NULL if the slot is empty
+  _Atomic(size_t)        size;      // the segment size
+  _Atomic(mi_msecs_t)    expire;    // when the segment is released (or 0 for never)
+} mi_huge_cache_slot_t;
+
+static mi_huge_cache_slot_t mi_huge_cache[MI_HUGE_CACHE_BUCKETS * MI_HUGE_CACHE_SLOTS];
+static _Atomic(size_t)      mi_huge_cache_total;   // total bytes in the cache
+
+static size_t mi_huge_cache_bucket(size_t size) {
+  mi_assert_internal(size >= MI_HUGE_CACHE_MIN_SIZE && size < MI_HUGE_CACHE_MAX_SIZE);
+  const size_t shift = mi_bsr(size);
+  const size_t bucket = 4*(shift - MI_HUGE_CACHE_MIN_SHIFT) + ((size >> (shift - 2)) & 3);
+  mi_assert_internal(bucket < MI_HUGE_CACHE_BUCKETS);
+  return bucket;
+}
+
+// can a huge segment of `size` bytes be cached?
+static bool mi_huge_cache_accepts(size_t size) {
+  return (size >= MI_HUGE_CACHE_MIN_SIZE && size < MI_HUGE_CACHE_MAX_SIZE &&
+          size <= mi_option_get_size(mi_option_huge_segment_cache));
+}
+
+static void mi_huge_cache_release(mi_segment_t* segment) {
+  _mi_arena_free(segment, segment->segment_size, segment->segment_size /* fully committed */, segment->memid);
+}
+
+// Try to put a fully committed huge segment in the cache (after `mi_segment_os_free` bookkeeping)
+static bool mi_huge_cache_push(mi_segment_t* segment) {
+  const size_t size = segment->segment_size;
+  if (!mi_huge_cache_accepts(size)) return false;
+  if (segment->memid.is_pinned) return false;  // nothing to gain as it is never decommitted
+  if (!_mi_arena_memid_is_suitable(segment->memid, _mi_arena_id_none())) return false;  // do not cache memory of exclusive arenas
+  const long delay = _mi_os_purge_delay(mi_option_get(mi_option_purge_delay)) * mi_option_get(mi_option_arena_purge_mult);
+  if (delay == 0) return false;  // immediate purging (or under critical memory pressure)
+
+  // claim budget
+  const size_t max_total = mi_option_get_size(mi_option_huge_segment_cache);
+  size_t total = mi_atomic_load_relaxed(&mi_huge_cache_total);
+  do {
+    if (total + size > max_total) return false;
+  } while (!mi_atomic_cas_weak_acq_rel(&mi_huge_cache_total, &total, total + size));
+
+  // and claim an empty slot in its bucket
+  mi_huge_cache_slot_t* const slots = &mi_huge_cache[mi_huge_cache_bucket(size) * MI_HUGE_CACHE_SLOTS];
+  for (size_t i = 0; i < MI_HUGE_CACHE_SLOTS; i++) {
+    mi_huge_cache_slot_t* const slot = &slots[i];
+    mi_segment_t* expected = NULL;
+    if (mi_atomic_load_ptr_relaxed(mi_segment_t, &slot->segment) == NULL &&
+        mi_atomic_cas_strong_acq_rel(&slot->segment, &expected, MI_HUGE_CACHE_BUSY))
+    {
+      mi_atomic_store_release(&slot->size, size);
+      mi_atomic_storei64_release(&slot->expire, (delay < 0 ? 0 : _mi_clock_now() + delay));
+      mi_atomic_store_ptr_release(mi_segment_t, &slot->segment, segment);
+      return true;
+    }
+  }
+  mi_atomic_sub_acq_rel(&mi_huge_cache_total, size);
+  return false;
+}
+
+// Try to find a cached huge segment of at least `size` bytes (and less than 1.5 times that)
+static mi_segment_t* mi_huge_cache_pop(size_t size) {
+  if (size < MI_HUGE_CACHE_MIN_SIZE || size >= MI_HUGE_CACHE_MAX_SIZE) return NULL;
+  if (mi_atomic_load_relaxed(&mi_huge_cache_total) == 0) return NULL;
+  const size_t bucket = mi_huge_cache_bucket(size);
+  for (size_t b = bucket; b <= bucket + 1 && b < MI_HUGE_CACHE_BUCKETS; b++) {
+    mi_huge_cache_slot_t* const slots = &mi_huge_cache[b * MI_HUGE_CACHE_SLOTS];
+    for (size_t i = 0; i < MI_HUGE_CACHE_SLOTS; i++) {
+      mi_huge_cache_slot_t* const slot = &slots[i];
+      mi_segment_t* segment = mi_atomic_load_ptr_acquire(mi_segment_t, &slot->segment);
+      if (segment == NULL || segment == MI_HUGE_CACHE_BUSY) continue;
+      if (mi_atomic_load_acquire(&slot->size) < size) continue;
+      if (!mi_atomic_cas_strong_acq_rel(&slot->segment, &segment, (mi_segment_t*)NULL)) continue;
+      // we own the segment now
+      mi_atomic_sub_acq_rel(&mi_huge_cache_total, segment->segment_size);
+      if mi_likely(segment->segment_size >= size) return segment;
+      // the slot was refilled concurrently with a smaller segment
+      if (!mi_huge_cache_push(segment)) { mi_huge_cache_release(segment); }
+    }
+  }
+  return NULL;
+}
+
+// Release expired huge segments from the cache (or all if `force` is set)
+void _mi_segment_cache_collect(bool force) {
+  if (mi_atomic_load_relaxed(&mi_huge_cache_total) == 0) return;
+  const mi_msecs_t now = (force ? 0 : _mi_clock_now());
+  for (size_t i = 0; i < MI_HUGE_CACHE_BUCKETS * MI_HUGE_CACHE_SLOTS; i++) {
+    mi_huge_cache_slot_t* const slot = &mi_huge_cache[i];
+    mi_segment_t* segment = mi_atomic_load_ptr_acquire(mi_segment_t, &slot->segment);
+    if (segment == NULL || segment == MI_HUGE_CACHE_BUSY) continue;
+    if (!force) {
+      const mi_msecs_t expire = mi_atomic_loadi64_relaxed(&slot->expire);
+      if (expire == 0 || expire > now) continue;
+    }
+    if (mi_atomic_cas_strong_acq_rel(&slot->segment, &segment, (mi_segment_t*)NULL)) {
+      mi_atomic_sub_acq_rel(&mi_huge_cache_total, segment->segment_size);
+      mi_huge_cache_release(segment);
+    }
+  }
+}
+
 static void mi_segment_os_free(mi_segment_t* segment, size_t segment_size, mi_segments_tld_t* tld) {
   segment->thread_id = 0;
   _mi_segment_map_freed_at(segment);
@@ -501,21 +772,39 @@ static void mi_segment_os_free(mi_segment_t* segment, size_t segment_size, mi_se
   }
 
   if (MI_SECURE != 0) {
-    mi_assert_internal(!segment->memid.is_pinned);
     mi_segment_protect(segment, false); // ensure no more guard pages are set
   }
 
   bool fully_committed = true;
   size_t committed_size = 0;
-  const size_t page_size = mi_segment_raw_page_size(segment);
-  for (size_t i = 0; i < segment->capacity; i++) {
-    mi_page_t* page = &segment->pages[i];
-    if (page->is_committed)  { committed_size += page_size;  }
-    if (!page->is_committed) { fully_committed = false; }
+  if (mi_segment_has_commit_chunks(segment)) {
+    committed_size = mi_commit_mask_count(segment->commit_mask) * MI_COMMIT_CHUNK_SIZE;
+    fully_committed = (segment->commit_mask == MI_COMMIT_MASK_FULL);
+    // the segment info at the start is never purged, even if the chunks it shares with the first page are
+    for (size_t chunk = 0; chunk * MI_COMMIT_CHUNK_SIZE < segment->segment_info_size; chunk++) {
+      const size_t info_size = segment->segment_info_size - chunk * MI_COMMIT_CHUNK_SIZE;
+      if (!mi_commit_mask_is_set(segment, chunk)) {
+        committed_size += (info_size < MI_COMMIT_CHUNK_SIZE ? info_size : MI_COMMIT_CHUNK_SIZE);
+      }
+    }
+  }
+  else {
+    const size_t page_size = mi_segment_raw_page_size(segment);
+    for (size_t i = 0; i < segment->capacity; i++) {
+      mi_page_t* page = &segment->pages[i];
+      if (page->is_committed)  { committed_size += page_size;  }
+      if (!page->is_committed) { fully_committed = false; }
+    }
   }
-  MI_UNUSED(fully_committed);
   mi_assert_internal((fully_committed && committed_size == segment_size) || (!fully_committed && committed_size < segment_size));
 
+  // keep fully committed huge segments in the cache for reuse
+  if (segment->page_kind == MI_PAGE_HUGE && fully_committed) {
+    mi_assert_internal(segment_size == segment->segment_size);
+    _mi_segment_cache_collect(false);
+    if (mi_huge_cache_push(segment)) return;
+  }
+
   _mi_arena_free(segment, segment_size, committed_size, segment->memid);
 }
 
@@ -530,45 +819,171 @@ void _mi_segments_collect(bool force, mi_segments_tld_t* tld) {
   #endif
 }
 
+// Purge only the oldest expired page (if any) and add the purged bytes to `purged_size`.
+// Returns `false` if there was no expired page. Called from `mi_heap_collect_ex`.
+bool _mi_segments_collect_step(size_t* purged_size, mi_segments_tld_t* tld) {
+  mi_page_t* const page = tld->pages_purge.last;
+  if (page == NULL || !mi_page_purge_is_expired(page, _mi_clock_now())) return false;
+  mi_segment_t* const segment = _mi_page_segment(page);
+  mi_page_purge_remove(page, tld);
+  *purged_size += mi_page_purge(segment, page, tld);
+  return true;
+}
+
+
+/* -----------------------------------------------------------
+  Shared memory
+  Segments in a shared arena (see `arena.c:mi_manage_shared_memory`) can be
+  accessed by other processes. Thread id's are only unique within a process
+  so the owner id of such segment is the thread id salted with an odd
+  per-process key. As thread id's are aligned, frees from another process
+  never match the owner id and always take the multi-threaded path which
+  pushes the block on the page `xthread_free` list (the pages never use the
+  delayed free list of the heap as it is process local memory).
+  Abandoned segments are only reclaimed by the process that owned them.
+----------------------------------------------------------- */
+
+static _Atomic(uintptr_t) mi_process_key;   // 0 if not yet initialized
+
+uintptr_t _mi_segment_process_key(void) {
+  uintptr_t key = mi_atomic_load_relaxed(&mi_process_key);
+  if mi_unlikely(key == 0) {
+    if (!_mi_prim_random_buf(&key, sizeof(key))) {
+      key = _mi_os_random_weak((uintptr_t)&mi_process_key);
+    }
+    key |= 1;  // odd so it is never a valid thread id
+    uintptr_t expected = 0;
+    if (!mi_atomic_cas_strong_acq_rel(&mi_process_key, &expected, key)) { key = expected; }
+  }
+  return key;
+}
+
+// Is this a segment in shared memory of another process?
+bool _mi_segment_is_foreign(const mi_segment_t* segment) {
+  return (mi_segment_is_shared(segment) && segment->process_key != _mi_segment_process_key());
+}
+
+// In the child of a fork: leave the segments in shared memory to the parent which still owns them.
+// We cannot access these segments as the parent can concurrently change them.
+void _mi_segments_fork_leave_shared(mi_segments_tld_t* tld) {
+  for (size_t kind = 0; kind <= MI_PAGE_MLARGE; kind++) {
+    tld->shared_free[kind].first = tld->shared_free[kind].last = NULL;
+  }
+}
+
+
+/* -----------------------------------------------------------
+  Fork
+  In the child of a `fork()` only the forking thread survives. Instead of
+  abandoning the segments of the other threads (which would touch all of
+  their pages) we just increment the fork generation in the child: a segment
+  claimed before the fork whose owner is not the forking thread is orphaned.
+  Frees into orphaned segments are ignored; the child cannot reuse that memory
+  anyway and this way it stays shared copy-on-write with the parent.
+  With `mi_option_fork_freeze` all segments of before the fork are left alone,
+  including those of the forking thread (which starts with fresh heaps).
+----------------------------------------------------------- */
+
+#define MI_FORK_FROZEN_THREAD_ID  ((mi_threadid_t)1)   // owner of the frozen segments of the forking thread
+
+static _Atomic(size_t)        mi_fork_generation;  // incremented in the child on each fork
+static _Atomic(mi_threadid_t) mi_fork_thread_id;   // the thread that survived the last fork
+static bool                   mi_fork_frozen;      // is all memory of before the last fork left alone?
+
+// Is the segment left alone since it was claimed before a fork by a thread that is not alive in this process?
+bool _mi_segment_is_fork_orphan(const mi_segment_t* segment) {
+  if mi_likely(segment->fork_generation == mi_atomic_load_relaxed(&mi_fork_generation)) return false;
+  if (mi_segment_is_shared(segment)) return false;  // frees go to the owner (in the parent)
+  if (mi_fork_frozen) return true;
+  const mi_threadid_t tid = mi_atomic_load_relaxed(&segment->thread_id);
+  return (tid != 0 && tid != mi_atomic_load_relaxed(&mi_fork_thread_id));
+}
+
+// Called in the child process by the forking thread
+void _mi_segments_fork_child(void) {
+  mi_atomic_increment_relaxed(&mi_fork_generation);
+  mi_atomic_store_relaxed(&mi_fork_thread_id, _mi_thread_id());
+  mi_atomic_store_relaxed(&mi_process_key, 0);  // segments in shared memory still belong to the parent
+  mi_fork_frozen = mi_option_is_enabled(mi_option_fork_freeze);
+}
+
+// Leave a segment of the forking thread to the parent (with `mi_option_fork_freeze`)
+void _mi_segment_fork_freeze(mi_segment_t* segment) {
+  mi_assert_internal(mi_fork_frozen);
+  if (mi_atomic_load_relaxed(&segment->thread_id) == _mi_thread_id()) {
+    mi_atomic_store_release(&segment->thread_id, MI_FORK_FROZEN_THREAD_ID);
+  }
+}
+
+// Leave the segments in the free queues to the parent and start afresh (with `mi_option_fork_freeze`)
+void _mi_segments_fork_freeze(mi_segments_tld_t* tld) {
+  for (size_t bucket = 0; bucket < MI_SEGMENT_FREE_BUCKETS; bucket++) {
+    mi_segment_queue_t* const queues[3] = { &tld->small_free[bucket], &tld->medium_free[bucket], &tld->mlarge_free[bucket] };
+    for (size_t i = 0; i < 3; i++) {
+      for (mi_segment_t* segment = queues[i]->first; segment != NULL; segment = segment->next) {
+        _mi_segment_fork_freeze(segment);
+      }
+      queues[i]->first = queues[i]->last = NULL;
+    }
+  }
+  tld->pages_purge.first = tld->pages_purge.last = NULL;
+  tld->count = 0;
+  tld->current_size = 0;
+  tld->reclaim_count = 0;
+}
+
 
 /* -----------------------------------------------------------
    Segment allocation
 ----------------------------------------------------------- */
 
-static mi_segment_t* mi_segment_os_alloc(bool eager_delayed, size_t page_alignment, mi_arena_id_t req_arena_id,
+static mi_segment_t* mi_segment_os_alloc(mi_page_kind_t page_kind, bool eager_delayed, size_t page_alignment, mi_arena_id_t req_arena_id,
                                          size_t pre_size, size_t info_size, bool commit, size_t segment_size,
                                          mi_segments_tld_t* tld)
 {
   mi_memid_t memid;
-  bool   allow_large = (!eager_delayed && (MI_SECURE == 0)); // only allow large OS pages once we are no longer lazy
-  size_t align_offset = 0;
-  size_t alignment = MI_SEGMENT_SIZE;
-  if (page_alignment > 0) {
-    alignment = page_alignment;
-    align_offset = _mi_align_up(pre_size, MI_SEGMENT_SIZE);
-    segment_size = segment_size + (align_offset - pre_size);  // adjust the segment size
-  }
-
-  mi_segment_t* segment = (mi_segment_t*)_mi_arena_alloc_aligned(segment_size, alignment, align_offset, commit, allow_large, req_arena_id, &memid);
-  if (segment == NULL) {
-    return NULL;  // failed to allocate
-  }
-
-  if (!memid.initially_committed) {
-    // ensure the initial info is committed
-    mi_assert_internal(!memid.is_pinned);
-    bool ok = _mi_os_commit(segment, pre_size, NULL);
-    if (!ok) {
-      // commit failed; we cannot touch the memory: free the segment directly and return `NULL`
-      _mi_arena_free(segment, segment_size, 0, memid);
-      return NULL;
+  mi_segment_t* segment = NULL;
+  if (page_kind == MI_PAGE_HUGE && page_alignment == 0 && req_arena_id == _mi_arena_id_none()) {
+    segment = mi_huge_cache_pop(segment_size);
+  }
+  if (segment != NULL) {
+    // reuse a cached huge segment; it is fully committed but not zero
+    memid = segment->memid;
+    memid.initially_committed = true;
+    memid.initially_zero = false;
+    segment_size = segment->segment_size;
+  }
+  else {
+    bool   allow_large = (!eager_delayed && (MI_SECURE == 0)); // only allow large OS pages once we are no longer lazy
+    size_t align_offset = 0;
+    size_t alignment = MI_SEGMENT_SIZE;
+    if (page_alignment > 0) {
+      alignment = page_alignment;
+      align_offset = _mi_align_up(pre_size, MI_SEGMENT_SIZE);
+      segment_size = segment_size + (align_offset - pre_size);  // adjust the segment size
+    }
+
+    segment = (mi_segment_t*)_mi_arena_alloc_aligned(segment_size, alignment, align_offset, commit, allow_large, req_arena_id, &memid);
+    if (segment == NULL) {
+      return NULL;  // failed to allocate
+    }
+
+    if (!memid.initially_committed) {
+      // ensure the initial info is committed
+      mi_assert_internal(!memid.is_pinned);
+      bool ok = _mi_os_commit(segment, pre_size, NULL);
+      if (!ok) {
+        // commit failed; we cannot touch the memory: free the segment directly and return `NULL`
+        _mi_arena_free(segment, segment_size, 0, memid);
+        return NULL;
+      }
     }
   }
 
   MI_UNUSED(info_size);
   segment->memid = memid;
   segment->allow_decommit = !memid.is_pinned;
-  segment->allow_purge = segment->allow_decommit && (mi_option_get(mi_option_purge_delay) >= 0);
+  segment->allow_purge = segment->allow_decommit;  // note: the `purge_delay` option is checked on each purge as heaps can have their own policy
   segment->segment_size = segment_size;
   segment->subproc = tld->subproc;
   mi_segments_track_size((long)(segment_size), tld);
@@ -578,7 +993,7 @@ static mi_segment_t* mi_segment_os_alloc(bool eager_delayed, size_t page_alignme
 
 // Allocate a segment from the OS aligned to `MI_SEGMENT_SIZE` .
 static mi_segment_t* mi_segment_alloc(size_t required, mi_page_kind_t page_kind, size_t page_shift, size_t page_alignment,
-                                      mi_arena_id_t req_arena_id, mi_segments_tld_t* tld)
+                                      mi_arena_id_t req_arena_id, const mi_heap_policy_t* policy, mi_segments_tld_t* tld)
 {
   // required is only > 0 for huge page allocations
   mi_assert_internal((required > 0 && page_kind > MI_PAGE_LARGE)|| (required==0 && page_kind <= MI_PAGE_LARGE));
@@ -602,15 +1017,16 @@ static mi_segment_t* mi_segment_alloc(size_t required, mi_page_kind_t page_kind,
   mi_assert_internal(init_segment_size >= required);
 
   // Initialize parameters
-  const bool eager_delayed = (page_kind <= MI_PAGE_MEDIUM &&          // don't delay for large objects
+  const bool eager_delayed = (page_kind <= MI_PAGE_MLARGE &&          // don't delay for large objects
                               // !_mi_os_has_overcommit() &&          // never delay on overcommit systems
+                              (policy == NULL || !policy->eager_commit) && // a heap policy for eager commit is never delayed
                               _mi_current_thread_count() > 1 &&       // do not delay for the first N threads
                               tld->peak_count < (size_t)mi_option_get(mi_option_eager_commit_delay));
-  const bool eager  = !eager_delayed && mi_option_is_enabled(mi_option_eager_commit);
+  const bool eager  = !eager_delayed && (policy != NULL ? policy->eager_commit : mi_option_is_enabled(mi_option_eager_commit));
   const bool init_commit = eager; // || (page_kind >= MI_PAGE_LARGE);
 
   // Allocate the segment from the OS (segment_size can change due to alignment)
-  mi_segment_t* segment = mi_segment_os_alloc(eager_delayed, page_alignment, req_arena_id, pre_size, info_size, init_commit, init_segment_size, tld);
+  mi_segment_t* segment = mi_segment_os_alloc(page_kind, eager_delayed, page_alignment, req_arena_id, pre_size, info_size, init_commit, init_segment_size, tld);
   if (segment == NULL) return NULL;
   mi_assert_internal(segment != NULL && (uintptr_t)segment % MI_SEGMENT_SIZE == 0);
   mi_assert_internal(segment->memid.is_pinned ? segment->memid.initially_committed : true);
@@ -634,14 +1050,17 @@ static mi_segment_t* mi_segment_alloc(size_t required, mi_page_kind_t page_kind,
   segment->capacity   = capacity;
   segment->page_shift = page_shift;
   segment->segment_info_size = pre_size;
-  segment->thread_id  = _mi_thread_id();
+  segment->commit_mask = (segment->memid.initially_committed ? MI_COMMIT_MASK_FULL : 0);
+  segment->thread_id  = _mi_segment_owner_id(segment, _mi_thread_id());
+  segment->fork_generation = mi_atomic_load_relaxed(&mi_fork_generation);
+  segment->process_key = (mi_segment_is_shared(segment) ? _mi_segment_process_key() : 0);
   segment->cookie     = _mi_ptr_cookie(segment);
 
   // set protection
   mi_segment_protect(segment, true);
 
-  // insert in free lists for small and medium pages
-  if (page_kind <= MI_PAGE_MEDIUM) {
+  // insert in free lists for small, medium, and medium-large pages
+  if (page_kind <= MI_PAGE_MLARGE) {
     mi_segment_insert_in_free_queue(segment, tld);
   }
 
@@ -660,8 +1079,16 @@ static void mi_segment_free(mi_segment_t* segment, bool force, mi_segments_tld_t
   mi_segment_remove_all_purges(segment, false /* don't force as we are about to free */, tld);
   mi_segment_remove_from_free_queue(segment, tld);
 
-  mi_assert_expensive(!mi_segment_queue_contains(&tld->small_free, segment));
-  mi_assert_expensive(!mi_segment_queue_contains(&tld->medium_free, segment));
+  #if (MI_DEBUG>=3)
+  for (size_t bucket = 0; bucket < MI_SEGMENT_FREE_BUCKETS; bucket++) {
+    mi_assert_expensive(!mi_segment_queue_contains(&tld->small_free[bucket], segment));
+    mi_assert_expensive(!mi_segment_queue_contains(&tld->medium_free[bucket], segment));
+    mi_assert_expensive(!mi_segment_queue_contains(&tld->mlarge_free[bucket], segment));
+  }
+  for (size_t kind = 0; kind <= MI_PAGE_MLARGE; kind++) {
+    mi_assert_expensive(!mi_segment_queue_contains(&tld->shared_free[kind], segment));
+  }
+  #endif
   mi_assert(segment->next == NULL);
   mi_assert(segment->prev == NULL);
   _mi_stat_decrease(&tld->stats->page_committed, segment->segment_info_size);
@@ -692,11 +1119,14 @@ static bool mi_segment_page_claim(mi_segment_t* segment, mi_page_t* page, mi_seg
   segment->used++;
   mi_assert_internal(page->segment_in_use && page->is_committed && page->used==0 && !mi_pages_purge_contains(page,tld));
   mi_assert_internal(segment->used <= segment->capacity);
-  if (segment->used == segment->capacity && segment->page_kind <= MI_PAGE_MEDIUM) {
+  if (segment->used == segment->capacity && segment->page_kind <= MI_PAGE_MLARGE) {
     // if no more free pages, remove from the queue
     mi_assert_internal(!mi_segment_has_free(segment));
     mi_segment_remove_from_free_queue(segment, tld);
   }
+  else if (segment->page_kind <= MI_PAGE_MLARGE) {
+    mi_segment_update_free_queue(segment, tld);
+  }
   return true;
 }
 
@@ -708,7 +1138,7 @@ static bool mi_segment_page_claim(mi_segment_t* segment, mi_page_t* page, mi_seg
 static void mi_segment_abandon(mi_segment_t* segment, mi_segments_tld_t* tld);
 
 // clear page data; can be called on abandoned segments
-static void mi_segment_page_clear(mi_segment_t* segment, mi_page_t* page, mi_segments_tld_t* tld)
+static void mi_segment_page_clear(mi_segment_t* segment, mi_page_t* page, const mi_heap_policy_t* policy, mi_segments_tld_t* tld)
 {
   mi_assert_internal(page->segment_in_use);
   mi_assert_internal(mi_page_all_free(page));
@@ -738,15 +1168,16 @@ static void mi_segment_page_clear(mi_segment_t* segment, mi_page_t* page, mi_seg
   page->heap_tag = heap_tag;
   page->page_start = page_start;
   segment->used--;
+  if (segment->page_kind <= MI_PAGE_MLARGE) { mi_segment_update_free_queue(segment, tld); }
 
   // schedule purge
-  mi_segment_schedule_purge(segment, page, tld);
+  mi_segment_schedule_purge(segment, page, policy, tld);
 
   page->capacity = 0;  // after purge these can be zero'd now
   page->reserved = 0;
 }
 
-void _mi_segment_page_free(mi_page_t* page, bool force, mi_segments_tld_t* tld)
+void _mi_segment_page_free(mi_page_t* page, bool force, const mi_heap_policy_t* policy, mi_segments_tld_t* tld)
 {
   mi_assert(page != NULL);
   mi_segment_t* segment = _mi_page_segment(page);
@@ -754,7 +1185,7 @@ void _mi_segment_page_free(mi_page_t* page, bool force, mi_segments_tld_t* tld)
   mi_pages_try_purge(false /*force?*/, tld);
 
   // mark it as free now
-  mi_segment_page_clear(segment, page, tld);
+  mi_segment_page_clear(segment, page, policy, tld);
 
   if (segment->used == 0) {
     // no more used pages; remove from the free list and free the segment
@@ -766,8 +1197,8 @@ void _mi_segment_page_free(mi_page_t* page, bool force, mi_segments_tld_t* tld)
       mi_segment_abandon(segment,tld);
     }
     else if (segment->used + 1 == segment->capacity) {
-      mi_assert_internal(segment->page_kind <= MI_PAGE_MEDIUM); // large and huge pages are always the single page in a segment
-      if (segment->page_kind <= MI_PAGE_MEDIUM) {
+      mi_assert_internal(segment->page_kind <= MI_PAGE_MLARGE); // large and huge pages are always the single page in a segment
+      if (segment->page_kind <= MI_PAGE_MLARGE) {
         // move back to segments  free list
         mi_segment_insert_in_free_queue(segment,tld);
       }
@@ -886,9 +1317,11 @@ static bool mi_segment_check_free(mi_segment_t* segment, size_t block_size, bool
 static mi_segment_t* mi_segment_reclaim(mi_segment_t* segment, mi_heap_t* heap, size_t requested_block_size, bool* right_page_reclaimed, mi_segments_tld_t* tld) {
   if (right_page_reclaimed != NULL) { *right_page_reclaimed = false; }
   // can be 0 still with abandoned_next, or already a thread id for segments outside an arena that are reclaimed on a free.
-  mi_assert_internal(mi_atomic_load_relaxed(&segment->thread_id) == 0 || mi_atomic_load_relaxed(&segment->thread_id) == _mi_thread_id());
+  mi_assert_internal(mi_atomic_load_relaxed(&segment->thread_id) == 0 || mi_atomic_load_relaxed(&segment->thread_id) == _mi_segment_owner_id(segment, _mi_thread_id()));
   mi_assert_internal(segment->subproc == heap->tld->segments.subproc); // only reclaim within the same subprocess
-  mi_atomic_store_release(&segment->thread_id, _mi_thread_id());
+  mi_assert_internal(!_mi_segment_is_foreign(segment));              // and within the same process
+  mi_atomic_store_release(&segment->thread_id, _mi_segment_owner_id(segment, _mi_thread_id()));
+  segment->fork_generation = mi_atomic_load_relaxed(&mi_fork_generation);
   segment->abandoned_visits = 0;
   segment->was_reclaimed = true;
   tld->reclaim_count++;
@@ -915,11 +1348,13 @@ static mi_segment_t* mi_segment_reclaim(mi_segment_t* segment, mi_heap_t* heap,
       }
       // associate the heap with this page, and allow heap thread delayed free again.
       mi_page_set_heap(page, target_heap);
-      _mi_page_use_delayed_free(page, MI_USE_DELAYED_FREE, true); // override never (after heap is set)
+      if (!mi_segment_is_shared(segment)) {  // pages in shared memory never use delayed free (see `mi_page_init`)
+        _mi_page_use_delayed_free(page, MI_USE_DELAYED_FREE, true); // override never (after heap is set)
+      }
       _mi_page_free_collect(page, false); // ensure used count is up to date
       if (mi_page_all_free(page)) {
         // if everything free already, clear the page directly
-        mi_segment_page_clear(segment, page, tld);  // reset is ok now
+        mi_segment_page_clear(segment, page, NULL, tld);  // reset is ok now
       }
       else {
         // otherwise reclaim it into the heap
@@ -943,7 +1378,7 @@ static mi_segment_t* mi_segment_reclaim(mi_segment_t* segment, mi_heap_t* heap,
     return NULL;
   }
   else {
-    if (segment->page_kind <= MI_PAGE_MEDIUM && mi_segment_has_free(segment)) {
+    if (segment->page_kind <= MI_PAGE_MLARGE && mi_segment_has_free(segment)) {
       mi_segment_insert_in_free_queue(segment, tld);
     }
     return segment;
@@ -951,26 +1386,57 @@ static mi_segment_t* mi_segment_reclaim(mi_segment_t* segment, mi_heap_t* heap,
 }
 
 
-// attempt to reclaim a particular segment (called from multi threaded free `alloc.c:mi_free_block_mt`)
-bool _mi_segment_attempt_reclaim(mi_heap_t* heap, mi_segment_t* segment) {
-  if (mi_atomic_load_relaxed(&segment->thread_id) != 0) return false;  // it is not abandoned
-  if (segment->subproc != heap->tld->segments.subproc)  return false;  // only reclaim within the same subprocess
-  if (!_mi_heap_memid_is_suitable(heap,segment->memid)) return false;  // don't reclaim between exclusive and non-exclusive arena's
+// Reclaiming an abandoned segment collects and reclaims all of its pages which is too much
+// work to do inside a `free`. Instead, a `free` in an abandoned segment just records a hint
+// (in constant time) and the segment is reclaimed in the next generic allocation of the thread
+// (see `_mi_segment_reclaim_hinted`). The hint is the arena block of the segment (or the segment
+// itself if it is outside an arena, which is only accessed if it is still in the abandoned list),
+// so we never access the segment memory unless it is still abandoned at that point.
+static bool mi_segment_can_reclaim_on_free(mi_heap_t* heap) {
   const long target = _mi_option_get_fast(mi_option_target_segments_per_thread);
   if (target > 0 && (size_t)target <= heap->tld->segments.count) return false; // don't reclaim if going above the target count
-
-  // don't reclaim more from a `free` call than half the current segments
+  // don't reclaim more from a `free` than half the current segments
   // this is to prevent a pure free-ing thread to start owning too many segments
-  // (but not for out-of-arena segments as that is the main way to be reclaimed for those)
-  if (segment->memid.memkind == MI_MEM_ARENA && heap->tld->segments.reclaim_count * 2 > heap->tld->segments.count) {
-    return false;
+  return (heap->tld->segments.reclaim_count * 2 <= heap->tld->segments.count);
+}
+
+// record a particular abandoned segment to be reclaimed (called from multi threaded free `free.c:mi_free_block_mt`)
+void _mi_segment_reclaim_hint(mi_heap_t* heap, mi_segment_t* segment) {
+  if (mi_atomic_load_relaxed(&segment->thread_id) != 0) return;  // it is not abandoned
+  if (_mi_segment_is_foreign(segment))                  return;  // only reclaim within the same process
+  if (segment->subproc != heap->tld->segments.subproc)  return;  // only reclaim within the same subprocess
+  if (_mi_segment_is_fork_orphan(segment))              return;  // leave frozen memory of before a fork alone
+  if (!_mi_heap_memid_is_suitable(heap,segment->memid)) return;  // don't reclaim between exclusive and non-exclusive arena's
+  if (!mi_segment_can_reclaim_on_free(heap))            return;
+  mi_segments_tld_t* const tld = &heap->tld->segments;
+  if (segment->memid.memkind != MI_MEM_ARENA) {
+    tld->reclaim_hint_arena = _mi_arena_id_none();
+    tld->reclaim_hint_os = segment;
   }
-  if (_mi_arena_segment_clear_abandoned(segment)) {  // atomically unabandon
-    mi_segment_t* res = mi_segment_reclaim(segment, heap, 0, NULL, &heap->tld->segments);
-    mi_assert_internal(res == segment);
-    return (res != NULL);
+  else {
+    tld->reclaim_hint_arena = segment->memid.mem.arena.id;
+    tld->reclaim_hint_block = segment->memid.mem.arena.block_index;
+    tld->reclaim_hint_os = NULL;
   }
-  return false;
+}
+
+// reclaim the segment recorded by `_mi_segment_reclaim_hint` (called from `page.c:_mi_malloc_generic`)
+void _mi_segment_reclaim_hinted(mi_heap_t* heap) {
+  mi_segments_tld_t* const tld = &heap->tld->segments;
+  const mi_arena_id_t arena_id = tld->reclaim_hint_arena;
+  mi_segment_t* const os_segment = tld->reclaim_hint_os;
+  if mi_likely(arena_id == _mi_arena_id_none() && os_segment == NULL) return;
+  tld->reclaim_hint_arena = _mi_arena_id_none();
+  tld->reclaim_hint_os = NULL;
+  if (!mi_segment_can_reclaim_on_free(heap)) return;
+  mi_segment_t* const segment = (os_segment != NULL ? _mi_arena_segment_os_clear_abandoned_hinted(os_segment, tld->subproc)
+                                                    : _mi_arena_segment_clear_abandoned_at_block(arena_id, tld->reclaim_hint_block, tld->subproc));
+  if (segment == NULL) return;  // no longer abandoned (or from another sub-process)
+  if (_mi_segment_is_fork_orphan(segment) || !_mi_heap_memid_is_suitable(heap, segment->memid)) {
+    _mi_arena_segment_mark_abandoned(segment);  // the arena block was reused for an unsuitable segment
+    return;
+  }
+  mi_segment_reclaim(segment, heap, 0, NULL, tld);
 }
 
 void _mi_abandoned_reclaim_all(mi_heap_t* heap, mi_segments_tld_t* tld) {
@@ -978,7 +1444,12 @@ void _mi_abandoned_reclaim_all(mi_heap_t* heap, mi_segments_tld_t* tld) {
   mi_arena_field_cursor_t current;
   _mi_arena_field_cursor_init(heap, tld->subproc, true /* visit all, blocking */, &current);
   while ((segment = _mi_arena_segment_clear_abandoned_next(&current)) != NULL) {
-    mi_segment_reclaim(segment, heap, 0, NULL, tld);
+    if (_mi_segment_is_fork_orphan(segment)) {
+      _mi_arena_segment_mark_abandoned(segment);  // leave frozen memory of before a fork alone
+    }
+    else {
+      mi_segment_reclaim(segment, heap, 0, NULL, tld);
+    }
   }
   _mi_arena_field_cursor_done(&current);
 }
@@ -1015,6 +1486,11 @@ static mi_segment_t* mi_segment_try_reclaim(mi_heap_t* heap, size_t block_size,
   while (segment_count_is_within_target(tld,NULL) && (max_tries-- > 0) && ((segment = _mi_arena_segment_clear_abandoned_next(&current)) != NULL))
   {
     mi_assert(segment->subproc == heap->tld->segments.subproc); // cursor only visits segments in our sub-process
+    if (_mi_segment_is_fork_orphan(segment)) {
+      // leave frozen memory of before a fork alone
+      _mi_arena_segment_mark_abandoned(segment);
+      continue;
+    }
     segment->abandoned_visits++;
     // todo: should we respect numa affinity for abandoned reclaim? perhaps only for the first visit?
     // todo: an arena exclusive heap will potentially visit many abandoned unsuitable segments and use many tries
@@ -1165,7 +1641,7 @@ static mi_segment_t* mi_segment_reclaim_or_alloc(mi_heap_t* heap, size_t block_s
     return segment;
   }
   // 2. otherwise allocate a fresh segment
-  return mi_segment_alloc(0, page_kind, page_shift, 0, heap->arena_id, tld);
+  return mi_segment_alloc(0, page_kind, page_shift, 0, heap->arena_id, _mi_heap_policy(heap), tld);
 }
 
 
@@ -1194,9 +1670,17 @@ static mi_page_t* mi_segment_page_alloc_in(mi_segment_t* segment, mi_segments_tl
 }
 
 static mi_page_t* mi_segment_page_try_alloc_in_queue(mi_heap_t* heap, mi_page_kind_t kind, mi_segments_tld_t* tld) {
-  // find an available segment the segment free queue
-  mi_segment_queue_t* const free_queue = mi_segment_free_queue_of_kind(kind, tld);
-  for (mi_segment_t* segment = free_queue->first; segment != NULL; segment = segment->next) {
+  // find an available segment in the segment free queues, starting with the fullest segments
+  for (size_t bucket = MI_SEGMENT_FREE_BUCKETS; bucket > 0; bucket--) {
+    mi_segment_queue_t* const free_queue = mi_segment_free_queue_of_kind(kind, bucket - 1, tld);
+    for (mi_segment_t* segment = free_queue->first; segment != NULL; segment = segment->next) {
+      if (_mi_arena_memid_is_suitable(segment->memid, heap->arena_id) && mi_segment_has_free(segment)) {
+        return mi_segment_page_alloc_in(segment, tld);
+      }
+    }
+  }
+  // or a segment in shared memory
+  for (mi_segment_t* segment = tld->shared_free[kind].first; segment != NULL; segment = segment->next) {
     if (_mi_arena_memid_is_suitable(segment->memid, heap->arena_id) && mi_segment_has_free(segment)) {
       return mi_segment_page_alloc_in(segment, tld);
     }
@@ -1231,6 +1715,10 @@ static mi_page_t* mi_segment_medium_page_alloc(mi_heap_t* heap, size_t block_siz
   return mi_segment_page_alloc(heap, block_size, MI_PAGE_MEDIUM, MI_MEDIUM_PAGE_SHIFT, tld);
 }
 
+static mi_page_t* mi_segment_mlarge_page_alloc(mi_heap_t* heap, size_t block_size, mi_segments_tld_t* tld) {
+  return mi_segment_page_alloc(heap, block_size, MI_PAGE_MLARGE, MI_MLARGE_PAGE_SHIFT, tld);
+}
+
 /* -----------------------------------------------------------
    large page allocation
 ----------------------------------------------------------- */
@@ -1246,9 +1734,9 @@ static mi_page_t* mi_segment_large_page_alloc(mi_heap_t* heap, size_t block_size
   return page;
 }
 
-static mi_page_t* mi_segment_huge_page_alloc(size_t size, size_t page_alignment, mi_arena_id_t req_arena_id, mi_segments_tld_t* tld)
+static mi_page_t* mi_segment_huge_page_alloc(size_t size, size_t page_alignment, mi_arena_id_t req_arena_id, const mi_heap_policy_t* policy, mi_segments_tld_t* tld)
 {
-  mi_segment_t* segment = mi_segment_alloc(size, MI_PAGE_HUGE, MI_SEGMENT_SHIFT + 1, page_alignment, req_arena_id, tld);
+  mi_segment_t* segment = mi_segment_alloc(size, MI_PAGE_HUGE, MI_SEGMENT_SHIFT + 1, page_alignment, req_arena_id, policy, tld);
   if (segment == NULL) return NULL;
   mi_assert_internal(mi_segment_page_size(segment) - segment->segment_info_size - (2*(MI_SECURE == 0 ? 0 : _mi_os_page_size())) >= size);
   #if MI_HUGE_PAGE_ABANDON
@@ -1278,6 +1766,30 @@ static mi_page_t* mi_segment_huge_page_alloc(size_t size, size_t page_alignment,
   return page;
 }
 
+// Shrink a huge page in place such that its block size becomes at least `block_size`,
+// and release the memory of the tail of the segment back to the arena or OS.
+// Returns `false` if no memory could be released.
+bool _mi_segment_huge_page_shrink(mi_segment_t* segment, mi_page_t* page, size_t block_size, mi_segments_tld_t* tld) {
+  mi_assert_internal(segment->page_kind == MI_PAGE_HUGE);
+  mi_assert_internal(segment == _mi_page_segment(page));
+  mi_assert_internal(page->used == 1);
+  mi_assert_internal(block_size <= page->block_size);
+  if (MI_SECURE != 0 || !page->is_committed) return false;  // keep the guard page at the end
+  uint8_t* const start = mi_segment_raw_page_start(segment, page, NULL);
+  size_t segment_size = (size_t)(start - (uint8_t*)segment) + block_size;
+  if (!_mi_arena_shrink(segment, segment->segment_size, &segment_size, true /* still committed */, &segment->memid)) return false;
+  mi_assert_internal(segment_size < segment->segment_size);
+  const size_t new_block_size = segment_size - (size_t)(start - (uint8_t*)segment);
+  mi_assert_internal(new_block_size >= block_size);
+  mi_segments_track_size(-((long)(segment->segment_size - segment_size)), tld);
+  _mi_stat_decrease(&tld->stats->page_committed, page->block_size - new_block_size);
+  _mi_segment_map_shrunk_at(segment, segment_size);
+  segment->segment_size = segment_size;
+  page->block_size = new_block_size;
+  page->block_size_shift = 0;
+  return true;
+}
+
 #if MI_HUGE_PAGE_ABANDON
 // free huge block from another thread
 void _mi_segment_huge_page_free(mi_segment_t* segment, mi_page_t* page, mi_block_t* block) {
@@ -1298,7 +1810,7 @@ void _mi_segment_huge_page_free(mi_segment_t* segment, mi_page_t* page, mi_block
     mi_assert(page->used == 0);
     mi_tld_t* tld = heap->tld;
     mi_segments_track_size((long)segment->segment_size, &tld->segments);
-    _mi_segment_page_free(page, true, &tld->segments);
+    _mi_segment_page_free(page, true, NULL, &tld->segments);
   }
 #if (MI_DEBUG!=0)
   else {
@@ -1314,7 +1826,7 @@ void _mi_segment_huge_page_reset(mi_segment_t* segment, mi_page_t* page, mi_bloc
   mi_assert_internal(segment == _mi_page_segment(page));
   mi_assert_internal(page->used == 1); // this is called just before the free
   mi_assert_internal(page->free == NULL);
-  if (segment->allow_decommit && page->is_committed) {
+  if (segment->allow_decommit && page->is_committed && !mi_huge_cache_accepts(segment->segment_size)) {  // don't reset if it can be cached for reuse
     size_t usize = mi_usable_size(block);
     if (usize > sizeof(mi_block_t)) {
       usize = usize - sizeof(mi_block_t);
@@ -1336,7 +1848,7 @@ mi_page_t* _mi_segment_page_alloc(mi_heap_t* heap, size_t block_size, size_t pag
     mi_assert_internal(page_alignment >= MI_SEGMENT_SIZE);
     //mi_assert_internal((MI_SEGMENT_SIZE % page_alignment) == 0);
     if (page_alignment < MI_SEGMENT_SIZE) { page_alignment = MI_SEGMENT_SIZE; }
-    page = mi_segment_huge_page_alloc(block_size, page_alignment, heap->arena_id, tld);
+    page = mi_segment_huge_page_alloc(block_size, page_alignment, heap->arena_id, _mi_heap_policy(heap), tld);
   }
   else if (block_size <= MI_SMALL_OBJ_SIZE_MAX) {
     page = mi_segment_small_page_alloc(heap, block_size, tld);
@@ -1344,11 +1856,14 @@ mi_page_t* _mi_segment_page_alloc(mi_heap_t* heap, size_t block_size, size_t pag
   else if (block_size <= MI_MEDIUM_OBJ_SIZE_MAX) {
     page = mi_segment_medium_page_alloc(heap, block_size, tld);
   }
+  else if (block_size <= MI_MLARGE_OBJ_SIZE_MAX) {
+    page = mi_segment_mlarge_page_alloc(heap, block_size, tld);
+  }
   else if (block_size <= MI_LARGE_OBJ_SIZE_MAX /* || mi_is_good_fit(block_size, MI_LARGE_PAGE_SIZE - sizeof(mi_segment_t)) */ ) {
     page = mi_segment_large_page_alloc(heap, block_size, tld);
   }
   else {
-    page = mi_segment_huge_page_alloc(block_size, page_alignment, heap->arena_id, tld);
+    page = mi_segment_huge_page_alloc(block_size, page_alignment, heap->arena_id, _mi_heap_policy(heap), tld);
   }
   mi_assert_expensive(page == NULL || mi_segment_is_valid(_mi_page_segment(page),tld));
   mi_assert_internal(page == NULL || (mi_segment_page_size(_mi_page_segment(page)) - (MI_SECURE == 0 ? 0 : _mi_os_page_size())) >= block_size);
@@ -27,11 +27,20 @@ we therefore test the API over various inputs. Please add more tests :-)
 #include <stdbool.h>
 #include <stdint.h>
 #include <errno.h>
+#include <string.h>
 
 #ifdef __cplusplus
 #include <vector>
 #endif
 
+#if !defined(_WIN32) && !defined(__wasi__)
+#include <unistd.h>    // fork
+#include <sys/wait.h>  // waitpid
+#include <sys/mman.h>  // mmap
+#include <sys/resource.h>  // setrlimit
+#include <pthread.h>   // pthread_create
+#endif
+
 #include "mimalloc.h"
 // #include "mimalloc/internal.h"
 #include "mimalloc/types.h" // for MI_DEBUG and MI_BLOCK_ALIGNMENT_MAX
@@ -51,6 +60,130 @@ bool test_stl_heap_allocator2(void);
 bool test_stl_heap_allocator3(void);
 bool test_stl_heap_allocator4(void);
 
+typedef struct reserve_done_info_s {
+  volatile int called;
+  int err;
+} reserve_done_info_t;
+
+void reserve_done(int err, void* arg) {
+  reserve_done_info_t* const info = (reserve_done_info_t*)arg;
+  info->err = err;
+  info->called++;
+}
+
+void pressure_handler(mi_pressure_t level, size_t size, void* arg) {
+  if (level == mi_pressure_moderate && size > 0) { (*(int*)arg)++; }
+}
+
+void pressure_release_handler(mi_pressure_t level, size_t size, void* arg) {
+  void** cache = (void**)arg;
+  if (level == mi_pressure_critical && size > 0 && *cache != NULL) {
+    mi_free(*cache);
+    *cache = NULL;
+  }
+}
+
+bool visit_reserved(const mi_heap_t* heap, const mi_heap_area_t* area, void* block, size_t block_size, void* arg) {
+  (void)heap; (void)block; (void)block_size;
+  *(size_t*)arg += area->reserved;
+  return true;
+}
+
+bool visit_find_block(const mi_heap_t* heap, const mi_heap_area_t* area, void* block, size_t block_size, void* arg) {
+  (void)heap; (void)area; (void)block_size;
+  if (block == NULL || block != *(void**)arg) return true;
+  *(void**)arg = NULL;  // found
+  return false;
+}
+
+bool visit_committed(const mi_heap_t* heap, const mi_heap_area_t* area, void* block, size_t block_size, void* arg) {
+  (void)heap; (void)block; (void)block_size;
+  *(size_t*)arg += area->committed;
+  return true;
+}
+
+#if !defined(_WIN32) && !defined(__wasi__)
+void* alloc_two(void* arg) {  // allocate two blocks in a thread and exit (abandoning the segment)
+  void** blocks = (void**)arg;
+  blocks[0] = mi_malloc(100);
+  blocks[1] = mi_malloc(100);
+  return NULL;
+}
+
+#define ABANDON_TAG  ((size_t)0xABA4D0)
+
+void* alloc_tagged(void* arg) {  // allocate tagged blocks in a thread and exit (abandoning its segments)
+  void** blocks = (void**)arg;
+  mi_heap_guarded_set_sample_rate(mi_heap_get_default(), 0, 0);  // a guarded block does not start at the visited block
+  for (int i = 0; i < 100; i++) {
+    blocks[i] = mi_malloc(200);
+    *(size_t*)blocks[i] = ABANDON_TAG;
+  }
+  return NULL;
+}
+
+bool visit_count_tagged(const mi_heap_t* heap, const mi_heap_area_t* area, void* block, size_t block_size, void* arg) {
+  (void)heap; (void)area; (void)block_size;
+  if (block != NULL && *(size_t*)block == ABANDON_TAG) { *(size_t*)arg += 1; }
+  return true;
+}
+
+typedef struct purge_abandon_info_s {
+  long   purge_delay;
+  size_t commit;
+} purge_abandon_info_t;
+
+void* free_with_purge_delay(void* arg) {  // free pages in a heap with a purge delay and exit (abandoning the segment)
+  purge_abandon_info_t* info = (purge_abandon_info_t*)arg;
+  mi_heap_policy_t policy;
+  mi_heap_policy_init(&policy);
+  policy.purge_delay = info->purge_delay;
+  mi_heap_t* heap = mi_heap_new_with_policy(&policy);
+  mi_heap_guarded_set_sample_rate(heap, 0, 0);  // guarded blocks are not in the same segment
+  void* keep = mi_heap_malloc(heap, 16);  // keep the segment alive (leaked)
+  void* ps[256];
+  for (int i = 0; i < 256; i++) { ps[i] = mi_heap_malloc(heap, 1024); }
+  for (int i = 0; i < 256; i++) { mi_free(ps[i]); }
+  mi_process_info(NULL, NULL, NULL, NULL, NULL, &info->commit, NULL, NULL);
+  mi_heap_delete(heap);
+  (void)keep;
+  return NULL;
+}
+
+typedef struct fork_orphan_info_s {
+  void* volatile block;
+  volatile int   done;
+} fork_orphan_info_t;
+
+void* alloc_until_done(void* arg) {  // allocate a block and keep the thread alive until done
+  fork_orphan_info_t* info = (fork_orphan_info_t*)arg;
+  void* block = mi_malloc(100);
+  info->block = block;
+  while (!info->done) { usleep(1000); }
+  mi_free(block);
+  return NULL;
+}
+
+void* commit_medium_chunks(void* arg) {  // allocate medium blocks in a fresh segment and purge one of their pages
+  size_t* commit = (size_t*)arg;
+  mi_heap_policy_t policy;
+  mi_heap_policy_init(&policy);
+  policy.eager_commit = false;
+  policy.purge_delay = 0;
+  mi_heap_t* heap = mi_heap_new_with_policy(&policy);
+  mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit[0], NULL, NULL);
+  void* p = mi_heap_malloc(heap, 32*MI_KiB);
+  void* q = mi_heap_malloc(heap, 48*MI_KiB);  // in another page so the segment stays alive
+  mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit[1], NULL, NULL);
+  mi_free(p);
+  mi_heap_collect(heap, true);
+  mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit[2], NULL, NULL);
+  mi_free(q);
+  mi_heap_delete(heap);
+  return NULL;
+}
+#endif
+
 bool mem_is_zero(uint8_t* p, size_t size) {
   if (p==NULL) return false;
   for (size_t i = 0; i < size; ++i) {
@@ -102,6 +235,20 @@ int main(void) {
     void* p = mi_malloc(67108872);
     mi_free(p);
   };
+  CHECK_BODY("calloc-reuse") {  // re-used (and possibly purged) memory must be zero'd
+    const size_t sizes[3] = { 48 * MI_KiB, 512 * MI_KiB, 16 * MI_MiB };
+    bool ok = true;
+    for (int i = 0; i < 3 && ok; i++) {
+      for (int j = 0; j < 3 && ok; j++) {
+        uint8_t* p = (uint8_t*)mi_calloc(1, sizes[i]);
+        ok = (p != NULL && mem_is_zero(p, sizes[i]));
+        if (p != NULL) { memset(p, 1, sizes[i]); }
+        mi_free(p);
+        mi_collect(true);
+      }
+    }
+    result = ok;
+  };
 
   // ---------------------------------------------------
   // Extended
@@ -263,12 +410,58 @@ int main(void) {
     }
     result = ok;
   }
+  CHECK_BODY("malloc-aligned-class") {  // 64-byte and 4KiB alignments use aligned size classes
+    bool ok = true;
+    for (size_t align = 64; align <= 4096 && ok; align *= 64) {
+      for (size_t size = 0; size <= 4*align && ok; size += 8) {
+        void* p[10];
+        for (int i = 0; i < 10 && ok; i++) {
+          p[i] = mi_malloc_aligned(size, align);
+          ok = (p[i] != NULL && ((uintptr_t)(p[i]) % align) == 0 && mi_usable_size(p[i]) >= size);
+          if (ok && size > 0 && (size % align) == 0) {
+            ok = (mi_usable_size(p[i]) < size + align);  // no over-allocation
+          }
+        }
+        for (int i = 0; i < 10 && ok; i++) {
+          mi_free(p[i]);
+        }
+      }
+    }
+    result = ok;
+  };
+  CHECK_BODY("malloc-aligned-small") {  // small alignments do not over-allocate at size class boundaries
+    mi_heap_t* heap = mi_heap_new();
+    mi_heap_guarded_set_sample_rate(heap, 0, 0);
+    bool ok = true;
+    for (size_t size = 64*MI_KiB; size <= 1024*MI_KiB && ok; size *= 2) {
+      void* p = mi_heap_malloc(heap, size);
+      void* q = mi_heap_malloc_aligned(heap, size, 16);
+      ok = (p != NULL && q != NULL && ((uintptr_t)q % 16) == 0 && mi_usable_size(q) == mi_usable_size(p));
+      mi_free(p);
+      mi_free(q);
+    }
+    mi_heap_delete(heap);
+    result = ok;
+  };
   CHECK_BODY("malloc-aligned-at1") {
     void* p = mi_malloc_aligned_at(48,32,0); result = (p != NULL && ((uintptr_t)(p) + 0) % 32 == 0); mi_free(p);
   };
   CHECK_BODY("malloc-aligned-at2") {
     void* p = mi_malloc_aligned_at(50,32,8); result = (p != NULL && ((uintptr_t)(p) + 8) % 32 == 0); mi_free(p);
   };
+  CHECK_BODY("malloc-aligned-at3") { // large alignments with an offset
+    bool ok = true;
+    const size_t offsets[4] = { 8, 64, 4096 + 16, MI_BLOCK_ALIGNMENT_MAX };
+    for (size_t align = 2 * MI_BLOCK_ALIGNMENT_MAX; align <= 16 * MI_BLOCK_ALIGNMENT_MAX && ok; align *= 2) {
+      for (int i = 0; i < 4 && ok; i++) {
+        uint8_t* p = (uint8_t*)mi_zalloc_aligned_at(1024 * 1024, align, offsets[i]);
+        ok = (p != NULL && ((uintptr_t)(p) + offsets[i]) % align == 0 && mem_is_zero(p, 1024 * 1024));
+        if (p != NULL) { p[1024 * 1024 - 1] = 1; }
+        mi_free(p);
+      }
+    }
+    result = ok;
+  };
   CHECK_BODY("memalign1") {
     void* p;
     bool ok = true;
@@ -321,12 +514,489 @@ int main(void) {
     result = (p != NULL && errno == 0);
     mi_free(p);
   };
+  CHECK_BODY("realloc-shrink-huge") {  // huge blocks shrink in place (except in secure mode)
+    mi_heap_t* heap = mi_heap_new();
+    mi_heap_guarded_set_sample_rate(heap, 0, 0);  // guarded blocks are not shrunk in place
+    bool ok = true;
+    for (size_t align = 0; align <= 4096 && ok; align += 4096) {
+      uint8_t* p = (uint8_t*)(align == 0 ? mi_heap_malloc(heap, 64 * MI_MiB) : mi_heap_malloc_aligned(heap, 64 * MI_MiB, align));
+      p[0] = p[10 * MI_MiB - 1] = p[40 * MI_MiB - 1] = 1;
+      uint8_t* q = (uint8_t*)mi_heap_realloc(heap, p, 40 * MI_MiB);
+      ok = ((MI_SECURE > 0 || (q == p && mi_usable_size(q) < 64 * MI_MiB)) && mi_usable_size(q) >= 40 * MI_MiB && q[0] == 1 && q[40 * MI_MiB - 1] == 1);
+      p = q;
+      q = (uint8_t*)mi_heap_realloc(heap, q, 10 * MI_MiB);
+      ok = ok && ((MI_SECURE > 0 || (q == p && mi_usable_size(q) < 40 * MI_MiB)) && mi_usable_size(q) >= 10 * MI_MiB && q[10 * MI_MiB - 1] == 1);
+      q = (uint8_t*)mi_heap_realloc(heap, q, 64 * MI_MiB);
+      ok = ok && (q != NULL && q[10 * MI_MiB - 1] == 1);
+      mi_free(q);
+    }
+    mi_heap_delete(heap);
+    result = ok;
+  };
 
   // ---------------------------------------------------
   // Heaps
   // ---------------------------------------------------
   CHECK("heap_destroy", test_heap1());
   CHECK("heap_delete", test_heap2());
+  CHECK_BODY("reserve-huge-async-done") {  // also run with MIMALLOC_RESERVE_HUGE_OS_PAGES_ASYNC=1 (see `test-api-reserve-async`)
+    reserve_done_info_t info = { 0, -1 };
+    mi_register_reserve_huge_os_pages_done(&reserve_done, &info);
+    #if !defined(_WIN32) && !defined(__wasi__)
+    for (int i = 0; i < 1000 && info.called == 0; i++) {  // wait for a pending reservation
+      usleep(10000);
+    }
+    #endif
+    int err = -1;
+    result = (info.called == 1 && mi_reserve_huge_os_pages_is_done(&err) && err == info.err);
+    mi_register_reserve_huge_os_pages_done(&reserve_done, &info);  // called again right away once done
+    result = result && (info.called == 2);
+  };
+  CHECK_BODY("pressure-purge-delay") {  // moderate pressure shortens the purge delay but does not purge right away
+    // note: this runs before the other pressure tests so it starts without pressure (which lasts for 2s after an event)
+    const long purge_delay = mi_option_get(mi_option_purge_delay);
+    const long purge_mult  = mi_option_get(mi_option_arena_purge_mult);
+    mi_collect(true);  // no pending purges
+    mi_option_set(mi_option_purge_delay, 10000);
+    mi_option_set(mi_option_arena_purge_mult, 1);
+    mi_arena_id_t arena1, arena2, arena3;
+    result = (mi_reserve_os_memory_ex(256*MI_MiB, false, false, true /* exclusive */, &arena1) == 0 &&
+              mi_reserve_os_memory_ex(256*MI_MiB, false, false, true /* exclusive */, &arena2) == 0);
+    mi_heap_t* heap1 = mi_heap_new_in_arena(arena1);
+    mi_heap_t* heap2 = mi_heap_new_in_arena(arena2);
+    // free a block before the pressure (which is purged after 10s)
+    void* p = mi_heap_malloc(heap1, 32*MI_MiB);
+    result = result && (p != NULL);
+    if (p != NULL) { memset(p, 1, 32*MI_MiB); }
+    mi_free(p);
+    size_t commit0 = 0;
+    mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit0, NULL, NULL);
+    // signal moderate pressure by committing over the threshold
+    mi_option_set(mi_option_commit_pressure_threshold, (long)((commit0 + 8*MI_MiB) / MI_KiB));
+    result = result && (mi_reserve_os_memory_ex(32*MI_MiB, true /* commit */, false, true /* exclusive */, &arena3) == 0);
+    mi_option_set(mi_option_commit_pressure_threshold, 0);
+    size_t commit1 = 0;
+    mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit1, NULL, NULL);
+    result = result && (commit1 >= commit0 + 24*MI_MiB);  // `p` is not purged yet
+    // a block freed under pressure is purged after 1s
+    void* q = mi_heap_malloc(heap2, 32*MI_MiB);
+    result = result && (q != NULL);
+    if (q != NULL) { memset(q, 1, 32*MI_MiB); }
+    mi_free(q);
+    size_t commit2 = 0;
+    mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit2, NULL, NULL);
+    size_t commit3 = commit2;
+    for (int i = 0; i < 500 && commit3 + 24*MI_MiB > commit2; i++) {  // wait for the purge of `q`
+      #if !defined(_WIN32) && !defined(__wasi__)
+      usleep(10000);
+      #endif
+      mi_collect(false);
+      mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit3, NULL, NULL);
+    }
+    result = result && (commit3 + 24*MI_MiB <= commit2);  // `q` is purged ...
+    result = result && (commit3 + 56*MI_MiB > commit2);   // ... but `p` is not
+    mi_heap_delete(heap1);
+    mi_heap_delete(heap2);
+    mi_option_set(mi_option_purge_delay, purge_delay);
+    mi_option_set(mi_option_arena_purge_mult, purge_mult);
+  };
+  CHECK_BODY("arena-purge-pending") {  // a delayed purge still runs after a purge in another arena
+    const long purge_delay = mi_option_get(mi_option_purge_delay);
+    const long purge_mult  = mi_option_get(mi_option_arena_purge_mult);
+    mi_collect(true);  // no pending purges
+    mi_option_set(mi_option_arena_purge_mult, 1);
+    mi_arena_id_t arena1, arena2;
+    result = (mi_reserve_os_memory_ex(256*MI_MiB, false, false, true /* exclusive */, &arena1) == 0 &&
+              mi_reserve_os_memory_ex(256*MI_MiB, false, false, true /* exclusive */, &arena2) == 0);
+    mi_heap_t* heap1 = mi_heap_new_in_arena(arena1);
+    mi_heap_t* heap2 = mi_heap_new_in_arena(arena2);
+    void* p = mi_heap_malloc(heap1, 32*MI_MiB);
+    void* q = mi_heap_malloc(heap2, 32*MI_MiB);
+    result = result && (p != NULL && q != NULL);
+    if (p != NULL) { memset(p, 1, 32*MI_MiB); }
+    if (q != NULL) { memset(q, 1, 32*MI_MiB); }
+    mi_option_set(mi_option_purge_delay, 500);
+    mi_free(p);
+    mi_option_set(mi_option_purge_delay, 50);
+    mi_free(q);  // purged first
+    size_t commit0 = 0;
+    mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit0, NULL, NULL);
+    size_t commit1 = commit0;
+    for (int i = 0; i < 500 && commit1 + 56*MI_MiB > commit0; i++) {  // wait for the purge of both
+      #if !defined(_WIN32) && !defined(__wasi__)
+      usleep(10000);
+      #endif
+      mi_collect(false);
+      mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit1, NULL, NULL);
+    }
+    result = result && (commit1 + 56*MI_MiB <= commit0);
+    mi_heap_delete(heap1);
+    mi_heap_delete(heap2);
+    mi_option_set(mi_option_purge_delay, purge_delay);
+    mi_option_set(mi_option_arena_purge_mult, purge_mult);
+  };
+  CHECK_BODY("pressure-commit-threshold") {
+    size_t current_commit = 0;
+    int called = 0;
+    mi_process_info(NULL, NULL, NULL, NULL, NULL, &current_commit, NULL, NULL);
+    mi_register_pressure_handler(&pressure_handler, &called);
+    mi_option_set(mi_option_commit_pressure_threshold, (long)((current_commit + 16*MI_MiB) / MI_KiB));
+    mi_arena_id_t arena_id;
+    result = (mi_reserve_os_memory_ex(64*MI_MiB, true /* commit */, false, true /* exclusive */, &arena_id) == 0);
+    mi_option_set(mi_option_commit_pressure_threshold, 0);
+    result = result && (called == 0);  // not called from inside the allocator ...
+    mi_collect(false);
+    result = result && (called == 1);  // ... but at the next safe point
+    mi_register_pressure_handler(NULL, NULL);
+  };
+  #if defined(__linux__)
+  CHECK_BODY("pressure-retry-on-oom") {  // the handler releases a cache so the failed allocation succeeds on retry
+    const pid_t pid = fork();
+    if (pid == 0) {
+      mi_option_set(mi_option_disallow_arena_alloc, 1);  // allocate directly from the OS
+      void* cache = mi_malloc(64*MI_MiB);
+      // limit the address space to what we use now plus a bit
+      size_t vm_pages = 0;
+      FILE* f = fopen("/proc/self/statm", "r");
+      if (f == NULL || fscanf(f, "%zu", &vm_pages) != 1) { _exit(2); }
+      fclose(f);
+      struct rlimit limit;
+      limit.rlim_cur = limit.rlim_max = (rlim_t)(vm_pages * (size_t)sysconf(_SC_PAGESIZE) + 32*MI_MiB);
+      if (setrlimit(RLIMIT_AS, &limit) != 0) { _exit(2); }
+      mi_register_pressure_handler(&pressure_release_handler, &cache);
+      void* p = mi_malloc(64*MI_MiB);
+      _exit(p != NULL && cache == NULL ? 0 : 1);
+    }
+    int status = 0;
+    result = (pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  };
+  #endif
+  CHECK_BODY("heap-policy-purge") {
+    mi_heap_policy_t policy;
+    mi_heap_policy_init(&policy);
+    policy.purge_delay = 0;  // purge immediately
+    policy.purge_decommits = true;
+    mi_heap_t* heap = mi_heap_new_with_policy(&policy);
+    void* keep = mi_heap_malloc(heap, 16);  // keep the segment alive
+    void* ps[64];
+    for (int i = 0; i < 64; i++) { ps[i] = mi_heap_malloc(heap, 1024); }
+    size_t commit_before = 0;
+    size_t commit_after = 0;
+    mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit_before, NULL, NULL);
+    for (int i = 0; i < 64; i++) { mi_free(ps[i]); }
+    mi_heap_collect(heap, false);
+    mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit_after, NULL, NULL);
+    result = (commit_after + 64*MI_KiB <= commit_before);
+    mi_free(keep);
+    mi_heap_delete(heap);
+  };
+  CHECK_BODY("heap-collect-ex") {  // an incremental collection stops at its target and resumes in the next call
+    mi_heap_t* heap = mi_heap_new();
+    void* keep = mi_heap_malloc(heap, 16);  // keep the segment alive
+    void* ps[3][64];
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 64; j++) { ps[i][j] = mi_heap_malloc(heap, (size_t)1024 << i); }
+    }
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 64; j++) { mi_free(ps[i][j]); }
+    }
+    int steps = 1;
+    while (mi_heap_collect_ex(heap, 0, 1) && steps < 1000) { steps++; }
+    result = (steps >= 3 && steps < 1000 && !mi_heap_collect_ex(heap, 0, 0) && !mi_heap_collect_ex(heap, 1000000000, 0));
+    mi_free(keep);
+    mi_heap_delete(heap);
+  };
+  CHECK_BODY("thread-idle-hint") {  // an idle hint purges the free pages of the thread
+    mi_heap_t* heap = mi_heap_new();
+    void* keep = mi_heap_malloc(heap, 16);  // keep the segment alive
+    void* ps[64];
+    for (int i = 0; i < 64; i++) { ps[i] = mi_heap_malloc(heap, 1024); }
+    size_t commit_before = 0;
+    size_t commit_after = 0;
+    mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit_before, NULL, NULL);
+    for (int i = 0; i < 64; i++) { mi_free(ps[i]); }
+    mi_thread_idle_hint();
+    mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit_after, NULL, NULL);
+    result = (commit_after + 64*MI_KiB <= commit_before);
+    mi_free(keep);
+    mi_heap_delete(heap);
+  };
+  CHECK_BODY("huge-segment-cache") {
+    mi_option_set(mi_option_huge_segment_cache, 64*MI_KiB);  // 64 MiB
+    void* p = mi_malloc(8*MI_MiB);
+    memset(p, 1, 8*MI_MiB);
+    mi_free(p);
+    void* q = mi_zalloc(8*MI_MiB);  // reuses the cached segment
+    result = (p == q && ((uint8_t*)q)[MI_MiB] == 0);
+    mi_free(q);
+    mi_collect(true);  // and releases it
+    mi_option_set(mi_option_huge_segment_cache, 0);
+  };
+  CHECK_BODY("heap-mlarge-page") {  // blocks up to MI_MLARGE_OBJ_SIZE_MAX do not take a whole segment
+    mi_heap_t* heap = mi_heap_new();
+    void* p = mi_heap_malloc(heap, 200*MI_KiB);
+    size_t reserved = 0;
+    mi_heap_visit_blocks(heap, false, &visit_reserved, &reserved);
+    result = (p != NULL && reserved >= 200*MI_KiB && reserved <= MI_MLARGE_PAGE_SIZE);
+    mi_heap_delete(heap);
+  };
+  CHECK_BODY("heap-churn-rate") {  // a size class that runs out of free blocks at a high rate is extended in larger steps
+    size_t committed[2] = { 0, 0 };
+    for (int i = 0; i < 2; i++) {
+      mi_heap_t* heap = mi_heap_new();
+      mi_heap_guarded_set_sample_rate(heap, 0, 0);  // guarded blocks are committed separately
+      for (int j = 0; j < 100; j++) {
+        if (i == 1) { mi_free(mi_malloc(4*MI_KiB)); }  // interleave slow path allocations so the size class is not hot
+        if (mi_heap_malloc(heap, 64) == NULL) { result = false; }
+      }
+      mi_heap_visit_blocks(heap, false, &visit_committed, &committed[i]);
+      mi_heap_destroy(heap);
+    }
+    result = result && (committed[0] > committed[1]);
+  };
+  #if !defined(_WIN32) && !defined(__wasi__)
+  CHECK_BODY("thread-idle-trim") {  // a thread that allocates again after being idle purges its free pages
+    mi_option_set(mi_option_idle_trim_delay, 20);
+    mi_heap_t* heap = mi_heap_new();
+    mi_heap_guarded_set_sample_rate(heap, 0, 0);  // guarded blocks are not in the same segment
+    void* keep = mi_heap_malloc(heap, 16);  // keep the segment alive
+    void* ps[256];  // spans several pages as the allocation after the idle period may reuse some
+    for (int i = 0; i < 256; i++) { ps[i] = mi_heap_malloc(heap, 1024); }
+    size_t commit_before = 0;
+    size_t commit_idle = 0;
+    size_t commit_after = 0;
+    for (int i = 0; i < 256; i++) { mi_free(ps[i]); }
+    mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit_before, NULL, NULL);
+    usleep(50*1000);
+    mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit_idle, NULL, NULL);
+    mi_heap_t* heap2 = mi_heap_new();
+    void* p = mi_heap_malloc(heap2, 16);  // a fresh heap always allocates through `_mi_malloc_generic`
+    mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit_after, NULL, NULL);
+    mi_option_set(mi_option_idle_trim_delay, 0);
+    result = (commit_idle + 64*MI_KiB > commit_before && commit_after + 64*MI_KiB <= commit_before);
+    mi_free(p);
+    mi_free(keep);
+    mi_heap_delete(heap2);
+    mi_heap_delete(heap);
+  };
+  CHECK_BODY("fork-freeze") {  // in the child, blocks allocated before the fork are left alone
+    char* p = (char*)mi_malloc(100);
+    strcpy(p, "parent");
+    mi_option_enable(mi_option_fork_freeze);
+    const pid_t pid = fork();
+    if (pid == 0) {
+      const bool shared = (strcmp(p, "parent") == 0);
+      mi_free(p);  // ignored
+      char* q = (char*)mi_malloc(100);
+      const bool ok = (shared && q != NULL && q != p);
+      mi_free(q);
+      _exit(ok ? 0 : 1);
+    }
+    mi_option_disable(mi_option_fork_freeze);
+    int status = 0;
+    result = (pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    mi_free(p);
+  };
+  CHECK_BODY("fork-orphan") {  // in the child, the forking thread keeps its heap and frees of other threads are ignored
+    mi_option_enable(mi_option_fork_handlers);
+    fork_orphan_info_t info = { NULL, 0 };
+    pthread_t thread;
+    result = (pthread_create(&thread, NULL, &alloc_until_done, &info) == 0);
+    while (result && info.block == NULL) { usleep(1000); }
+    void* p = mi_malloc(100);
+    const pid_t pid = fork();
+    if (pid == 0) {
+      void* found = p;
+      mi_heap_visit_blocks(mi_heap_get_default(), true, &visit_find_block, &found);
+      bool ok = (found == NULL);
+      mi_free(p);
+      found = p;
+      mi_heap_visit_blocks(mi_heap_get_default(), true, &visit_find_block, &found);
+      ok = ok && (found == p);
+      mi_free(info.block);  // the thread did not survive the fork
+      mi_collect(true);
+      _exit(ok ? 0 : 1);
+    }
+    int status = 0;
+    result = result && (pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    info.done = 1;
+    if (info.block != NULL) { pthread_join(thread, NULL); }
+    mi_free(p);
+  };
+  CHECK_BODY("reclaim-on-free") {  // a free in an abandoned segment reclaims it at the next generic allocation
+    mi_option_enable(mi_option_abandoned_reclaim_on_free);
+    void* blocks[2] = { NULL, NULL };
+    pthread_t thread;
+    result = (pthread_create(&thread, NULL, &alloc_two, blocks) == 0 && pthread_join(thread, NULL) == 0);
+    if (result) {
+      result = !mi_heap_check_owned(mi_heap_get_default(), blocks[1]);
+      mi_free(blocks[0]);
+      void* p = mi_malloc(3000);  // not a small allocation so it always goes through the generic path
+      result = (result && mi_heap_check_owned(mi_heap_get_default(), blocks[1]));
+      mi_free(p);
+    }
+    mi_free(blocks[1]);
+    mi_option_disable(mi_option_abandoned_reclaim_on_free);
+  };
+  CHECK_BODY("reclaim-on-free-os") {  // also for a segment outside an arena (in the abandoned OS list)
+    mi_option_enable(mi_option_abandoned_reclaim_on_free);
+    void* blocks[2] = { NULL, NULL };
+    pthread_t thread;
+    mi_option_enable(mi_option_disallow_arena_alloc);
+    result = (pthread_create(&thread, NULL, &alloc_two, blocks) == 0 && pthread_join(thread, NULL) == 0);
+    mi_option_disable(mi_option_disallow_arena_alloc);
+    if (result) {
+      result = !mi_heap_check_owned(mi_heap_get_default(), blocks[1]);
+      mi_free(blocks[0]);
+      void* p = mi_malloc(3000);
+      result = (result && mi_heap_check_owned(mi_heap_get_default(), blocks[1]));
+      mi_free(p);
+    }
+    mi_free(blocks[1]);
+    mi_option_disable(mi_option_abandoned_reclaim_on_free);
+  };
+  CHECK_BODY("abandoned-visit-threads") {  // visit abandoned blocks while other threads abandon theirs
+    mi_option_enable(mi_option_visit_abandoned);
+    void* blocks[8][100];
+    for (int os = 0; os < 2 && result; os++) {  // in arena's and outside (in the abandoned OS list)
+      mi_option_set_enabled(mi_option_disallow_arena_alloc, os == 1);
+      pthread_t threads[8];
+      for (int i = 0; i < 8; i++) {
+        if (pthread_create(&threads[i], NULL, &alloc_tagged, blocks[i]) != 0) { result = false; }
+      }
+      size_t count = 0;
+      mi_abandoned_visit_blocks(mi_subproc_main(), -1, true, &visit_count_tagged, &count);
+      for (int i = 0; i < 8; i++) {
+        if (pthread_join(threads[i], NULL) != 0) { result = false; }
+      }
+      mi_option_disable(mi_option_disallow_arena_alloc);
+      count = 0;
+      result = (result && mi_abandoned_visit_blocks(mi_subproc_main(), -1, true, &visit_count_tagged, &count) && count == 8*100);
+      for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 100; j++) { mi_free(blocks[i][j]); }
+      }
+    }
+    mi_option_disable(mi_option_visit_abandoned);
+  };
+  CHECK_BODY("heap-policy-never-purge-abandon") {  // free pages of a heap that never purges are not purged on abandonment either
+    mi_option_enable(mi_option_abandoned_page_purge);
+    size_t purged[2] = { 0, 0 };
+    for (int i = 0; i < 2; i++) {
+      purge_abandon_info_t info = { (i == 0 ? -1 : 60000), 0 };
+      mi_collect(true);  // so no pending purges of earlier tests expire while the thread runs
+      pthread_t thread;
+      result = (pthread_create(&thread, NULL, &free_with_purge_delay, &info) == 0 && pthread_join(thread, NULL) == 0);
+      size_t commit = 0;
+      mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit, NULL, NULL);
+      purged[i] = (info.commit > commit ? info.commit - commit : 0);
+      if (!result) break;
+    }
+    // the 256KiB that was freed in the heap is only purged with the finite purge delay
+    result = result && (purged[0] + 128*MI_KiB <= purged[1]);
+    mi_option_disable(mi_option_abandoned_page_purge);
+  };
+  CHECK_BODY("segment-commit-chunks") {  // medium pages commit and purge just the chunks they use
+    #if MI_SECURE < 2
+    mi_option_enable(mi_option_disallow_arena_alloc);  // allocate a fresh segment from the OS
+    size_t commit[3] = { 0, 0, 0 };
+    pthread_t thread;
+    result = (pthread_create(&thread, NULL, &commit_medium_chunks, commit) == 0 && pthread_join(thread, NULL) == 0);
+    mi_option_disable(mi_option_disallow_arena_alloc);
+    result = result && (commit[1] > commit[0] && commit[1] - commit[0] < MI_MEDIUM_PAGE_SIZE && commit[2] < commit[1]);
+    #endif
+  };
+  CHECK_BODY("shared-arena") {  // a child process frees a block of the parent in shared memory
+    const size_t size = 16 * MI_MiB;
+    uint8_t* base = (uint8_t*)mmap(NULL, size + 4*MI_MiB, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    uint8_t* start = (uint8_t*)(((uintptr_t)base + 4*MI_MiB - 1) & ~((uintptr_t)4*MI_MiB - 1));
+    mi_arena_id_t arena_id;
+    result = (base != MAP_FAILED && mi_manage_shared_memory(start, size, &arena_id));
+    if (result) {
+      mi_heap_t* heap = mi_heap_new_in_arena(arena_id);
+      char* p = (char*)mi_heap_malloc(heap, 100);
+      strcpy(p, "shared");
+      const bool in_use = !mi_unmanage_shared_memory(arena_id);  // cannot detach while we still have memory in it
+      const pid_t pid = fork();
+      if (pid == 0) {
+        mi_arena_id_t child_id;
+        const bool ok = (mi_manage_shared_memory(start, size, &child_id) && child_id == arena_id && strcmp(p, "shared") == 0);
+        mi_free(p);
+        _exit(ok ? 0 : 1);
+      }
+      int status = 0;
+      result = (in_use && pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+      mi_heap_collect(heap, true);
+      size_t reserved = 0;
+      mi_heap_visit_blocks(heap, false, &visit_reserved, &reserved);
+      result = (result && (uint8_t*)p >= start && (uint8_t*)p < start + size && reserved == 0);
+      mi_heap_delete(heap);
+      result = (result && mi_unmanage_shared_memory(arena_id) && !mi_unmanage_shared_memory(arena_id));
+    }
+    if (base != MAP_FAILED) { munmap(base, size + 4*MI_MiB); }
+  };
+  #endif
+  CHECK_BODY("heap-check-owned") {
+    mi_heap_t* heap = mi_heap_new();
+    int local = 0;
+    uint8_t* p = (uint8_t*)mi_heap_malloc(heap, 100);
+    uint8_t* q = (uint8_t*)mi_malloc(100);
+    uint8_t* h = (uint8_t*)mi_heap_malloc(heap, 8 * MI_MiB);
+    uint8_t* m = (uint8_t*)mi_malloc(64 * MI_MiB);
+    result = (mi_heap_check_owned(heap, p) && mi_heap_check_owned(heap, p + 8) && mi_heap_check_owned(heap, h + MI_MiB) &&
+              mi_heap_check_owned(heap, h + 6*MI_MiB) && mi_check_owned(m + 8*MI_MiB) && mi_check_owned(m + 64*MI_MiB - 8) &&
+              mi_is_in_heap_region(m + 40*MI_MiB) && !mi_heap_check_owned(heap, m + 8*MI_MiB) &&
+              !mi_heap_check_owned(heap, q) && mi_check_owned(q) && !mi_check_owned(p) && !mi_check_owned(&local) && !mi_check_owned(NULL));
+    mi_free(m);
+    mi_free(q);
+    mi_heap_delete(heap);
+  };
+  CHECK_BODY("heap-io-arena") {
+    mi_arena_id_t arena_id;
+    result = (mi_io_arena_new(16 * MI_MiB, MI_IO_ARENA_PREFAULT, &arena_id) == 0);
+    if (result) {
+      size_t size;
+      uint8_t* start = (uint8_t*)mi_arena_area(arena_id, &size);
+      mi_arena_range_t ranges[8];
+      result = (size == 16 * MI_MiB && mi_arena_ranges(arena_id, 0, ranges, 1) == 1 && ranges[0].start == start && ranges[0].size == size);
+      result = result && (mi_arena_ranges(arena_id, 4 * MI_MiB, ranges, 8) == 4 && ranges[3].start == start + 12 * MI_MiB && ranges[3].size == 4 * MI_MiB);
+      mi_heap_t* heap = mi_heap_new_in_arena(arena_id);
+      const size_t sizes[5] = { 1, 100, 4096, 10000, MI_MiB + 1 };
+      for (int i = 0; i < 5 && result; i++) {
+        uint8_t* p = (uint8_t*)mi_heap_zalloc_io(heap, sizes[i]);
+        result = (p != NULL && (uintptr_t)p % MI_IO_BLOCK_ALIGN == 0 && mi_usable_size(p) >= sizes[i] &&
+                  mem_is_zero(p, sizes[i]) && p >= start && p + sizes[i] <= start + size);
+        mi_free(p);
+      }
+      mi_heap_delete(heap);
+    }
+  };
+
+  #if MI_GUARDED_SAMPLING
+  CHECK_BODY("heap-guarded-sample") {  // guarded objects can be enabled at runtime in builds without padding
+    mi_heap_t* heap = mi_heap_new();
+    mi_heap_guarded_set_sample_rate(heap, 1, 0);
+    const size_t size = 200 * MI_KiB;    // large objects are allocated in fresh segments
+    void* ps[4];
+    for (int i = 0; i < 4; i++) {
+      ps[i] = mi_heap_malloc(heap, size);
+      result = result && (ps[i] != NULL && ((uintptr_t)ps[i] + size) % 4096 == 0 && mi_is_in_heap_region(ps[i]));
+      if (ps[i] != NULL) { memset(ps[i], i, size); }
+    }
+    #if !defined(_WIN32) && !defined(__wasi__)
+    if (result) {  // writing just beyond the object hits the guard page
+      const pid_t pid = fork();
+      if (pid == 0) {
+        ((volatile uint8_t*)ps[0])[size] = 1;
+        _exit(0);
+      }
+      int status = 0;
+      result = (pid > 0 && waitpid(pid, &status, 0) == pid && WIFSIGNALED(status));
+    }
+    #endif
+    for (int i = 0; i < 4; i++) { mi_free(ps[i]); }
+    mi_heap_delete(heap);
+  };
+  #endif
 
   //mi_stats_print(NULL);
 